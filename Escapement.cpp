@@ -3,7 +3,12 @@
 //
 // Description: Simple FTP based client program that takes a local directory and 
 // keeps it synchronised with a remote server directory. To save on FTP requests it can 
-// keep a local JSON file that contains a cache of remote file details.
+// keep a local (binary, memory mapped) file that contains a cache of remote file details;
+// an existing JSON cache is imported and the cache can be exported as JSON. File details
+// are held in shard files beside the cache file (one per group of top-level directories)
+// and changes made while synchronising are appended to a journal. Run with a job list
+// (--jobs) it becomes a daemon running every job listed, each polling on its own schedule,
+// on a shared pool of worker threads and per-server pool of transfer connections.
 // 
 // Escapement
 // Program Options:
@@ -16,10 +21,31 @@
 //   -r [ --remote ] arg    Remote server directory
 //   -l [ --local ] arg     Local directory
 //   -t [ --polltime ] arg  Server poll time in minutes
-//   -c [ --cache ] arg     JSON filename cache
+//   -c [ --cache ] arg     File cache
 //   -m [ --command ] arg   Command: 0 (Synchronise), 1 (Pull) , 2 (Refresh cache)
 //   -n [ --nossl ]         Switch off ssl for connection
+//   --noverify             Do not verify server TLS certificate
 //   -v [ --override ]      Override any command line options from cache file
+//   --connections arg      Number of parallel transfer connections
+//   --smallfile arg        Small file transfer lane threshold in bytes
+//   --segments arg         Number of connections per segmented download
+//   --segmentsize arg      Segmented download threshold in bytes
+//   --journal arg          Partial transfer journal file
+//   --resumesize arg       Resumable transfer threshold in bytes
+//   --buffersize arg       Transfer buffer size in bytes
+//   --compress             Compress transfers (MODE Z) where server supports it
+//   --append               Upload only the appended tail of files that have grown
+//   --persistent           Keep server connection open between polls
+//   --fullpull             Pull all files from server (not just missing/stale ones)
+//   --clockprobe           Measure server clock skew on pull by uploading a probe file
+//   --directio arg         Direct I/O (O_DIRECT) download threshold in bytes (0 == off)
+//   --cacheexport arg      Export file cache as JSON to file
+//   --serverconnections arg Maximum pooled transfer connections per server (0 == no limit)
+//   --priority arg         Job weight in fair share of server connections and bandwidth
+//   --minconnections arg   Server connections job is served first up to
+//   --maxconnections arg   Maximum server connections job may hold (0 == no limit)
+//   --jobs arg             Run as daemon for jobs in list file (one job's options per line)
+//   --jobthreads arg       Number of daemon worker threads running jobs
 //
 // Dependencies:
 //
@@ -39,6 +65,11 @@
 //
 
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <memory>
+#include <vector>
 
 //
 // Antik Classes
@@ -54,6 +85,9 @@
 #include "Escapement.hpp"
 #include "Escapement_CommandLine.hpp"
 #include "Escapement_Files.hpp"
+#include "Escapement_Daemon.hpp"
+#include "Escapement_Session.hpp"
+#include "Escapement_SessionPool.hpp"
 
 // =========
 // NAMESPACE
@@ -70,11 +104,36 @@ namespace Escapement {
 
     using namespace Escapement_CommandLine;
     using namespace Escapement_Files;
+    using namespace Escapement_Daemon;
+    using namespace Escapement_Session;
+    using namespace Escapement_SessionPool;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Interval between NOOP keepalives on a persistent server connection
+    //
+
+    static const std::chrono::seconds kKeepaliveInterval { 30 };
 
     // ===============
     // LOCAL FUNCTIONS
     // ===============
 
+    //
+    // Close pooled sessions and free cached TLS sessions; done before exit so that
+    // no SSL calls are left for static destruction.
+    //
+
+    static void closeSharedSessions(void) {
+
+        closeIdleSessions();
+        CSession::clearTLSSessionCache();
+
+    }
+
     //
     // Exit with error message/status.
     //
@@ -89,11 +148,45 @@ namespace Escapement {
     }
 
     //
-    // Set up FTP parameters and connect to server.
+    // Return true if server connection is still alive (answers NOOP); a dead
+    // connection is closed.
+    //
+
+    static bool isServerConnectionAlive(EscapementRunContext &runContext) {
+
+        try {
+            if (runContext.ftpServer.isConnected() && (runContext.ftpServer.noOperation() == 200)) {
+                return (true);
+            }
+        } catch (...) {
+        }
+
+        try {
+            if (runContext.ftpServer.isConnected()) {
+                runContext.ftpServer.disconnect();
+            }
+        } catch (...) {
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Set up FTP parameters and connect to server. A live persistent connection is
+    // reused as is and, once the remote directory has been checked/created, a
+    // reconnect only needs to change back to it.
     //
 
     static void connectToServer(EscapementRunContext &runContext) {
 
+        if (runContext.optionData.persistentSession && runContext.ftpServer.isConnected()) {
+            if (isServerConnectionAlive(runContext)) {
+                return;
+            }
+            std::cout << "*** Server connection lost, reconnecting... ***" << std::endl;
+        }
+
         try {
 
             // Set server and port
@@ -118,6 +211,15 @@ namespace Escapement {
 
             runContext.ftpServer.setBinaryTransfer(true);
 
+            // Reconnect so remote directory already checked/created and set to its server path
+
+            if (runContext.remoteDirectoryChecked) {
+                if (runContext.ftpServer.changeWorkingDirectory(runContext.optionData.remoteDirectory) != 250) {
+                    throw CFTP::Exception("Could not change to remote directory " + runContext.optionData.remoteDirectory);
+                }
+                return;
+            }
+
             // Remote directory does not exist so create
 
             if (!runContext.ftpServer.fileExists(runContext.optionData.remoteDirectory)) {
@@ -132,6 +234,7 @@ namespace Escapement {
 
             runContext.ftpServer.changeWorkingDirectory(runContext.optionData.remoteDirectory);
             runContext.ftpServer.getCurrentWoringDirectory(runContext.optionData.remoteDirectory);
+            runContext.remoteDirectoryChecked = true;
 
             std::cout << "*** Current Working Directory [" << runContext.optionData.remoteDirectory << "] ***" << std::endl;
 
@@ -184,14 +287,14 @@ namespace Escapement {
 
             // Save refreshed file lists
 
-            saveFilesAfterSynchronise(runContext);
+            saveFilesAfterRefresh(runContext);
 
         }
 
     }
 
     //
-    // Pull files from server.
+    // Pull files from server (only those missing or stale locally unless a full pull).
     //
 
     static void pullFilesFromServer(EscapementRunContext &runContext) {
@@ -212,9 +315,7 @@ namespace Escapement {
 
             getAllRemoteFiles(runContext);
 
-            for (auto &file : runContext.remoteFiles) {
-                runContext.filesToProcess.push_back(file.first);
-            }
+            selectFilesToPull(runContext);
 
             // Get non empty list
 
@@ -225,7 +326,11 @@ namespace Escapement {
 
             // Report disparity in number of files
 
-            if (runContext.localFiles.size() != runContext.remoteFiles.size()) {
+            auto filesMissing = std::count_if(runContext.remoteFiles.begin(), runContext.remoteFiles.end(), [&runContext] (const std::pair<const std::string, FileInfo> &file) {
+                return (!runContext.localFiles.count(convertFilePath(runContext.optionData, file.first)));
+            });
+
+            if (filesMissing) {
                 std::cerr << "Not all files pulled from FTP server." << std::endl;
                 if (!runContext.ftpServer.isConnected()) {
                     std::cerr << "FTP server disconnected unexpectedly." << std::endl;
@@ -237,126 +342,235 @@ namespace Escapement {
             runContext.ftpServer.disconnect();
 
             if (!runContext.filesToProcess.empty()) {
-
                 std::cout << "*** Files pulled from server ***\n" << std::endl;
+            } else {
+                std::cout << "*** No files pulled from server ***\n" << std::endl;
+            }
 
-                // Make remote modified time the same as local to enable sync to work.
+            // Save file lists after pull (pulled files carry their remote modified times)
 
-                for (auto &file : runContext.localFiles) {
-                    runContext.remoteFiles[convertFilePath(runContext.optionData, file.first)] = file.second;
-                }
+            if (!runContext.localFiles.empty()) {
+                saveFilesAfterRefresh(runContext);
+            }
 
-                // Save file lists after pull
+        }
 
-                saveFilesAfterSynchronise(runContext);
+    }
 
-            } else {
-                std::cout << "*** No files pulled from server ***\n" << std::endl;
-            }
+    //
+    // Wait poll time before next synchronise, keeping any persistent server connection
+    // alive with NOOPs. A connection found dead is closed and reopened at next connect.
+    //
+
+    static void waitForNextPoll(EscapementRunContext &runContext) {
+
+        auto pollEnd = std::chrono::steady_clock::now() + std::chrono::minutes(runContext.optionData.pollTime);
 
+        for (auto now = std::chrono::steady_clock::now(); now < pollEnd; now = std::chrono::steady_clock::now()) {
+            std::this_thread::sleep_for(std::min(std::chrono::duration_cast<std::chrono::steady_clock::duration>(kKeepaliveInterval), pollEnd - now));
+            if (runContext.optionData.persistentSession && runContext.ftpServer.isConnected() &&
+                (std::chrono::steady_clock::now() < pollEnd) && !isServerConnectionAlive(runContext)) {
+                std::cerr << "Escapement error: Server connection lost while waiting." << std::endl;
+            }
         }
 
     }
 
     //
-    // Synchronise files with server.
+    // Synchronise files with server (one pass).
     //
 
-    static void sychroniseFiles(EscapementRunContext &runContext) {
-
-        do {
+    static void sychroniseFilesOnce(EscapementRunContext &runContext) {
 
-            std::cout << "*** Sychronizing Files ***" << std::endl;
+        std::cout << "*** Sychronizing Files ***" << std::endl;
 
-            // Connect to server
+        // Connect to server
 
-            connectToServer(runContext);
+        connectToServer(runContext);
 
-            // If connection successful synchronise
+        // If connection successful synchronise
 
-            if (runContext.ftpServer.isConnected()) {
+        if (runContext.ftpServer.isConnected()) {
 
-                // Get local and remote file information for synchronise
+            // Get local and remote file information for synchronise
 
-                std::cout << "*** Getting local/remote file lists... ***" << std::endl;
+            std::cout << "*** Getting local/remote file lists... ***" << std::endl;
 
-                loadFilesBeforeSynchronise(runContext);
+            loadFilesBeforeSynchronise(runContext);
 
-                // PASS 1) Copy new/updated files to server
+            // PASS 1) Copy new/updated files to server
 
-                std::cout << "*** Determining new/updated file list..***" << std::endl;
+            std::cout << "*** Determining new/updated file list..***" << std::endl;
 
-                for (auto &file : runContext.localFiles) {
-                    auto remoteFile = runContext.remoteFiles.find(convertFilePath(runContext.optionData, file.first));
-                    if ((remoteFile == runContext.remoteFiles.end()) || (remoteFile->second < file.second)) {
-                        runContext.filesToProcess.push_back(file.first);
-                    }
+            for (auto &file : runContext.localFiles) {
+                auto remoteFile = runContext.remoteFiles.find(convertFilePath(runContext.optionData, file.first));
+                if ((remoteFile == runContext.remoteFiles.end()) || isLocalFileNewer(file.second, remoteFile->second)) {
+                    runContext.filesToProcess.push_back(file.first);
                 }
+            }
 
-                // Push non empty list
+            // Push non empty list
 
-                if (!runContext.filesToProcess.empty()) {
-                    std::cout << "*** Transferring " << runContext.filesToProcess.size() << " new/updated files to server ***" << std::endl;
-                    pushFiles(runContext);
-                }
+            if (!runContext.filesToProcess.empty()) {
+                std::cout << "*** Transferring " << runContext.filesToProcess.size() << " new/updated files to server ***" << std::endl;
+                pushFiles(runContext);
+            }
 
-                // PASS 2) Remove any deleted local files/directories from server and local cache
+            // PASS 2) Remove any deleted local files/directories from server and local cache
 
-                std::cout << "*** Determining local files deleted..***" << std::endl;
+            std::cout << "*** Determining local files deleted..***" << std::endl;
 
-                runContext.filesToProcess.clear();
-                for (auto &file : runContext.remoteFiles) {
-                    if (runContext.localFiles.find(convertFilePath(runContext.optionData, file.first)) == runContext.localFiles.end()) {
-                        runContext.filesToProcess.push_back(file.first);
-                    }
+            runContext.filesToProcess.clear();
+            for (auto &file : runContext.remoteFiles) {
+                if (runContext.localFiles.find(convertFilePath(runContext.optionData, file.first)) == runContext.localFiles.end()) {
+                    runContext.filesToProcess.push_back(file.first);
                 }
+            }
 
-                // Delete non empty list
+            // Delete non empty list
 
-                if (!runContext.filesToProcess.empty()) {
-                    std::cout << "*** Removing " << runContext.filesToProcess.size() << " deleted local files from server ***" << std::endl;
-                    deleteFiles(runContext);
-                }
+            if (!runContext.filesToProcess.empty()) {
+                std::cout << "*** Removing " << runContext.filesToProcess.size() << " deleted local files from server ***" << std::endl;
+                deleteFiles(runContext);
+            }
 
-                // Report disparity in number of files
+            // Report disparity in number of files
 
-                if (runContext.localFiles.size() != runContext.remoteFiles.size()) {
-                    std::cerr << "FTP server seems to be out of sync with local directory." << std::endl;
-                    if (!runContext.ftpServer.isConnected()) {
-                        std::cerr << "FTP server disconnected unexpectedly." << std::endl;
-                    }
+            if (runContext.localFiles.size() != runContext.remoteFiles.size()) {
+                std::cerr << "FTP server seems to be out of sync with local directory." << std::endl;
+                if (!runContext.ftpServer.isConnected()) {
+                    std::cerr << "FTP server disconnected unexpectedly." << std::endl;
                 }
+            }
 
-                // Disconnect 
+            // Disconnect (unless connection kept for next poll)
 
+            if (!runContext.optionData.persistentSession || !runContext.optionData.pollTime) {
                 runContext.ftpServer.disconnect();
+            }
 
-                // Saved file list after synchronise
-
-                if (runContext.totalFilesProcessed) {
-                    saveFilesAfterSynchronise(runContext);
-                    std::cout << "*** Files synchronised with server ***\n" << std::endl;
-                } else {
-                    std::cout << "*** No files synchronised. ***\n" << std::endl;
-                }
+            // Saved file list after synchronise
 
+            if (runContext.totalFilesProcessed) {
+                saveFilesAfterSynchronise(runContext);
+                std::cout << "*** Files synchronised with server ***\n" << std::endl;
+            } else {
+                std::cout << "*** No files synchronised. ***\n" << std::endl;
             }
 
-            // Wait poll interval (pollTime == 0 then one pass)
+        }
+
+    }
+
+    //
+    // Reset run context file lists for next synchronise (remote files are kept when
+    // cached as the cache is only loaded once).
+    //
+
+    static void resetForNextPoll(EscapementRunContext &runContext) {
+
+        runContext.localFiles.clear();
+        if (runContext.optionData.fileCache.empty()) {
+            runContext.remoteFiles.clear();
+        }
+        runContext.filesToProcess.clear();
+        runContext.totalFilesProcessed = 0;
+
+    }
+
+    //
+    // Synchronise files with server, repeating every poll interval (pollTime == 0 then
+    // one pass).
+    //
+
+    static void sychroniseFiles(EscapementRunContext &runContext) {
+
+        do {
+
+            sychroniseFilesOnce(runContext);
 
             if (runContext.optionData.pollTime) {
                 std::cout << "*** Waiting " << runContext.optionData.pollTime << " minutes for next synchronise... ***\n" << std::endl;
-                std::this_thread::sleep_for(std::chrono::minutes(runContext.optionData.pollTime));
-                runContext.localFiles.clear();
-                runContext.remoteFiles.clear();
-                runContext.filesToProcess.clear();
-                runContext.totalFilesProcessed = 0;
+                waitForNextPoll(runContext);
+                resetForNextPoll(runContext);
             }
 
         } while (runContext.optionData.pollTime);
 
     }
 
+    //
+    // Display run parameters.
+    //
+
+    static void displayRunParameters(const EscapementOptions &optionData) {
+
+        std::cout << "Server [" << optionData.serverName << "]" << " Port [" << optionData.serverPort << "]" << " User [" << optionData.userName << "]";
+        std::cout << " Remote Directory [" << optionData.remoteDirectory << "]" << " Local Directory [" << optionData.localDirectory << "]";
+        std::cout << " SSL [" << ((optionData.noSSL) ? "Off" : "On") << "]";
+        std::cout << " Connections [" << optionData.transferConnections << "]\n" << std::endl;
+
+    }
+
+    //
+    // Run daemon: every job in the job list is run on a shared pool of worker threads
+    // (synchronise jobs again every poll interval, pull and refresh jobs once). Jobs share
+    // the per-server session pool, taking its connection limit from the daemon unless
+    // they set their own; within that limit sessions are divided between jobs by their
+    // priority and minimum/maximum connections.
+    //
+
+    static void runDaemon(const EscapementOptions &daemonOptions) {
+
+        std::vector<std::unique_ptr<EscapementRunContext>> jobContexts;
+        CJobScheduler jobScheduler { daemonOptions.jobThreads };
+
+        for (auto &jobOptions : fetchJobListOptions(daemonOptions.jobListFile)) {
+
+            jobContexts.emplace_back(new EscapementRunContext());
+
+            EscapementRunContext &runContext { *jobContexts.back() };
+
+            runContext.optionData = jobOptions;
+            runContext.optionData.jobName = runContext.optionData.localDirectory + " <-> " +
+                    runContext.optionData.serverName + ":" + runContext.optionData.remoteDirectory;
+            if (runContext.optionData.serverConnections == 0) {
+                runContext.optionData.serverConnections = daemonOptions.serverConnections;
+            }
+
+            displayRunParameters(runContext.optionData);
+
+            std::chrono::minutes pollInterval { 0 };
+            if (runContext.optionData.command == kEscapementSynchronise) {
+                pollInterval = std::chrono::minutes(runContext.optionData.pollTime);
+            }
+
+            jobScheduler.addJob(runContext.optionData.jobName, pollInterval, [&runContext] () {
+                switch (runContext.optionData.command) {
+                    case kEscapementSynchronise:
+                        resetForNextPoll(runContext);
+                        sychroniseFilesOnce(runContext);
+                        break;
+                    case kEscapementPullFiles:
+                        pullFilesFromServer(runContext);
+                        break;
+                    case kEscapementRefreshCache:
+                        refreshFileCache(runContext);
+                        break;
+                }
+            });
+
+        }
+
+        std::cout << "*** Running " << jobContexts.size() << " jobs on " << daemonOptions.jobThreads << " threads ***\n" << std::endl;
+
+        jobScheduler.run();
+
+        closeSharedSessions();
+
+    }
+
+
     // ================
     // PUBLIC FUNCTIONS
     // ================
@@ -371,11 +585,16 @@ namespace Escapement {
 
             runContext.optionData = fetchCommandLineOptions(argc, argv);
 
+            // Daemon runs jobs from job list
+
+            if (!runContext.optionData.jobListFile.empty()) {
+                runDaemon(runContext.optionData);
+                return;
+            }
+
             // Display run parameters
 
-            std::cout << "Server [" << runContext.optionData.serverName << "]" << " Port [" << runContext.optionData.serverPort << "]" << " User [" << runContext.optionData.userName << "]";
-            std::cout << " Remote Directory [" << runContext.optionData.remoteDirectory << "]" << " Local Directory [" << runContext.optionData.localDirectory << "]";
-            std::cout << " SSL [" << ((runContext.optionData.noSSL) ? "Off" : "On") << "]\n" << std::endl;
+            displayRunParameters(runContext.optionData);
 
             switch (runContext.optionData.command) {
                 case kEscapementSynchronise:
@@ -388,7 +607,11 @@ namespace Escapement {
                     refreshFileCache(runContext);
                     break;
             }
+
+            closeSharedSessions();
+
         } catch (const std::exception &e) {
+            closeSharedSessions();
             exitWithError(e.what());
         }
 
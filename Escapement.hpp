@@ -8,6 +8,8 @@
 #include <string>
 #include <unordered_map>
 #include <deque>
+#include <cstdint>
+#include <ctime>
 
 //
 // Antik Classes
@@ -29,6 +31,29 @@ namespace Escapement {
     const int kEscapementPullFiles    { 1 };
     const int kEscapementRefreshCache { 2 };
     
+    //
+    // Default transfer settings
+    //
+    
+    const int kDefaultTransferConnections { 1 };                      // Parallel transfer connections
+    const std::uint64_t kDefaultSmallFileSize { 1024 * 1024 };        // Small file lane threshold (bytes)
+    const std::int64_t kUnknownFileSize { -1 };                       // File size not known
+    const int kDefaultDownloadSegments { 1 };                         // Connections per segmented download
+    const std::uint64_t kDefaultSegmentSize { 1024 * 1024 * 1024 };   // Segmented download threshold (bytes)
+    const std::uint64_t kDefaultResumeSize { 64 * 1024 * 1024 };      // Journaled (resumable) transfer threshold (bytes)
+    const size_t kDefaultIOBufferSize { 1024 * 1024 };                // Transfer buffer size (bytes)
+    const std::uint64_t kDefaultDirectIOSize { 0 };                   // Direct I/O download threshold (bytes, 0 == off)
+    
+    //
+    // Default daemon settings
+    //
+    
+    const int kDefaultJobThreads { 4 };                               // Worker threads running jobs
+    const int kDefaultServerConnections { 0 };                        // Transfer connections per server (0 == no limit)
+    const int kDefaultJobPriority { 1 };                              // Job weight in fair share of server connections
+    const int kDefaultMinConnections { 0 };                           // Connections a job is served first up to
+    const int kDefaultMaxConnections { 0 };                           // Connections a job may hold (0 == no limit)
+    
     //
     // Escapement decoded option argument data.
     //
@@ -45,13 +70,45 @@ namespace Escapement {
         std::string fileCache;                 // JSON file to hold remote/local file info
         int command { kEscapementSynchronise };// == 0 Synchronise, == 1 Pull , == 2 Refresh cache
         bool noSSL { false };                  // == true switch off default SSL connection
+        bool noVerify { false };               // == true do not verify server TLS certificate
         bool override { false };               // == true override any option values from cache file
+        int transferConnections { kDefaultTransferConnections }; // Number of parallel transfer connections
+        std::uint64_t smallFileSize { kDefaultSmallFileSize };   // Files below this size use small file lane
+        int downloadSegments { kDefaultDownloadSegments };       // Connections per segmented download (1 == off)
+        std::uint64_t segmentSize { kDefaultSegmentSize };       // Downloads of at least this size are segmented
+        std::string journalFile;                                 // Partial transfer journal ("" == no resume)
+        std::uint64_t resumeSize { kDefaultResumeSize };         // Transfers of at least this size are resumable
+        size_t ioBufferSize { kDefaultIOBufferSize };            // Transfer (double) buffer size in bytes
+        bool compress { false };                                 // == true use MODE Z for compressible files
+        bool appendUploads { false };                            // == true upload only appended tail of grown files
+        bool persistentSession { false };                        // == true keep server connection open between polls
+        bool fullPull { false };                                 // == true pull overwrites all local files (not incremental)
+        bool clockProbe { false };                               // == true measure server clock skew with an uploaded probe file
+        std::uint64_t directIOSize { kDefaultDirectIOSize };     // Downloads of at least this size bypass page cache (0 == off)
+        std::string cacheExport;                                 // JSON file cache is exported to ("" == no export)
+        std::string jobListFile;                                 // Daemon job list ("" == run single job)
+        int jobThreads { kDefaultJobThreads };                   // Daemon worker threads running jobs
+        int serverConnections { kDefaultServerConnections };     // Pooled transfer connections per server (0 == no limit)
+        std::string jobName;                                     // Daemon job name (fair share key, "" == single job)
+        int jobPriority { kDefaultJobPriority };                 // Job weight in fair share of server connections/bandwidth
+        int minConnections { kDefaultMinConnections };           // Job served before others until holding this many connections
+        int maxConnections { kDefaultMaxConnections };           // Most server connections job may hold (0 == no limit)
     };
 
+    //
+    // File information (last modified date/time, size and type)
+    //
+    
+    struct FileInfo {
+        Antik::FTP::CFTP::DateTime modified;    // Last modified date/time
+        std::int64_t size { kUnknownFileSize }; // Size in bytes (kUnknownFileSize if not known)
+        bool directory { false };               // == true entry is a directory
+        std::string fingerprint;                // Uploaded content fingerprint ("size:SHA-256") if known
+    };
 
-   // File information map (indexed by filename, value last modified date/time)
+   // File information map (indexed by filename, value file information)
 
-   typedef std::unordered_map<std::string, Antik::FTP::CFTP::DateTime> FileInfoMap;
+   typedef std::unordered_map<std::string, FileInfo> FileInfoMap;
 
    // Escapement run context (run options, file lists and ftp server data)
    
@@ -62,6 +119,7 @@ namespace Escapement {
         FileInfoMap remoteFiles;                // List of remote files
         Antik::FileList filesToProcess;         // List of files to be processed
         int totalFilesProcessed { 0 };          // Total files processed
+        bool remoteDirectoryChecked { false };  // == true remote directory exists and is its server path
     };
 
 } // namespace Escapement
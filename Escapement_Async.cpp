@@ -0,0 +1,1445 @@
+//
+// Class: CAsyncEngine
+//
+// Description: Event driven FTP engine used by Escapement where many independent
+// requests (directory listings and MDTM/SIZE queries) can be spread over many
+// connections. Each worker thread runs an epoll loop over the control and passive
+// data connections given to it.
+//
+// Each connection is a state machine: connect, greeting, explicit TLS (non-blocking
+// handshake, resuming the server's session where it can, to begin with the one cached
+// by CSession), login and binary mode, then operations taken from its server's queue
+// one at a time. Replies are matched to the handler set by the command that expects
+// them so no thread ever blocks on a server; a few threads can so drive hundreds of
+// sessions to any number of servers.
+//
+// Operation results are status codes in the same manner as CFTP/CSession; a
+// connection that fails reports status code 0 for its operation (and for any still
+// queued once a server has no connections left).
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : Sockets, epoll, eventfd.
+// OpenSSL            : TLS for control and data connections.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
+#include <thread>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+//
+// OpenSSL
+//
+
+#include <openssl/err.h>
+
+//
+// Escapement asynchronous engine
+//
+
+#include "Escapement_Async.hpp"
+#include "Escapement_Session.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Async {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+    using namespace Escapement_Session;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Channel read/write results other than a byte count
+    //
+
+    static const ssize_t kWouldBlock { -1 };
+    static const ssize_t kChannelError { -2 };
+
+    //
+    // Epoll events handled per wait, wait timeout (milliseconds) and seconds without
+    // progress before a busy connection is failed.
+    //
+
+    static const int kMaxEvents { 64 };
+    static const int kEventWaitTimeout { 1000 };
+    static const std::chrono::seconds kConnectionTimeout { 60 };
+
+    //
+    // Worker I/O buffer size and bytes moved on a data connection per event (so that one
+    // fast transfer does not starve the rest of the connections on its worker).
+    //
+
+    static const size_t kIOBufferSize { 256 * 1024 };
+    static const size_t kMaxBytesPerEvent { 1024 * 1024 };
+
+    //
+    // Control/data connection socket, any TLS layered on top of it and its progress
+    //
+
+    struct CAsyncEngine::Channel {
+        int socket { -1 };                      // Socket (-1 == closed)
+        SSL *ssl { nullptr };                   // TLS connection (nullptr if plain)
+        bool connecting { false };              // == true non-blocking connect in progress
+        bool handshaking { false };             // == true TLS handshake in progress
+        bool wantWrite { false };               // == true TLS waiting for socket to be writable
+        std::uint32_t events { 0 };             // Epoll events registered
+        Connection *connection { nullptr };     // Owning connection
+        bool dataChannel { false };             // == true data channel
+    };
+
+    //
+    // Connection state
+    //
+
+    enum class ConnectionState { connecting, idle, busy, closed };
+
+    //
+    // Server connection (control plus data channel) and the operation in progress on it
+    //
+
+    struct CAsyncEngine::Connection {
+        Server *server { nullptr };             // Server connected to
+        Worker *worker { nullptr };             // Worker driving connection
+        Channel control;                        // Control channel
+        Channel data;                           // Data channel
+        ConnectionState state { ConnectionState::connecting }; // Connection state
+        std::string input;                      // Unprocessed control input
+        std::string output;                     // Control output waiting to be sent
+        std::string response;                   // Reply being assembled
+        std::string replyCode;                  // Status code of reply being assembled
+        ReplyFn replyFn;                        // Handler for next reply
+        std::string passiveCommand { "EPSV" };  // Passive mode command (EPSV or PASV)
+        Operation operation;                    // Operation in progress
+        bool transferStarted { false };         // == true preliminary (1xx) reply received
+        bool dataStreaming { false };           // == true data being transferred
+        bool dataDone { false };                // == true data channel finished with
+        bool dataFailed { false };              // == true data transfer failed locally
+        bool replyDone { false };               // == true final transfer reply received
+        std::uint16_t finalStatusCode { 0 };    // Final transfer reply status code
+        std::string finalResponse;              // Final transfer reply
+        std::string dataBuffer;                 // Listing received
+        std::chrono::steady_clock::time_point lastActivity; // Last progress
+    };
+
+    //
+    // Engine thread, its event loop and connections
+    //
+
+    struct CAsyncEngine::Worker {
+
+        ~Worker() {
+            if (epollFd != -1) {
+                ::close(epollFd);
+            }
+            if (wakeFd != -1) {
+                ::close(wakeFd);
+            }
+        }
+
+        int epollFd { -1 };                         // Epoll instance
+        int wakeFd { -1 };                          // Wake up event (operations queued/stop)
+        std::thread thread;                         // Worker thread
+        std::vector<Connection *> connections;      // Connections driven by worker
+        std::vector<Connection *> newConnections;   // Connections to start (engine mutex)
+        std::vector<char> ioBuffer;                 // Data transfer buffer
+    };
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Set the name the server certificate must match (an IP address or host name).
+    //
+
+    static bool setCertificateName(SSL *ssl, const std::string &serverName) {
+
+        if (X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), serverName.c_str()) == 1) {
+            return (true);
+        }
+
+        return (SSL_set1_host(ssl, serverName.c_str()) == 1);
+
+    }
+
+    //
+    // Wake worker from its event wait.
+    //
+
+    static void wakeWorker(int wakeFd) {
+
+        std::uint64_t wakeCount { 1 };
+
+        if (::write(wakeFd, &wakeCount, sizeof (wakeCount)) == -1) {
+            return;
+        }
+
+    }
+
+    //
+    // Return data port from passive mode (EPSV/PASV) reply ("" if not in passive mode).
+    // The address given in a PASV reply is ignored in favour of the server address.
+    //
+
+    static std::string passiveDataPort(std::uint16_t statusCode, const std::string &response) {
+
+        if (statusCode == 229) {
+            size_t portStart = response.find("|||");
+            if (portStart != std::string::npos) {
+                return (std::to_string(std::atoi(response.c_str() + portStart + 3)));
+            }
+        } else if (statusCode == 227) {
+            size_t addressStart = response.find_first_of("0123456789", 4);
+            std::vector<int> addressFields;
+            while ((addressStart != std::string::npos) && (addressFields.size() < 6)) {
+                size_t addressEnd;
+                addressFields.push_back(std::stoi(response.substr(addressStart), &addressEnd));
+                addressStart = response.find_first_of("0123456789", addressStart + addressEnd);
+            }
+            if (addressFields.size() == 6) {
+                return (std::to_string(addressFields[4] * 256 + addressFields[5]));
+            }
+        }
+
+        return ("");
+
+    }
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Read from channel returning bytes read, 0 at end of stream, kWouldBlock if nothing
+    // to read yet or kChannelError.
+    //
+
+    ssize_t CAsyncEngine::readChannel(Channel &channel, void *buffer, size_t length) {
+
+        if (channel.ssl != nullptr) {
+            ERR_clear_error();
+            int bytesRead = SSL_read(channel.ssl, buffer, length);
+            if (bytesRead > 0) {
+                return (bytesRead);
+            }
+            switch (SSL_get_error(channel.ssl, bytesRead)) {
+                case SSL_ERROR_WANT_READ:
+                    channel.wantWrite = false;
+                    return (kWouldBlock);
+                case SSL_ERROR_WANT_WRITE:
+                    channel.wantWrite = true;
+                    return (kWouldBlock);
+                case SSL_ERROR_ZERO_RETURN:
+                    return (0);
+                case SSL_ERROR_SYSCALL:
+                    return ((bytesRead == 0) ? 0 : kChannelError);
+                default:
+                    return (kChannelError);
+            }
+        }
+
+        ssize_t bytesRead = ::recv(channel.socket, buffer, length, 0);
+        if (bytesRead == -1) {
+            return (((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? kWouldBlock : kChannelError);
+        }
+
+        return (bytesRead);
+
+    }
+
+    //
+    // Write to channel returning bytes written, kWouldBlock if it cannot take any now
+    // or kChannelError.
+    //
+
+    ssize_t CAsyncEngine::writeChannel(Channel &channel, const void *buffer, size_t length) {
+
+        if (channel.ssl != nullptr) {
+            ERR_clear_error();
+            int bytesWritten = SSL_write(channel.ssl, buffer, length);
+            if (bytesWritten > 0) {
+                return (bytesWritten);
+            }
+            switch (SSL_get_error(channel.ssl, bytesWritten)) {
+                case SSL_ERROR_WANT_READ:
+                    channel.wantWrite = false;
+                    return (kWouldBlock);
+                case SSL_ERROR_WANT_WRITE:
+                    channel.wantWrite = true;
+                    return (kWouldBlock);
+                default:
+                    return (kChannelError);
+            }
+        }
+
+        ssize_t bytesWritten = ::send(channel.socket, buffer, length, MSG_NOSIGNAL);
+        if (bytesWritten == -1) {
+            return (((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? kWouldBlock : kChannelError);
+        }
+
+        return (bytesWritten);
+
+    }
+
+    //
+    // Continue TLS handshake on channel. Returns 1 when complete, 0 if waiting on the
+    // socket and -1 if it failed.
+    //
+
+    int CAsyncEngine::continueHandshake(Channel &channel) {
+
+        ERR_clear_error();
+
+        int handshakeResult = SSL_connect(channel.ssl);
+        if (handshakeResult == 1) {
+            return (1);
+        }
+
+        switch (SSL_get_error(channel.ssl, handshakeResult)) {
+            case SSL_ERROR_WANT_READ:
+                channel.wantWrite = false;
+                return (0);
+            case SSL_ERROR_WANT_WRITE:
+                channel.wantWrite = true;
+                return (0);
+            default:
+                return (-1);
+        }
+
+    }
+
+    //
+    // Queue operation for server and wake workers. An operation for a server with no
+    // connections left is completed at once with status code 0.
+    //
+
+    void CAsyncEngine::queueOperation(int server, Operation &&operation) {
+
+        {
+            std::unique_lock<std::mutex> engineLock(m_engineMutex);
+            Server &operationServer = *m_servers.at(server);
+            if (operationServer.liveConnections > 0) {
+                operationServer.operations.push_back(std::move(operation));
+                m_outstanding++;
+                engineLock.unlock();
+                for (auto &worker : m_workers) {
+                    wakeWorker(worker->wakeFd);
+                }
+                return;
+            }
+        }
+
+        AsyncResult result;
+        result.response = "No connection to server.";
+        operation.completionFn(result);
+
+    }
+
+    //
+    // Worker event loop.
+    //
+
+    void CAsyncEngine::runWorker(Worker &worker) {
+
+        std::vector<struct epoll_event> events(kMaxEvents);
+
+        worker.ioBuffer.resize(kIOBufferSize);
+
+        for (;;) {
+
+            std::vector<Connection *> newConnections;
+
+            {
+                std::lock_guard<std::mutex> engineLock(m_engineMutex);
+                if (m_stopping) {
+                    break;
+                }
+                newConnections.swap(worker.newConnections);
+            }
+
+            for (auto connection : newConnections) {
+                worker.connections.push_back(connection);
+                startConnection(*connection);
+            }
+
+            dispatchOperations(worker);
+
+            int eventCount = epoll_wait(worker.epollFd, events.data(), events.size(), kEventWaitTimeout);
+
+            for (int event = 0; event < eventCount; event++) {
+                if (events[event].data.ptr == nullptr) {
+                    std::uint64_t wakeCount;
+                    if (::read(worker.wakeFd, &wakeCount, sizeof (wakeCount)) == -1) {
+                        continue;
+                    }
+                    continue;
+                }
+                Channel &channel = *static_cast<Channel *> (events[event].data.ptr);
+                Connection &connection = *channel.connection;
+                if ((connection.state == ConnectionState::closed) || (channel.socket == -1)) {
+                    continue;
+                }
+                if (channel.dataChannel) {
+                    handleData(connection, events[event].events);
+                } else {
+                    handleControl(connection, events[event].events);
+                }
+                updateInterest(connection);
+            }
+
+            checkTimeouts(worker);
+
+        }
+
+    }
+
+    //
+    // Start non-blocking connect of control channel to server.
+    //
+
+    void CAsyncEngine::startConnection(Connection &connection) {
+
+        struct epoll_event controlEvent {};
+
+        connection.lastActivity = std::chrono::steady_clock::now();
+
+        connection.control.socket = socket(connection.server->address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if ((connection.control.socket == -1) ||
+            ((::connect(connection.control.socket, reinterpret_cast<struct sockaddr *> (&connection.server->address), connection.server->addressLength) != 0) &&
+            (errno != EINPROGRESS))) {
+            failConnection(connection, "Could not connect to " + connection.server->optionData.serverName + ":" + connection.server->optionData.serverPort);
+            return;
+        }
+
+        connection.control.connecting = true;
+        connection.control.events = EPOLLOUT;
+        controlEvent.events = connection.control.events;
+        controlEvent.data.ptr = &connection.control;
+        epoll_ctl(connection.worker->epollFd, EPOLL_CTL_ADD, connection.control.socket, &controlEvent);
+
+        connection.replyFn = [this] (Connection &connection, std::uint16_t statusCode) {
+            if (statusCode != 220) {
+                failConnection(connection, "Server refused connection [" + connection.response + "]");
+            } else if (!connection.server->optionData.noSSL) {
+                sendCommand(connection, "AUTH TLS", [this] (Connection &connection, std::uint16_t statusCode) {
+                    if (statusCode != 234) {
+                        failConnection(connection, "Server refused TLS [" + connection.response + "]");
+                        return;
+                    }
+                    SSL_SESSION *cachedSession { nullptr };
+                    {
+                        std::lock_guard<std::mutex> engineLock(m_engineMutex);
+                        if ((connection.server->tlsSession != nullptr) && SSL_SESSION_up_ref(connection.server->tlsSession)) {
+                            cachedSession = connection.server->tlsSession;
+                        }
+                    }
+                    startTLS(connection.control, cachedSession);
+                    SSL_SESSION_free(cachedSession);
+                });
+            } else {
+                login(connection);
+            }
+        };
+
+    }
+
+    //
+    // Start queued operations on idle connections.
+    //
+
+    void CAsyncEngine::dispatchOperations(Worker &worker) {
+
+        for (auto connection : worker.connections) {
+            if (connection->state == ConnectionState::idle) {
+                Operation operation;
+                {
+                    std::lock_guard<std::mutex> engineLock(m_engineMutex);
+                    if (connection->server->operations.empty()) {
+                        continue;
+                    }
+                    operation = std::move(connection->server->operations.front());
+                    connection->server->operations.pop_front();
+                }
+                startOperation(*connection, std::move(operation));
+                updateInterest(*connection);
+            }
+        }
+
+    }
+
+    //
+    // Handle control channel events: connect completion, TLS handshake progress, replies
+    // and sending of queued commands.
+    //
+
+    void CAsyncEngine::handleControl(Connection &connection, std::uint32_t events) {
+
+        connection.lastActivity = std::chrono::steady_clock::now();
+
+        if (connection.control.connecting) {
+            int socketError { 0 };
+            socklen_t socketErrorLength = sizeof (socketError);
+            if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                return;
+            }
+            if ((getsockopt(connection.control.socket, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorLength) != 0) || (socketError != 0)) {
+                failConnection(connection, "Could not connect to " + connection.server->optionData.serverName + ":" + connection.server->optionData.serverPort);
+                return;
+            }
+            connection.control.connecting = false;
+        }
+
+        if (connection.control.handshaking) {
+            int handshakeResult = continueHandshake(connection.control);
+            if (handshakeResult < 0) {
+                failConnection(connection, "TLS handshake with " + connection.server->optionData.serverName + " failed.");
+            } else if (handshakeResult > 0) {
+                connection.control.handshaking = false;
+                login(connection);
+            }
+            return;
+        }
+
+        for (;;) {
+            char buffer[4096];
+            ssize_t bytesRead = readChannel(connection.control, buffer, sizeof (buffer));
+            if (bytesRead > 0) {
+                connection.input.append(buffer, bytesRead);
+            } else if (bytesRead == kWouldBlock) {
+                break;
+            } else {
+                failConnection(connection, (bytesRead == 0) ? "Server closed control connection." : "Control connection read failed.");
+                return;
+            }
+        }
+
+        handleReplies(connection);
+        flushControl(connection);
+
+    }
+
+    //
+    // Pass each complete (possibly multi-line) reply received to the handler set by the
+    // command expecting it. An unexpected 421 (server closing) fails the connection.
+    //
+
+    void CAsyncEngine::handleReplies(Connection &connection) {
+
+        for (;;) {
+
+            if ((connection.state == ConnectionState::closed) || connection.control.handshaking) {
+                return;
+            }
+
+            size_t lineEnd = connection.input.find('\n');
+            if (lineEnd == std::string::npos) {
+                return;
+            }
+
+            std::string line { connection.input.substr(0, lineEnd + 1) };
+            connection.input.erase(0, lineEnd + 1);
+            connection.response += line;
+
+            if (connection.replyCode.empty()) {
+                if ((line.size() < 4) || !std::isdigit(line[0]) || !std::isdigit(line[1]) || !std::isdigit(line[2])) {
+                    failConnection(connection, "Invalid server reply [" + line + "]");
+                    return;
+                }
+                connection.replyCode = line.substr(0, 3);
+                if (line[3] == '-') {
+                    continue;
+                }
+            } else if ((line.compare(0, 3, connection.replyCode) != 0) || (line.size() < 4) || (line[3] != ' ')) {
+                continue;
+            }
+
+            std::uint16_t statusCode = std::stoi(connection.replyCode);
+            ReplyFn replyFn { std::move(connection.replyFn) };
+
+            connection.replyCode.clear();
+            connection.replyFn = nullptr;
+
+            if (replyFn) {
+                replyFn(connection, statusCode);
+            } else if (statusCode == 421) {
+                failConnection(connection, "Server closed connection [" + connection.response + "]");
+                return;
+            }
+
+            connection.response.clear();
+
+        }
+
+    }
+
+    //
+    // Send as much queued control output as the channel will take.
+    //
+
+    void CAsyncEngine::flushControl(Connection &connection) {
+
+        if ((connection.state == ConnectionState::closed) || connection.control.connecting || connection.control.handshaking) {
+            return;
+        }
+
+        while (!connection.output.empty()) {
+            ssize_t bytesWritten = writeChannel(connection.control, connection.output.data(), connection.output.size());
+            if (bytesWritten == kWouldBlock) {
+                return;
+            } else if (bytesWritten < 0) {
+                failConnection(connection, "Control connection write failed.");
+                return;
+            }
+            connection.output.erase(0, bytesWritten);
+        }
+
+    }
+
+    //
+    // Register the epoll events each channel of connection is now waiting on.
+    //
+
+    void CAsyncEngine::updateInterest(Connection &connection) {
+
+        if (connection.state == ConnectionState::closed) {
+            return;
+        }
+
+        auto channelEvents = [] (Channel &channel, std::uint32_t streamEvents) -> std::uint32_t {
+            if (channel.connecting) {
+                return (EPOLLOUT);
+            } else if (channel.handshaking || ((channel.ssl != nullptr) && channel.wantWrite)) {
+                return ((channel.wantWrite) ? EPOLLOUT : EPOLLIN);
+            }
+            return (streamEvents);
+        };
+
+        auto registerEvents = [&connection] (Channel &channel, std::uint32_t events) {
+            if (events != channel.events) {
+                struct epoll_event channelEvent {};
+                channelEvent.events = events;
+                channelEvent.data.ptr = &channel;
+                epoll_ctl(connection.worker->epollFd, EPOLL_CTL_MOD, channel.socket, &channelEvent);
+                channel.events = events;
+            }
+        };
+
+        registerEvents(connection.control, channelEvents(connection.control, (connection.output.empty()) ? EPOLLIN : (EPOLLIN | EPOLLOUT)));
+
+        if (connection.data.socket != -1) {
+            registerEvents(connection.data, channelEvents(connection.data, (connection.dataStreaming) ? static_cast<std::uint32_t> (EPOLLIN) : 0));
+        }
+
+    }
+
+    //
+    // Fail connections that are waiting on a server which has stopped responding.
+    //
+
+    void CAsyncEngine::checkTimeouts(Worker &worker) {
+
+        auto now = std::chrono::steady_clock::now();
+
+        for (auto connection : worker.connections) {
+            if ((connection->state == ConnectionState::connecting) || (connection->state == ConnectionState::busy)) {
+                if ((now - connection->lastActivity) > kConnectionTimeout) {
+                    failConnection(*connection, "Server timed out.");
+                }
+            }
+        }
+
+    }
+
+    //
+    // Queue command on control channel and set the handler for its reply.
+    //
+
+    void CAsyncEngine::sendCommand(Connection &connection, const std::string &commandLine, ReplyFn replyFn) {
+
+        connection.output += commandLine + "\r\n";
+        connection.replyFn = replyFn;
+
+        flushControl(connection);
+
+    }
+
+    //
+    // Start TLS handshake on a connected channel, offering to resume session (if any) for
+    // an abbreviated handshake. The handshake is then advanced as the socket allows.
+    //
+
+    void CAsyncEngine::startTLS(Channel &channel, SSL_SESSION *session) {
+
+        channel.ssl = SSL_new(m_sslContext);
+        if (channel.ssl == nullptr) {
+            failConnection(*channel.connection, "Could not create TLS connection.");
+            return;
+        }
+
+        const Escapement::EscapementOptions &optionData { channel.connection->server->optionData };
+
+        SSL_set_fd(channel.ssl, channel.socket);
+        SSL_set_tlsext_host_name(channel.ssl, optionData.serverName.c_str());
+        SSL_set_verify(channel.ssl, (optionData.noVerify) ? SSL_VERIFY_NONE : SSL_VERIFY_PEER, nullptr);
+        if (!setCertificateName(channel.ssl, optionData.serverName)) {
+            failConnection(*channel.connection, "Could not set TLS certificate name.");
+            return;
+        }
+
+        if (session != nullptr) {
+            SSL_set_session(channel.ssl, session);
+        }
+
+        channel.handshaking = true;
+        channel.wantWrite = true;
+
+    }
+
+    //
+    // Log in, protect data connections (TLS) and switch to binary mode.
+    //
+
+    void CAsyncEngine::login(Connection &connection) {
+
+        ReplyFn binaryMode = [this] (Connection &connection, std::uint16_t statusCode) {
+            if (statusCode != 200) {
+                failConnection(connection, "Could not set binary mode [" + connection.response + "]");
+            } else {
+                connectionReady(connection);
+            }
+        };
+
+        ReplyFn loggedIn = [this, binaryMode] (Connection &connection, std::uint16_t statusCode) {
+            if (statusCode != 230) {
+                failConnection(connection, "Login failed [" + connection.response + "]");
+                return;
+            }
+            if (connection.control.ssl == nullptr) {
+                sendCommand(connection, "TYPE I", binaryMode);
+                return;
+            }
+            SSL_SESSION *session = SSL_get1_session(connection.control.ssl);
+            if ((session != nullptr) && SSL_SESSION_is_resumable(session)) {
+                std::lock_guard<std::mutex> engineLock(m_engineMutex);
+                std::swap(session, connection.server->tlsSession);
+            }
+            SSL_SESSION_free(session);
+            sendCommand(connection, "PBSZ 0", [this, binaryMode] (Connection &connection, std::uint16_t statusCode) {
+                if (statusCode != 200) {
+                    failConnection(connection, "Could not protect data connections [" + connection.response + "]");
+                    return;
+                }
+                sendCommand(connection, "PROT P", [this, binaryMode] (Connection &connection, std::uint16_t statusCode) {
+                    if (statusCode != 200) {
+                        failConnection(connection, "Could not protect data connections [" + connection.response + "]");
+                    } else {
+                        sendCommand(connection, "TYPE I", binaryMode);
+                    }
+                });
+            });
+        };
+
+        sendCommand(connection, "USER " + connection.server->optionData.userName, [this, loggedIn] (Connection &connection, std::uint16_t statusCode) {
+            if (statusCode == 331) {
+                sendCommand(connection, "PASS " + connection.server->optionData.userPassword, loggedIn);
+            } else {
+                loggedIn(connection, statusCode);
+            }
+        });
+
+    }
+
+    //
+    // Connection logged in and ready for operations.
+    //
+
+    void CAsyncEngine::connectionReady(Connection &connection) {
+
+        connection.state = ConnectionState::idle;
+
+    }
+
+    //
+    // Start operation on idle connection. Operations with data first enter passive mode.
+    //
+
+    void CAsyncEngine::startOperation(Connection &connection, Operation &&operation) {
+
+        connection.state = ConnectionState::busy;
+        connection.operation = std::move(operation);
+        connection.lastActivity = std::chrono::steady_clock::now();
+        connection.transferStarted = connection.dataDone = connection.dataFailed = connection.replyDone = false;
+        connection.finalStatusCode = 0;
+        connection.finalResponse.clear();
+        connection.dataBuffer.clear();
+
+        if (connection.operation.type == OperationType::command) {
+            sendCommand(connection, connection.operation.commandLine, [this] (Connection &connection, std::uint16_t statusCode) {
+                completeOperation(connection, statusCode, connection.response);
+            });
+        } else {
+            sendCommand(connection, connection.passiveCommand, [this] (Connection &connection, std::uint16_t statusCode) {
+                openDataChannel(connection, statusCode);
+            });
+        }
+
+    }
+
+    //
+    // Start non-blocking connect to passive data port (falling back to PASV if EPSV is
+    // refused) and send the operation's command.
+    //
+
+    void CAsyncEngine::openDataChannel(Connection &connection, std::uint16_t statusCode) {
+
+        std::string dataPort { passiveDataPort(statusCode, connection.response) };
+
+        if (dataPort.empty()) {
+            if (connection.passiveCommand == "EPSV") {
+                connection.passiveCommand = "PASV";
+                sendCommand(connection, connection.passiveCommand, [this] (Connection &connection, std::uint16_t statusCode) {
+                    openDataChannel(connection, statusCode);
+                });
+            } else {
+                completeOperation(connection, statusCode, connection.response);
+            }
+            return;
+        }
+
+        struct addrinfo hints {}, *address { nullptr };
+        struct epoll_event dataEvent {};
+
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+
+        if (getaddrinfo(connection.server->numericHost.c_str(), dataPort.c_str(), &hints, &address) == 0) {
+            connection.data.socket = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if ((connection.data.socket != -1) &&
+                (::connect(connection.data.socket, address->ai_addr, address->ai_addrlen) != 0) && (errno != EINPROGRESS)) {
+                ::close(connection.data.socket);
+                connection.data.socket = -1;
+            }
+            freeaddrinfo(address);
+        }
+
+        if (connection.data.socket == -1) {
+            completeOperation(connection, 425, "Could not open data connection.");
+            return;
+        }
+
+        connection.data.connecting = true;
+        connection.data.events = EPOLLOUT;
+        dataEvent.events = connection.data.events;
+        dataEvent.data.ptr = &connection.data;
+        epoll_ctl(connection.worker->epollFd, EPOLL_CTL_ADD, connection.data.socket, &dataEvent);
+
+        sendCommand(connection, connection.operation.commandLine, [this] (Connection &connection, std::uint16_t statusCode) {
+            startTransfer(connection, statusCode);
+        });
+
+    }
+
+    //
+    // Handle reply to transfer command; a preliminary reply starts the data flowing once
+    // the data channel is connected, anything else ends the operation.
+    //
+
+    void CAsyncEngine::startTransfer(Connection &connection, std::uint16_t statusCode) {
+
+        if ((statusCode == 125) || (statusCode == 150)) {
+            connection.transferStarted = true;
+            connection.replyFn = [this] (Connection &connection, std::uint16_t statusCode) {
+                endTransfer(connection, statusCode);
+            };
+            if (!connection.data.connecting) {
+                dataChannelReady(connection);
+            }
+            return;
+        }
+
+        closeDataChannel(connection, true);
+        completeOperation(connection, statusCode, connection.response);
+
+    }
+
+    //
+    // Handle final transfer reply. The operation completes once the data channel is
+    // also finished with; a failure reply abandons any data still to come.
+    //
+
+    void CAsyncEngine::endTransfer(Connection &connection, std::uint16_t statusCode) {
+
+        connection.replyDone = true;
+        connection.finalStatusCode = statusCode;
+        connection.finalResponse = connection.response;
+
+        if (!connection.dataDone && (statusCode >= 300)) {
+            closeDataChannel(connection, true);
+            connection.dataDone = true;
+        }
+
+        if (connection.dataDone) {
+            completeOperation(connection, statusCode, connection.response);
+        }
+
+    }
+
+    //
+    // Data channel connected and transfer started; negotiate TLS (resuming the control
+    // connection session as many servers require) or start streaming.
+    //
+
+    void CAsyncEngine::dataChannelReady(Connection &connection) {
+
+        if (connection.data.socket == -1) {
+            return;
+        }
+
+        if (connection.control.ssl != nullptr) {
+            startTLS(connection.data, SSL_get_session(connection.control.ssl));
+        } else {
+            connection.dataStreaming = true;
+        }
+
+    }
+
+    //
+    // Handle data channel events: connect completion, TLS handshake progress and data
+    // transfer.
+    //
+
+    void CAsyncEngine::handleData(Connection &connection, std::uint32_t events) {
+
+        connection.lastActivity = std::chrono::steady_clock::now();
+
+        if (connection.data.connecting) {
+            int socketError { 0 };
+            socklen_t socketErrorLength = sizeof (socketError);
+            if (!(events & (EPOLLOUT | EPOLLERR | EPOLLHUP))) {
+                return;
+            }
+            if ((getsockopt(connection.data.socket, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorLength) != 0) || (socketError != 0)) {
+                finishDataTransfer(connection, true);
+                return;
+            }
+            connection.data.connecting = false;
+            if (connection.transferStarted) {
+                dataChannelReady(connection);
+            }
+        }
+
+        if (connection.data.handshaking) {
+            int handshakeResult = continueHandshake(connection.data);
+            if (handshakeResult < 0) {
+                finishDataTransfer(connection, true);
+                return;
+            } else if (handshakeResult == 0) {
+                return;
+            }
+            connection.data.handshaking = false;
+            connection.dataStreaming = true;
+        }
+
+        if (connection.dataStreaming) {
+            receiveData(connection);
+        } else if (!connection.data.handshaking && (events & (EPOLLERR | EPOLLHUP))) {
+            finishDataTransfer(connection, true);
+        }
+
+    }
+
+    //
+    // Receive listing data until none is waiting (or this event's share has been moved).
+    //
+
+    void CAsyncEngine::receiveData(Connection &connection) {
+
+        std::vector<char> &ioBuffer = connection.worker->ioBuffer;
+        size_t bytesReceived { 0 };
+
+        while ((bytesReceived < kMaxBytesPerEvent) || ((connection.data.ssl != nullptr) && (SSL_pending(connection.data.ssl) > 0))) {
+
+            ssize_t bytesRead = readChannel(connection.data, ioBuffer.data(), ioBuffer.size());
+
+            if (bytesRead == kWouldBlock) {
+                return;
+            } else if (bytesRead <= 0) {
+                finishDataTransfer(connection, (bytesRead != 0));
+                return;
+            }
+
+            bytesReceived += bytesRead;
+            connection.dataBuffer.append(ioBuffer.data(), bytesRead);
+
+        }
+
+    }
+
+    //
+    // Close data channel. A TLS close notify is returned for a transfer that ended
+    // normally (servers wait on it); a reset close makes the server see any transfer
+    // still in progress fail at once.
+    //
+
+    void CAsyncEngine::closeDataChannel(Connection &connection, bool reset) {
+
+        if (connection.data.ssl != nullptr) {
+            if (!reset && !connection.data.handshaking) {
+                ERR_clear_error();
+                SSL_shutdown(connection.data.ssl);
+            }
+            SSL_free(connection.data.ssl);
+            connection.data.ssl = nullptr;
+        }
+
+        if (connection.data.socket != -1) {
+            epoll_ctl(connection.worker->epollFd, EPOLL_CTL_DEL, connection.data.socket, nullptr);
+            if (reset) {
+                struct linger socketLinger { 1, 0 };
+                setsockopt(connection.data.socket, SOL_SOCKET, SO_LINGER, &socketLinger, sizeof (socketLinger));
+            }
+            ::close(connection.data.socket);
+            connection.data.socket = -1;
+        }
+
+        connection.data.connecting = connection.data.handshaking = connection.data.wantWrite = false;
+        connection.data.events = 0;
+        connection.dataStreaming = false;
+
+    }
+
+    //
+    // Data channel finished with; complete the operation if its final reply is in.
+    //
+
+    void CAsyncEngine::finishDataTransfer(Connection &connection, bool failed) {
+
+        closeDataChannel(connection, failed);
+
+        connection.dataDone = true;
+        connection.dataFailed = connection.dataFailed || failed;
+
+        if (connection.replyDone) {
+            completeOperation(connection, connection.finalStatusCode, connection.finalResponse);
+        }
+
+    }
+
+    //
+    // Complete operation in progress on connection and call its completion function. A
+    // transfer the server reports good but that failed locally is given status code 451.
+    //
+
+    void CAsyncEngine::completeOperation(Connection &connection, std::uint16_t statusCode, const std::string &response) {
+
+        AsyncResult result;
+        CompletionFn completionFn { std::move(connection.operation.completionFn) };
+
+        result.statusCode = (connection.dataFailed && (statusCode != 0) && (statusCode < 300)) ? 451 : statusCode;
+        result.response = response;
+
+        if ((connection.operation.type == OperationType::list) && ((result.statusCode / 100) == 2)) {
+            result.entries = parseListing(connection.dataBuffer);
+        }
+
+        connection.operation = Operation();
+        connection.dataBuffer.clear();
+
+        if (connection.state == ConnectionState::busy) {
+            connection.state = ConnectionState::idle;
+        }
+
+        if (completionFn) {
+            completionFn(result);
+        }
+
+        std::lock_guard<std::mutex> engineLock(m_engineMutex);
+        if (--m_outstanding == 0) {
+            m_engineIdle.notify_all();
+        }
+
+    }
+
+    //
+    // Close failed connection, completing its operation (if any) with status code 0 and,
+    // if it was the server's last connection, any operations still queued for the server.
+    //
+
+    void CAsyncEngine::failConnection(Connection &connection, const std::string &reason) {
+
+        if (connection.state == ConnectionState::closed) {
+            return;
+        }
+
+        bool busy = (connection.state == ConnectionState::busy);
+        std::deque<Operation> orphanedOperations;
+
+        closeDataChannel(connection, true);
+
+        if (connection.control.ssl != nullptr) {
+            SSL_free(connection.control.ssl);
+            connection.control.ssl = nullptr;
+        }
+        if (connection.control.socket != -1) {
+            epoll_ctl(connection.worker->epollFd, EPOLL_CTL_DEL, connection.control.socket, nullptr);
+            ::close(connection.control.socket);
+            connection.control.socket = -1;
+        }
+
+        connection.state = ConnectionState::closed;
+        connection.replyFn = nullptr;
+        connection.input.clear();
+        connection.output.clear();
+
+        {
+            std::lock_guard<std::mutex> engineLock(m_engineMutex);
+            if (--connection.server->liveConnections == 0) {
+                orphanedOperations.swap(connection.server->operations);
+            }
+        }
+
+        if (busy) {
+            connection.dataFailed = false;
+            completeOperation(connection, 0, reason);
+        }
+
+        for (auto &operation : orphanedOperations) {
+            AsyncResult result;
+            result.response = reason;
+            if (operation.completionFn) {
+                operation.completionFn(result);
+            }
+            std::lock_guard<std::mutex> engineLock(m_engineMutex);
+            if (--m_outstanding == 0) {
+                m_engineIdle.notify_all();
+            }
+        }
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Main constructor (starts worker threads)
+    //
+
+    CAsyncEngine::CAsyncEngine(int threads) {
+
+        for (int thread = 0; thread < std::max(threads, 1); thread++) {
+            std::unique_ptr<Worker> worker { new Worker() };
+            struct epoll_event wakeEvent {};
+            worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+            worker->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if ((worker->epollFd == -1) || (worker->wakeFd == -1)) {
+                throw Exception("Could not create event loop.");
+            }
+            wakeEvent.events = EPOLLIN;
+            wakeEvent.data.ptr = nullptr;
+            epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->wakeFd, &wakeEvent);
+            m_workers.push_back(std::move(worker));
+        }
+
+        for (auto &worker : m_workers) {
+            worker->thread = std::thread(&CAsyncEngine::runWorker, this, std::ref(*worker));
+        }
+
+    }
+
+    //
+    // Destructor (stops worker threads and closes all connections)
+    //
+
+    CAsyncEngine::~CAsyncEngine() {
+
+        {
+            std::lock_guard<std::mutex> engineLock(m_engineMutex);
+            m_stopping = true;
+        }
+
+        for (auto &worker : m_workers) {
+            wakeWorker(worker->wakeFd);
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+
+        for (auto &connection : m_connections) {
+            for (Channel *channel : { &connection->data, &connection->control }) {
+                if (channel->ssl != nullptr) {
+                    SSL_free(channel->ssl);
+                }
+                if (channel->socket != -1) {
+                    ::close(channel->socket);
+                }
+            }
+        }
+
+        for (auto &server : m_servers) {
+            SSL_SESSION_free(server->tlsSession);
+        }
+
+        if (m_sslContext != nullptr) {
+            SSL_CTX_free(m_sslContext);
+        }
+
+    }
+
+    //
+    // Add server and open connections to it (spread across workers). Their first TLS
+    // handshakes resume any session CSession has cached for the server. Returns the
+    // server number to give operations.
+    //
+
+    int CAsyncEngine::addServer(const EscapementOptions &optionData, int connections) {
+
+        std::unique_ptr<Server> server { new Server() };
+        struct addrinfo hints {}, *addressList { nullptr };
+        char numericHost[NI_MAXHOST];
+
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(optionData.serverName.c_str(), optionData.serverPort.c_str(), &hints, &addressList) != 0) {
+            throw Exception("Could not resolve " + optionData.serverName + ":" + optionData.serverPort);
+        }
+
+        std::memcpy(&server->address, addressList->ai_addr, addressList->ai_addrlen);
+        server->addressLength = addressList->ai_addrlen;
+        freeaddrinfo(addressList);
+
+        if (getnameinfo(reinterpret_cast<struct sockaddr *> (&server->address), server->addressLength,
+                numericHost, sizeof (numericHost), nullptr, 0, NI_NUMERICHOST) != 0) {
+            throw Exception("Could not get server address.");
+        }
+
+        server->numericHost = numericHost;
+        server->optionData = optionData;
+        server->liveConnections = std::max(connections, 1);
+
+        std::lock_guard<std::mutex> engineLock(m_engineMutex);
+
+        if (!optionData.noSSL && (m_sslContext == nullptr)) {
+            m_sslContext = SSL_CTX_new(TLS_client_method());
+            if (m_sslContext == nullptr) {
+                throw Exception("Could not create TLS context.");
+            }
+            if (SSL_CTX_set_default_verify_paths(m_sslContext) != 1) {
+                SSL_CTX_free(m_sslContext);
+                m_sslContext = nullptr;
+                throw Exception("Could not load trusted certificates.");
+            }
+            SSL_CTX_set_mode(m_sslContext, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+        }
+
+        for (int connection = 0; connection < server->liveConnections; connection++) {
+            std::unique_ptr<Connection> newConnection { new Connection() };
+            newConnection->server = server.get();
+            newConnection->worker = m_workers[m_nextWorker++ % m_workers.size()].get();
+            newConnection->control.connection = newConnection.get();
+            newConnection->data.connection = newConnection.get();
+            newConnection->data.dataChannel = true;
+            newConnection->worker->newConnections.push_back(newConnection.get());
+            m_connections.push_back(std::move(newConnection));
+        }
+
+        if (!optionData.noSSL) {
+            server->tlsSession = CSession::getCachedTLSSession(optionData);
+        }
+
+        m_servers.push_back(std::move(server));
+
+        for (auto &worker : m_workers) {
+            wakeWorker(worker->wakeFd);
+        }
+
+        return (m_servers.size() - 1);
+
+    }
+
+    //
+    // List directory (MLSD); entries are returned in the result.
+    //
+
+    void CAsyncEngine::list(int server, const std::string &remotePath, CompletionFn completionFn) {
+        queueOperation(server, { OperationType::list, "MLSD " + remotePath, completionFn });
+    }
+
+    //
+    // Get file last modified time (MDTM); returned in the response.
+    //
+
+    void CAsyncEngine::mdtm(int server, const std::string &remotePath, CompletionFn completionFn) {
+        queueOperation(server, { OperationType::command, "MDTM " + remotePath, completionFn });
+    }
+
+    //
+    // Get file size (SIZE); returned in the response.
+    //
+
+    void CAsyncEngine::size(int server, const std::string &remotePath, CompletionFn completionFn) {
+        queueOperation(server, { OperationType::command, "SIZE " + remotePath, completionFn });
+    }
+
+    //
+    // Wait until all operations queued (including any queued by completion functions)
+    // have completed.
+    //
+
+    void CAsyncEngine::wait(void) {
+
+        std::unique_lock<std::mutex> engineLock(m_engineMutex);
+
+        m_engineIdle.wait(engineLock, [this] () {
+            return (m_outstanding == 0);
+        });
+
+    }
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Parse MLSD listing into directory entries (current/parent entries skipped).
+    //
+
+    std::vector<ListEntry> parseListing(const std::string &listing) {
+
+        std::vector<ListEntry> entries;
+        std::istringstream listingStream(listing);
+        std::string line;
+
+        while (std::getline(listingStream, line)) {
+
+            if (!line.empty() && (line.back() == '\r')) {
+                line.pop_back();
+            }
+
+            size_t factsEnd = line.find(' ');
+            if (factsEnd == std::string::npos) {
+                continue;
+            }
+
+            ListEntry entry;
+            bool listed { true };
+            std::istringstream factStream(line.substr(0, factsEnd));
+            std::string fact;
+
+            entry.name = line.substr(factsEnd + 1);
+
+            while (std::getline(factStream, fact, ';')) {
+                size_t valueStart = fact.find('=');
+                if (valueStart == std::string::npos) {
+                    continue;
+                }
+                std::string factName { fact.substr(0, valueStart) };
+                std::string factValue { fact.substr(valueStart + 1) };
+                std::transform(factName.begin(), factName.end(), factName.begin(), [] (unsigned char c) {
+                    return (std::tolower(c));
+                });
+                if (factName == "type") {
+                    std::transform(factValue.begin(), factValue.end(), factValue.begin(), [] (unsigned char c) {
+                        return (std::tolower(c));
+                    });
+                    listed = (factValue != "cdir") && (factValue != "pdir");
+                    entry.directory = (factValue == "dir");
+                } else if ((factName == "size") && !factValue.empty() && std::isdigit(factValue[0])) {
+                    entry.size = std::strtoll(factValue.c_str(), nullptr, 10);
+                } else if (factName == "modify") {
+                    entry.modified = factValue.substr(0, 14);
+                }
+            }
+
+            if (listed && !entry.name.empty() && (entry.name != ".") && (entry.name != "..")) {
+                entries.push_back(entry);
+            }
+
+        }
+
+        return (entries);
+
+    }
+
+    //
+    // Parse long (LIST) listing in the Unix "ls -l" format almost every server uses into
+    // directory entries (type and size only; current/parent and unparsable lines skipped).
+    //
+
+    std::vector<ListEntry> parseLongListing(const std::string &listing) {
+
+        std::vector<ListEntry> entries;
+        std::istringstream listingStream(listing);
+        std::string line;
+
+        while (std::getline(listingStream, line)) {
+
+            if (!line.empty() && (line.back() == '\r')) {
+                line.pop_back();
+            }
+
+            std::istringstream lineStream(line);
+            std::string permissions, links, owner, group, size, month, day, time;
+
+            if (!(lineStream >> permissions >> links >> owner >> group >> size >> month >> day >> time)) {
+                continue;
+            }
+
+            ListEntry entry;
+
+            lineStream >> std::ws;
+            std::getline(lineStream, entry.name);
+
+            entry.directory = (permissions[0] == 'd');
+            if (permissions[0] == '-') {
+                entry.size = std::strtoll(size.c_str(), nullptr, 10);
+            } else if (permissions[0] == 'l') {
+                entry.name = entry.name.substr(0, entry.name.find(" -> "));
+            }
+
+            if (!entry.name.empty() && (entry.name != ".") && (entry.name != "..")) {
+                entries.push_back(entry);
+            }
+
+        }
+
+        return (entries);
+
+    }
+
+} // namespace Escapement_Async
@@ -0,0 +1,193 @@
+#ifndef ESCAPEMENT_ASYNC_HPP
+#define ESCAPEMENT_ASYNC_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+
+//
+// Linux
+//
+
+#include <sys/socket.h>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+
+//
+// OpenSSL
+//
+
+#include <openssl/ssl.h>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Async {
+
+    //
+    // Remote directory entry (from MLSD facts)
+    //
+
+    struct ListEntry {
+        std::string name;                               // Entry name
+        bool directory { false };                       // == true entry is a directory
+        std::int64_t size { Escapement::kUnknownFileSize }; // Size in bytes (kUnknownFileSize if not known)
+        std::string modified;                           // Last modified (YYYYMMDDHHMMSS UTC, "" if not known)
+    };
+
+    //
+    // Asynchronous operation result
+    //
+
+    struct AsyncResult {
+        std::uint16_t statusCode { 0 };     // Final reply status code (0 == connection lost)
+        std::string response;               // Final reply
+        std::vector<ListEntry> entries;     // Directory entries (list)
+    };
+
+    std::vector<ListEntry> parseListing(const std::string &listing);
+    std::vector<ListEntry> parseLongListing(const std::string &listing);
+
+    //
+    // Operation completion callback
+    //
+
+    typedef std::function<void(const AsyncResult &)> CompletionFn;
+
+    //
+    // Event driven FTP engine. Drives many control and data connections (to one or
+    // more servers) from a small number of threads with epoll, each connection being a
+    // state machine advanced by socket readiness and server replies. Operations are
+    // queued per server and taken by the first idle connection to it; their completion
+    // callbacks run on an engine thread and may queue further operations. Only the
+    // listing and MDTM/SIZE query passes use it; moving the transfer and delete passes
+    // onto it is a follow-up (see the readme's to do list).
+    //
+
+    class CAsyncEngine {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CAsyncEngine Failure: " + message) {
+            }
+
+        };
+
+        explicit CAsyncEngine(int threads = 1);
+        virtual ~CAsyncEngine();
+
+        CAsyncEngine(const CAsyncEngine &orig) = delete;
+        CAsyncEngine(const CAsyncEngine &&orig) = delete;
+        CAsyncEngine& operator=(CAsyncEngine other) = delete;
+
+        int addServer(const Escapement::EscapementOptions &optionData, int connections);
+
+        void list(int server, const std::string &remotePath, CompletionFn completionFn);
+        void mdtm(int server, const std::string &remotePath, CompletionFn completionFn);
+        void size(int server, const std::string &remotePath, CompletionFn completionFn);
+
+        void wait(void);
+
+    private:
+
+        enum class OperationType { command, list };
+
+        //
+        // Queued operation
+        //
+
+        struct Operation {
+            OperationType type { OperationType::command };
+            std::string commandLine;
+            CompletionFn completionFn;
+        };
+
+        //
+        // Server connected to and its queued operations
+        //
+
+        struct Server {
+            Escapement::EscapementOptions optionData;
+            struct sockaddr_storage address;
+            socklen_t addressLength { 0 };
+            std::string numericHost;
+            std::deque<Operation> operations;
+            int liveConnections { 0 };
+            SSL_SESSION *tlsSession { nullptr };
+        };
+
+        struct Channel;
+        struct Connection;
+        struct Worker;
+
+        typedef std::function<void(Connection &, std::uint16_t)> ReplyFn;
+
+        void queueOperation(int server, Operation &&operation);
+        void runWorker(Worker &worker);
+        void startConnection(Connection &connection);
+        void dispatchOperations(Worker &worker);
+
+        void handleControl(Connection &connection, std::uint32_t events);
+        void handleData(Connection &connection, std::uint32_t events);
+        void handleReplies(Connection &connection);
+        void flushControl(Connection &connection);
+        void updateInterest(Connection &connection);
+        void checkTimeouts(Worker &worker);
+
+        void sendCommand(Connection &connection, const std::string &commandLine, ReplyFn replyFn);
+        void startTLS(Channel &channel, SSL_SESSION *session);
+        void login(Connection &connection);
+        void connectionReady(Connection &connection);
+
+        void startOperation(Connection &connection, Operation &&operation);
+        void openDataChannel(Connection &connection, std::uint16_t statusCode);
+        void startTransfer(Connection &connection, std::uint16_t statusCode);
+        void endTransfer(Connection &connection, std::uint16_t statusCode);
+        void dataChannelReady(Connection &connection);
+        void receiveData(Connection &connection);
+        void closeDataChannel(Connection &connection, bool reset);
+        void finishDataTransfer(Connection &connection, bool failed);
+        void completeOperation(Connection &connection, std::uint16_t statusCode, const std::string &response);
+        void failConnection(Connection &connection, const std::string &reason);
+
+        static ssize_t readChannel(Channel &channel, void *buffer, size_t length);
+        static ssize_t writeChannel(Channel &channel, const void *buffer, size_t length);
+        static int continueHandshake(Channel &channel);
+
+        std::vector<std::unique_ptr<Worker>> m_workers;         // Engine threads
+        std::vector<std::unique_ptr<Server>> m_servers;         // Servers
+        std::vector<std::unique_ptr<Connection>> m_connections; // All connections
+        SSL_CTX *m_sslContext { nullptr };                      // TLS context (nullptr until a TLS server added)
+        size_t m_nextWorker { 0 };                              // Worker for next connection
+        size_t m_outstanding { 0 };                             // Operations queued or in progress
+        bool m_stopping { false };                              // == true engine shutting down
+        std::mutex m_engineMutex;                               // Servers/queues/counts mutex
+        std::condition_variable m_engineIdle;                   // Signalled when no operations outstanding
+
+    };
+
+} // namespace Escapement_Async
+
+#endif /* ESCAPEMENT_ASYNC_HPP */
+
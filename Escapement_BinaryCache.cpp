@@ -0,0 +1,699 @@
+//
+// Class: CBinaryCache
+//
+// Description: Binary file-state cache used by Escapement in place of JSON (which is
+// kept for import/export only). Paths are sorted and front coded with restart points so
+// that a cache of millions of entries is a compact table that can be binary searched,
+// and each path has a fixed width metadata record. The file is written in one pass to a
+// temporary file that is renamed into place, and read by mapping it into memory; entries
+// are decoded only as they are looked up or walked, so loading involves no parsing.
+// Every section carries a CRC-32 so a damaged cache is rejected rather than trusted.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : mmap.
+// zlib               : CRC-32.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//
+// zlib
+//
+
+#include <zlib.h>
+
+//
+// Escapement binary cache
+//
+
+#include "Escapement_BinaryCache.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_BinaryCache {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+
+    using namespace Antik::FTP;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // File identification, format version and byte order tag
+    //
+
+    static const char kCacheMagic[8] { 'E', 'S', 'C', 'C', 'A', 'C', 'H', 'E' };
+    static const std::uint32_t kCacheVersion { 1 };
+    static const std::uint32_t kEndianTag { 0x01020304 };
+
+    //
+    // Paths between full (restart) entries in the path table
+    //
+
+    static const std::uint32_t kRestartInterval { 16 };
+
+    //
+    // Record flags
+    //
+
+    static const std::uint32_t kRecordDirectory { 0x1 };        // Entry is a directory
+    static const std::uint32_t kRecordModifiedString { 0x2 };   // Modified held in string table
+
+    //
+    // Largest block passed to crc32() at once
+    //
+
+    static const std::uint64_t kChecksumBlockSize { 1024 * 1024 * 1024 };
+
+    //
+    // Cache file header
+    //
+
+    struct CBinaryCache::Header {
+        char magic[8];                      // kCacheMagic
+        std::uint32_t version;              // kCacheVersion
+        std::uint32_t headerSize;           // sizeof (Header)
+        std::uint32_t endianTag;            // kEndianTag as written
+        std::uint32_t restartInterval;      // Paths between restart entries
+        std::uint64_t entryCount;           // Number of entries
+        std::uint64_t optionsOffset;        // Options section offset
+        std::uint64_t optionsSize;          // Options section size
+        std::uint64_t pathsOffset;          // Path table offset
+        std::uint64_t pathsSize;            // Path table size
+        std::uint64_t restartsOffset;       // Restart offsets section offset
+        std::uint64_t restartCount;         // Number of restart entries
+        std::uint64_t recordsOffset;        // Records section offset
+        std::uint64_t stringsOffset;        // String table offset
+        std::uint64_t stringsSize;          // String table size
+        std::uint32_t optionsChecksum;      // CRC-32 of options section
+        std::uint32_t pathsChecksum;        // CRC-32 of path table
+        std::uint32_t restartsChecksum;     // CRC-32 of restart offsets
+        std::uint32_t recordsChecksum;      // CRC-32 of records
+        std::uint32_t stringsChecksum;      // CRC-32 of string table
+        std::uint32_t headerChecksum;       // CRC-32 of header (this field zero)
+    };
+
+    //
+    // Fixed width entry metadata record
+    //
+
+    struct CBinaryCache::Record {
+        std::int64_t size;                  // Size in bytes (kUnknownFileSize if not known)
+        std::uint64_t modified;             // Modified YYYYMMDDHHMMSS as a number (0 == none) or string offset
+        std::uint64_t fingerprint;          // Fingerprint string offset + 1 (0 == none)
+        std::uint32_t flags;                // kRecord* flags
+        std::uint32_t reserved;             // Zero
+    };
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // CRC-32 of a block of any size.
+    //
+
+    static std::uint32_t checksum(const char *data, std::uint64_t length) {
+
+        uLong crc = crc32(0L, Z_NULL, 0);
+
+        while (length > 0) {
+            uInt blockLength = static_cast<uInt> (std::min(length, kChecksumBlockSize));
+            crc = crc32(crc, reinterpret_cast<const Bytef *> (data), blockLength);
+            data += blockLength;
+            length -= blockLength;
+        }
+
+        return (static_cast<std::uint32_t> (crc));
+
+    }
+
+    //
+    // Append an unsigned LEB128 encoded value.
+    //
+
+    static void putVarint(std::string &buffer, std::uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back(static_cast<char> ((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<char> (value));
+    }
+
+    //
+    // Decode an unsigned LEB128 value, returning the position after it (nullptr if it
+    // runs past end).
+    //
+
+    static const char *getVarint(const char *position, const char *end, std::uint64_t &value) {
+        value = 0;
+        for (int shift = 0; (position < end) && (shift < 64); shift += 7) {
+            std::uint8_t byte = static_cast<std::uint8_t> (*position++);
+            value |= static_cast<std::uint64_t> (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return (position);
+            }
+        }
+        return (nullptr);
+    }
+
+    //
+    // Append a length prefixed string returning its offset.
+    //
+
+    static std::uint64_t putString(std::string &buffer, const std::string &value) {
+        std::uint64_t offset { buffer.size() };
+        putVarint(buffer, value.size());
+        buffer.append(value);
+        return (offset);
+    }
+
+    //
+    // Decode a length prefixed string, returning the position after it (nullptr if it
+    // runs past end).
+    //
+
+    static const char *getString(const char *position, const char *end, std::string &value) {
+        std::uint64_t length;
+        position = getVarint(position, end, length);
+        if ((position == nullptr) || (length > static_cast<std::uint64_t> (end - position))) {
+            return (nullptr);
+        }
+        value.assign(position, length);
+        return (position + length);
+    }
+
+    //
+    // Pad buffer to an 8 byte boundary.
+    //
+
+    static void alignBuffer(std::string &buffer) {
+        buffer.resize((buffer.size() + 7) & ~static_cast<size_t> (7), '\0');
+    }
+
+    //
+    // Pack a YYYYMMDDHHMMSS modified time into a number. Returns false if it is in some
+    // other form (it is then kept as a string).
+    //
+
+    static bool packModified(const std::string &modified, std::uint64_t &packed) {
+        if ((modified.size() != 14) || !std::all_of(modified.begin(), modified.end(), [] (unsigned char c) { return (std::isdigit(c)); })) {
+            return (false);
+        }
+        packed = std::stoull(modified);
+        return (true);
+    }
+
+    //
+    // Decode options section name/value pairs. Returns false if it is corrupt.
+    //
+
+    static bool decodeOptions(const char *position, const char *end, CachedOptions &cachedOptions) {
+
+        while (position < end) {
+            std::string name, value;
+            position = getString(position, end, name);
+            if (position != nullptr) {
+                position = getString(position, end, value);
+            }
+            if (position == nullptr) {
+                return (false);
+            }
+            cachedOptions.emplace_back(name, value);
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Write all of buffer to file. Returns false on failure.
+    //
+
+    static bool writeAll(int fileFd, const char *buffer, size_t length) {
+
+        while (length > 0) {
+            ssize_t bytesWritten = ::write(fileFd, buffer, length);
+            if (bytesWritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return (false);
+            }
+            buffer += bytesWritten;
+            length -= bytesWritten;
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Flush the directory holding a file to disk (so a file created or renamed into it
+    // survives a crash). Returns false on failure.
+    //
+
+    static bool syncDirectory(const std::string &filePath) {
+
+        size_t directoryEnd = filePath.find_last_of('/');
+        std::string directory { (directoryEnd == std::string::npos) ? "." : filePath.substr(0, std::max(directoryEnd, static_cast<size_t> (1))) };
+
+        int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd == -1) {
+            return (false);
+        }
+
+        bool synced = (fsync(directoryFd) == 0);
+
+        ::close(directoryFd);
+
+        return (synced);
+
+    }
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Check a cache file header (of a file of fileSize bytes) is supported and intact.
+    //
+
+    void CBinaryCache::checkHeader(const Header &cacheHeader, const std::string &cacheFile, std::uint64_t fileSize) {
+
+        Header header { cacheHeader };
+        header.headerChecksum = 0;
+
+        if ((std::memcmp(header.magic, kCacheMagic, sizeof (kCacheMagic)) != 0) || (header.version != kCacheVersion) ||
+            (header.headerSize != sizeof (Header)) || (header.endianTag != kEndianTag) || (header.restartInterval == 0)) {
+            throw Exception("[" + cacheFile + "] is not a supported cache file.");
+        }
+        if (checksum(reinterpret_cast<const char *> (&header), sizeof (header)) != cacheHeader.headerChecksum) {
+            throw Exception("Cache [" + cacheFile + "] header checksum mismatch.");
+        }
+        if ((header.restartCount != ((header.entryCount + header.restartInterval - 1) / header.restartInterval)) ||
+            (header.entryCount > (fileSize / sizeof (Record))) ||
+            ((header.restartsOffset % sizeof (std::uint64_t)) != 0) || ((header.recordsOffset % sizeof (std::uint64_t)) != 0)) {
+            throw Exception("Cache [" + cacheFile + "] header corrupt.");
+        }
+
+    }
+
+    //
+    // Check a section lies inside the mapping and matches its checksum.
+    //
+
+    void CBinaryCache::checkSection(std::uint64_t offset, std::uint64_t length, std::uint32_t sectionChecksum, const char *name) const {
+
+        if ((offset > m_mappingSize) || (length > (m_mappingSize - offset))) {
+            throw Exception(std::string("Cache ") + name + " section truncated.");
+        }
+
+        if (checksum(m_mapping + offset, length) != sectionChecksum) {
+            throw Exception(std::string("Cache ") + name + " section checksum mismatch.");
+        }
+
+    }
+
+    //
+    // Decode the path table entry at entry (filePath holds the previous path on entry).
+    // Returns the position of the next entry.
+    //
+
+    const char *CBinaryCache::decodePath(const char *entry, std::string &filePath) const {
+
+        std::uint64_t sharedLength, suffixLength;
+
+        entry = getVarint(entry, m_pathTableEnd, sharedLength);
+        if (entry != nullptr) {
+            entry = getVarint(entry, m_pathTableEnd, suffixLength);
+        }
+        if ((entry == nullptr) || (sharedLength > filePath.size()) ||
+            (suffixLength > static_cast<std::uint64_t> (m_pathTableEnd - entry))) {
+            throw Exception("Cache path table corrupt.");
+        }
+
+        filePath.resize(sharedLength);
+        filePath.append(entry, suffixLength);
+
+        return (entry + suffixLength);
+
+    }
+
+    //
+    // Decode metadata record index.
+    //
+
+    FileInfo CBinaryCache::decodeRecord(std::uint64_t index) const {
+
+        const Record &record = m_records[index];
+        const char *stringsEnd = m_strings + m_header->stringsSize;
+        FileInfo fileInfo;
+
+        fileInfo.size = record.size;
+        fileInfo.directory = (record.flags & kRecordDirectory);
+
+        if (record.flags & kRecordModifiedString) {
+            std::string modified;
+            if ((record.modified >= m_header->stringsSize) ||
+                (getString(m_strings + record.modified, stringsEnd, modified) == nullptr)) {
+                throw Exception("Cache string table corrupt.");
+            }
+            fileInfo.modified = static_cast<CFTP::DateTime> (modified);
+        } else if (record.modified != 0) {
+            fileInfo.modified = static_cast<CFTP::DateTime> (std::to_string(record.modified));
+        }
+
+        if (record.fingerprint != 0) {
+            if ((record.fingerprint > m_header->stringsSize) ||
+                (getString(m_strings + record.fingerprint - 1, stringsEnd, fileInfo.fingerprint) == nullptr)) {
+                throw Exception("Cache string table corrupt.");
+            }
+        }
+
+        return (fileInfo);
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Map cache file and check its header and sections.
+    //
+
+    CBinaryCache::CBinaryCache(const std::string &cacheFile) {
+
+        struct stat fileStat;
+
+        m_cacheFd = open(cacheFile.c_str(), O_RDONLY | O_CLOEXEC);
+        if (m_cacheFd == -1) {
+            throw Exception("Could not open [" + cacheFile + "]: " + std::string(std::strerror(errno)));
+        }
+
+        try {
+
+            if ((fstat(m_cacheFd, &fileStat) != 0) || (static_cast<size_t> (fileStat.st_size) < sizeof (Header))) {
+                throw Exception("Cache [" + cacheFile + "] truncated.");
+            }
+
+            m_mappingSize = fileStat.st_size;
+            void *mapping = mmap(nullptr, m_mappingSize, PROT_READ, MAP_PRIVATE, m_cacheFd, 0);
+            if (mapping == MAP_FAILED) {
+                throw Exception("Could not map [" + cacheFile + "]: " + std::string(std::strerror(errno)));
+            }
+            m_mapping = static_cast<const char *> (mapping);
+            m_header = reinterpret_cast<const Header *> (m_mapping);
+
+            const Header &header { *m_header };
+
+            checkHeader(header, cacheFile, m_mappingSize);
+
+            checkSection(header.optionsOffset, header.optionsSize, header.optionsChecksum, "options");
+            checkSection(header.pathsOffset, header.pathsSize, header.pathsChecksum, "path");
+            checkSection(header.restartsOffset, header.restartCount * sizeof (std::uint64_t), header.restartsChecksum, "restart");
+            checkSection(header.recordsOffset, header.entryCount * sizeof (Record), header.recordsChecksum, "record");
+            checkSection(header.stringsOffset, header.stringsSize, header.stringsChecksum, "string");
+
+            m_pathTable = m_mapping + header.pathsOffset;
+            m_pathTableEnd = m_pathTable + header.pathsSize;
+            m_restarts = reinterpret_cast<const std::uint64_t *> (m_mapping + header.restartsOffset);
+            m_records = reinterpret_cast<const Record *> (m_mapping + header.recordsOffset);
+            m_strings = m_mapping + header.stringsOffset;
+
+            for (std::uint64_t restart = 0; restart < header.restartCount; restart++) {
+                if (m_restarts[restart] >= header.pathsSize) {
+                    throw Exception("Cache [" + cacheFile + "] restart table corrupt.");
+                }
+            }
+
+        } catch (...) {
+            if (m_mapping != nullptr) {
+                munmap(const_cast<char *> (m_mapping), m_mappingSize);
+            }
+            ::close(m_cacheFd);
+            throw;
+        }
+
+    }
+
+    //
+    // Destructor
+    //
+
+    CBinaryCache::~CBinaryCache() {
+
+        munmap(const_cast<char *> (m_mapping), m_mappingSize);
+        ::close(m_cacheFd);
+
+    }
+
+    //
+    // Return true if file exists and starts with the binary cache magic.
+    //
+
+    bool CBinaryCache::isBinaryCache(const std::string &cacheFile) {
+
+        char magic[sizeof (kCacheMagic)];
+        std::ifstream cacheFileStream { cacheFile, std::ios::binary };
+
+        return (cacheFileStream.read(magic, sizeof (magic)) && (std::memcmp(magic, kCacheMagic, sizeof (kCacheMagic)) == 0));
+
+    }
+
+    //
+    // Read cached option values without mapping or checking the file state sections
+    // (only the header and options section are read).
+    //
+
+    CachedOptions CBinaryCache::readOptions(const std::string &cacheFile) {
+
+        std::ifstream cacheFileStream { cacheFile, std::ios::binary | std::ios::ate };
+        CachedOptions cachedOptions;
+        Header header;
+
+        if (!cacheFileStream) {
+            throw Exception("Could not open [" + cacheFile + "]");
+        }
+
+        std::uint64_t fileSize = cacheFileStream.tellg();
+
+        if (!cacheFileStream.seekg(0).read(reinterpret_cast<char *> (&header), sizeof (header))) {
+            throw Exception("Cache [" + cacheFile + "] truncated.");
+        }
+
+        checkHeader(header, cacheFile, fileSize);
+
+        if ((header.optionsOffset > fileSize) || (header.optionsSize > (fileSize - header.optionsOffset))) {
+            throw Exception("Cache options section truncated.");
+        }
+
+        std::string options(header.optionsSize, '\0');
+
+        if (!cacheFileStream.seekg(header.optionsOffset).read(&options[0], options.size())) {
+            throw Exception("Cache options section truncated.");
+        }
+        if (checksum(options.data(), options.size()) != header.optionsChecksum) {
+            throw Exception("Cache options section checksum mismatch.");
+        }
+        if (!decodeOptions(options.data(), options.data() + options.size(), cachedOptions)) {
+            throw Exception("Cache options section corrupt.");
+        }
+
+        return (cachedOptions);
+
+    }
+
+    //
+    // Write options and file information to a binary cache file (through a temporary file
+    // renamed into place so a failed write never leaves a partial cache).
+    //
+
+    void CBinaryCache::write(const std::string &cacheFile, const CachedOptions &cachedOptions, const FileInfoMap &fileInfoMap) {
+
+        EntryList entryList;
+
+        entryList.reserve(fileInfoMap.size());
+        for (auto &file : fileInfoMap) {
+            entryList.push_back(&file);
+        }
+
+        write(cacheFile, cachedOptions, entryList);
+
+    }
+
+    //
+    // Write options and a list of entries (sorted in place) to a binary cache file. The
+    // file is written to a temporary, flushed to disk and renamed over the old one, then
+    // its directory is flushed; so once this returns the new file survives a crash.
+    //
+
+    void CBinaryCache::write(const std::string &cacheFile, const CachedOptions &cachedOptions, EntryList &entryList) {
+
+        EntryList &sortedFiles { entryList };
+        std::string options, paths, restarts, records, strings;
+        std::string cacheFileTemp { cacheFile + ".tmp" };
+        const std::string *previousPath { nullptr };
+        Header header {};
+
+        std::sort(sortedFiles.begin(), sortedFiles.end(), [] (const FileInfoMap::value_type *lhs, const FileInfoMap::value_type *rhs) {
+            return (lhs->first < rhs->first);
+        });
+
+        for (auto &option : cachedOptions) {
+            putString(options, option.first);
+            putString(options, option.second);
+        }
+
+        records.reserve(sortedFiles.size() * sizeof (Record));
+
+        for (size_t index = 0; index < sortedFiles.size(); index++) {
+
+            const std::string &filePath = sortedFiles[index]->first;
+            const FileInfo &fileInfo = sortedFiles[index]->second;
+            size_t sharedLength { 0 };
+            Record record {};
+
+            if ((index % kRestartInterval) == 0) {
+                std::uint64_t restartOffset { paths.size() };
+                restarts.append(reinterpret_cast<const char *> (&restartOffset), sizeof (restartOffset));
+            } else {
+                size_t maxShared = std::min(previousPath->size(), filePath.size());
+                while ((sharedLength < maxShared) && ((*previousPath)[sharedLength] == filePath[sharedLength])) {
+                    sharedLength++;
+                }
+            }
+            putVarint(paths, sharedLength);
+            putVarint(paths, filePath.size() - sharedLength);
+            paths.append(filePath, sharedLength, std::string::npos);
+            previousPath = &filePath;
+
+            std::string modified { static_cast<std::string> (fileInfo.modified) };
+            record.size = fileInfo.size;
+            record.flags = fileInfo.directory ? kRecordDirectory : 0;
+            if (!modified.empty() && !packModified(modified, record.modified)) {
+                record.modified = putString(strings, modified);
+                record.flags |= kRecordModifiedString;
+            }
+            if (!fileInfo.fingerprint.empty()) {
+                record.fingerprint = putString(strings, fileInfo.fingerprint) + 1;
+            }
+            records.append(reinterpret_cast<const char *> (&record), sizeof (record));
+
+        }
+
+        std::memcpy(header.magic, kCacheMagic, sizeof (kCacheMagic));
+        header.version = kCacheVersion;
+        header.headerSize = sizeof (Header);
+        header.endianTag = kEndianTag;
+        header.restartInterval = kRestartInterval;
+        header.entryCount = sortedFiles.size();
+        header.restartCount = restarts.size() / sizeof (std::uint64_t);
+
+        std::string body;
+        auto addSection = [&body] (const std::string &section, std::uint64_t &offset, std::uint32_t &sectionChecksum) {
+            alignBuffer(body);
+            offset = sizeof (Header) + body.size();
+            sectionChecksum = checksum(section.data(), section.size());
+            body.append(section);
+        };
+
+        body.reserve(options.size() + paths.size() + restarts.size() + records.size() + strings.size() + 64);
+        addSection(options, header.optionsOffset, header.optionsChecksum);
+        header.optionsSize = options.size();
+        addSection(paths, header.pathsOffset, header.pathsChecksum);
+        header.pathsSize = paths.size();
+        addSection(restarts, header.restartsOffset, header.restartsChecksum);
+        addSection(records, header.recordsOffset, header.recordsChecksum);
+        addSection(strings, header.stringsOffset, header.stringsChecksum);
+        header.stringsSize = strings.size();
+
+        header.headerChecksum = checksum(reinterpret_cast<const char *> (&header), sizeof (header));
+
+        int cacheFileFd = open(cacheFileTemp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if ((cacheFileFd == -1) ||
+            !writeAll(cacheFileFd, reinterpret_cast<const char *> (&header), sizeof (header)) ||
+            !writeAll(cacheFileFd, body.data(), body.size()) ||
+            (fsync(cacheFileFd) != 0)) {
+            std::string error { std::strerror(errno) };
+            if (cacheFileFd != -1) {
+                ::close(cacheFileFd);
+            }
+            std::remove(cacheFileTemp.c_str());
+            throw Exception("Could not write [" + cacheFileTemp + "]: " + error);
+        }
+
+        ::close(cacheFileFd);
+
+        if (std::rename(cacheFileTemp.c_str(), cacheFile.c_str()) != 0) {
+            std::remove(cacheFileTemp.c_str());
+            throw Exception("Could not replace [" + cacheFile + "]");
+        }
+
+        if (!syncDirectory(cacheFile)) {
+            throw Exception("Could not flush directory of [" + cacheFile + "]: " + std::string(std::strerror(errno)));
+        }
+
+    }
+
+    //
+    // Return number of entries.
+    //
+
+    std::uint64_t CBinaryCache::size(void) const {
+
+        return (m_header->entryCount);
+
+    }
+
+    //
+    // Walk all entries in path order.
+    //
+
+    void CBinaryCache::forEach(EntryFn entryFn) const {
+
+        const char *entry = m_pathTable;
+        std::string filePath;
+
+        for (std::uint64_t index = 0; index < m_header->entryCount; index++) {
+            entry = decodePath(entry, filePath);
+            entryFn(filePath, decodeRecord(index));
+        }
+
+    }
+
+} // namespace Escapement_BinaryCache
@@ -0,0 +1,122 @@
+#ifndef ESCAPEMENT_BINARYCACHE_HPP
+#define ESCAPEMENT_BINARYCACHE_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_BinaryCache {
+
+    //
+    // Cached option values (name, value) kept with the file state
+    //
+
+    typedef std::vector<std::pair<std::string, std::string>> CachedOptions;
+
+    //
+    // Read-only view of a binary file-state cache. The file is mapped into memory and
+    // checked (header and section checksums) when opened; entries are then walked in path
+    // order straight from the mapping. There is no lookup by path: every run diffs the
+    // whole local tree against the whole remote state, so a load needs every entry in a
+    // FileInfoMap whatever the access method. File layout (all integers little endian):
+    //
+    //   Header   : magic, version, entry count, section offsets/sizes and CRC-32s
+    //   Options  : name/value string pairs
+    //   Paths    : sorted paths, front coded (length shared with previous path, suffix)
+    //              with a full path every kRestartInterval entries
+    //   Restarts : offset in path table of every restart entry (checked but unused
+    //              when reading; kept so the layout is unchanged)
+    //   Records  : fixed width metadata record per path (in path order)
+    //   Strings  : variable length values referenced from records (fingerprints)
+    //
+    // The options section can be read on its own (readOptions()) without touching the
+    // file state. Failures (missing/corrupt file) are reported by throwing
+    // CBinaryCache::Exception.
+    //
+
+    class CBinaryCache {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CBinaryCache Failure: " + message) {
+            }
+
+        };
+
+        //
+        // Entry walk callback (path and its file information)
+        //
+
+        typedef std::function<void(const std::string &, const Escapement::FileInfo &)> EntryFn;
+
+        //
+        // Entries to write (need not be sorted)
+        //
+
+        typedef std::vector<const Escapement::FileInfoMap::value_type *> EntryList;
+
+        explicit CBinaryCache(const std::string &cacheFile);
+        virtual ~CBinaryCache();
+
+        CBinaryCache(const CBinaryCache &orig) = delete;
+        CBinaryCache(const CBinaryCache &&orig) = delete;
+        CBinaryCache& operator=(CBinaryCache other) = delete;
+
+        static bool isBinaryCache(const std::string &cacheFile);
+        static CachedOptions readOptions(const std::string &cacheFile);
+        static void write(const std::string &cacheFile, const CachedOptions &cachedOptions, const Escapement::FileInfoMap &fileInfoMap);
+        static void write(const std::string &cacheFile, const CachedOptions &cachedOptions, EntryList &entryList);
+
+        std::uint64_t size(void) const;
+        void forEach(EntryFn entryFn) const;
+
+    private:
+
+        struct Header;
+        struct Record;
+
+        static void checkHeader(const Header &cacheHeader, const std::string &cacheFile, std::uint64_t fileSize);
+        void checkSection(std::uint64_t offset, std::uint64_t length, std::uint32_t checksum, const char *name) const;
+        const char *decodePath(const char *entry, std::string &filePath) const;
+        Escapement::FileInfo decodeRecord(std::uint64_t index) const;
+
+        int m_cacheFd { -1 };                       // Cache file
+        const char *m_mapping { nullptr };          // Cache file mapping
+        size_t m_mappingSize { 0 };                 // Cache file mapping size
+        const Header *m_header { nullptr };         // Header (start of mapping)
+        const char *m_pathTable { nullptr };        // Front coded path table
+        const char *m_pathTableEnd { nullptr };     // End of path table
+        const std::uint64_t *m_restarts { nullptr };// Restart entry offsets
+        const Record *m_records { nullptr };        // Metadata records
+        const char *m_strings { nullptr };          // String table
+
+    };
+
+} // namespace Escapement_BinaryCache
+
+#endif /* ESCAPEMENT_BINARYCACHE_HPP */
+
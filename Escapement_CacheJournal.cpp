@@ -0,0 +1,396 @@
+//
+// Class: CCacheJournal
+//
+// Description: Append-only journal of file-state cache changes used by Escapement so
+// that a cycle which changes a handful of files writes a handful of records instead of
+// the whole cache. On load the journal is replayed on top of the last cache snapshot;
+// it is folded into a new snapshot (and started afresh) once it grows large enough.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : File I/O (fdatasync).
+// zlib               : CRC-32.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+
+//
+// zlib
+//
+
+#include <zlib.h>
+
+//
+// Escapement cache journal
+//
+
+#include "Escapement_CacheJournal.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_CacheJournal {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+
+    using namespace Antik::FTP;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Record types
+    //
+
+    static const std::uint8_t kRecordUpdate { 1 };
+    static const std::uint8_t kRecordRemove { 2 };
+
+    //
+    // Record header size (payload length and CRC-32)
+    //
+
+    static const size_t kRecordHeaderSize { 2 * sizeof (std::uint32_t) };
+
+    //
+    // Records written between syncs to disk
+    //
+
+    static const std::uint64_t kJournalSyncRecords { 256 };
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Append a fixed width (host order) value.
+    //
+
+    template <typename T>
+    static void putValue(std::string &buffer, T value) {
+        buffer.append(reinterpret_cast<const char *> (&value), sizeof (value));
+    }
+
+    //
+    // Append a length prefixed string.
+    //
+
+    static void putString(std::string &buffer, const std::string &value) {
+        putValue<std::uint32_t> (buffer, value.size());
+        buffer.append(value);
+    }
+
+    //
+    // Decode a fixed width value. Returns false if it runs past end.
+    //
+
+    template <typename T>
+    static bool getValue(const char *&position, const char *end, T &value) {
+        if (static_cast<size_t> (end - position) < sizeof (value)) {
+            return (false);
+        }
+        std::memcpy(&value, position, sizeof (value));
+        position += sizeof (value);
+        return (true);
+    }
+
+    //
+    // Decode a length prefixed string. Returns false if it runs past end.
+    //
+
+    static bool getString(const char *&position, const char *end, std::string &value) {
+        std::uint32_t length;
+        if (!getValue(position, end, length) || (static_cast<size_t> (end - position) < length)) {
+            return (false);
+        }
+        value.assign(position, length);
+        position += length;
+        return (true);
+    }
+
+    //
+    // Apply a record payload to file information (passing its path to any replayFn).
+    // Returns false if it is not valid.
+    //
+
+    static bool applyRecord(const char *position, const char *end, FileInfoMap &fileInfoMap, const CCacheJournal::ReplayFn &replayFn) {
+
+        std::uint8_t recordType;
+        std::string filePath;
+
+        if (!getValue(position, end, recordType) || !getString(position, end, filePath)) {
+            return (false);
+        }
+
+        if (recordType == kRecordRemove) {
+            if (position != end) {
+                return (false);
+            }
+            fileInfoMap.erase(filePath);
+            if (replayFn) {
+                replayFn(filePath);
+            }
+            return (true);
+        }
+
+        if (recordType == kRecordUpdate) {
+            FileInfo fileInfo;
+            std::uint8_t directory;
+            std::string modified;
+            if (!getValue(position, end, fileInfo.size) || !getValue(position, end, directory) ||
+                !getString(position, end, modified) || !getString(position, end, fileInfo.fingerprint) || (position != end)) {
+                return (false);
+            }
+            fileInfo.directory = (directory != 0);
+            fileInfo.modified = static_cast<CFTP::DateTime> (modified);
+            fileInfoMap[filePath] = fileInfo;
+            if (replayFn) {
+                replayFn(filePath);
+            }
+            return (true);
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Replay journal file into file information, returning the number of records applied
+    // and setting validLength to the length of the journal up to the last good record.
+    //
+
+    static std::uint64_t replayJournal(const std::string &journalFile, FileInfoMap &fileInfoMap, const CCacheJournal::ReplayFn &replayFn, std::uint64_t &validLength) {
+
+        std::ifstream journalFileStream { journalFile, std::ios::binary };
+        std::string journal { std::istreambuf_iterator<char>(journalFileStream), std::istreambuf_iterator<char>() };
+        const char *position = journal.data();
+        const char *end = position + journal.size();
+        std::uint64_t recordCount { 0 };
+
+        validLength = 0;
+
+        while (static_cast<size_t> (end - position) >= kRecordHeaderSize) {
+            std::uint32_t payloadLength, payloadChecksum;
+            const char *record = position;
+            getValue(record, end, payloadLength);
+            getValue(record, end, payloadChecksum);
+            if ((static_cast<size_t> (end - record) < payloadLength) ||
+                (crc32(0L, reinterpret_cast<const Bytef *> (record), payloadLength) != payloadChecksum) ||
+                !applyRecord(record, record + payloadLength, fileInfoMap, replayFn)) {
+                break;
+            }
+            position = record + payloadLength;
+            validLength = position - journal.data();
+            recordCount++;
+        }
+
+        return (recordCount);
+
+    }
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Open journal file for appending.
+    //
+
+    void CCacheJournal::open(void) {
+
+        m_journalFd = ::open(m_journalFile.c_str(), O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC, 0600);
+        if (m_journalFd == -1) {
+            throw Exception("Could not open [" + m_journalFile + "]: " + std::string(std::strerror(errno)));
+        }
+
+    }
+
+    //
+    // Append record (payload with length and CRC-32) to journal, syncing every
+    // kJournalSyncRecords records.
+    //
+
+    void CCacheJournal::append(const std::string &payload) {
+
+        std::string record;
+
+        putValue<std::uint32_t> (record, payload.size());
+        putValue<std::uint32_t> (record, crc32(0L, reinterpret_cast<const Bytef *> (payload.data()), payload.size()));
+        record.append(payload);
+
+        for (size_t bytesWritten = 0; bytesWritten < record.size();) {
+            ssize_t writeLength = ::write(m_journalFd, record.data() + bytesWritten, record.size() - bytesWritten);
+            if (writeLength == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw Exception("Could not write [" + m_journalFile + "]: " + std::string(std::strerror(errno)));
+            }
+            bytesWritten += writeLength;
+        }
+
+        m_recordCount++;
+
+        if (++m_unsyncedRecords >= kJournalSyncRecords) {
+            sync();
+        }
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Replay journal into file information and open it for appending further changes. Any
+    // torn record left at the end by a crash is truncated away first.
+    //
+
+    CCacheJournal::CCacheJournal(const std::string &journalFile, FileInfoMap &fileInfoMap, ReplayFn replayFn) : m_journalFile { journalFile } {
+
+        std::uint64_t validLength;
+
+        m_recordCount = replayJournal(m_journalFile, fileInfoMap, replayFn, validLength);
+
+        open();
+
+        if (ftruncate(m_journalFd, validLength) != 0) {
+            ::close(m_journalFd);
+            throw Exception("Could not truncate [" + m_journalFile + "]: " + std::string(std::strerror(errno)));
+        }
+
+    }
+
+    //
+    // Destructor (outstanding records are synced)
+    //
+
+    CCacheJournal::~CCacheJournal() {
+
+        if (m_journalFd != -1) {
+            if (m_unsyncedRecords != 0) {
+                fdatasync(m_journalFd);
+            }
+            ::close(m_journalFd);
+        }
+
+    }
+
+    //
+    // Replay a journal file (read only) into file information. Returns records applied.
+    //
+
+    std::uint64_t CCacheJournal::replay(const std::string &journalFile, FileInfoMap &fileInfoMap, ReplayFn replayFn) {
+
+        std::uint64_t validLength;
+
+        return (replayJournal(journalFile, fileInfoMap, replayFn, validLength));
+
+    }
+
+    //
+    // Record entry added/updated.
+    //
+
+    void CCacheJournal::update(const std::string &filePath, const FileInfo &fileInfo) {
+
+        std::string payload;
+
+        putValue(payload, kRecordUpdate);
+        putString(payload, filePath);
+        putValue(payload, fileInfo.size);
+        putValue<std::uint8_t> (payload, fileInfo.directory);
+        putString(payload, static_cast<std::string> (fileInfo.modified));
+        putString(payload, fileInfo.fingerprint);
+
+        append(payload);
+
+    }
+
+    //
+    // Record entry removed.
+    //
+
+    void CCacheJournal::remove(const std::string &filePath) {
+
+        std::string payload;
+
+        putValue(payload, kRecordRemove);
+        putString(payload, filePath);
+
+        append(payload);
+
+    }
+
+    //
+    // Sync records written to disk.
+    //
+
+    void CCacheJournal::sync(void) {
+
+        if (m_unsyncedRecords != 0) {
+            if (fdatasync(m_journalFd) != 0) {
+                throw Exception("Could not sync [" + m_journalFile + "]: " + std::string(std::strerror(errno)));
+            }
+            m_unsyncedRecords = 0;
+        }
+
+    }
+
+    //
+    // Move current records to rotatedFile (for folding into a snapshot) and start an
+    // empty journal.
+    //
+
+    void CCacheJournal::rotate(const std::string &rotatedFile) {
+
+        sync();
+
+        if (std::rename(m_journalFile.c_str(), rotatedFile.c_str()) != 0) {
+            throw Exception("Could not rename [" + m_journalFile + "]: " + std::string(std::strerror(errno)));
+        }
+
+        ::close(m_journalFd);
+        m_journalFd = -1;
+        m_recordCount = 0;
+
+        open();
+
+    }
+
+    //
+    // Return number of records in journal.
+    //
+
+    std::uint64_t CCacheJournal::getRecordCount(void) const {
+
+        return (m_recordCount);
+
+    }
+
+} // namespace Escapement_CacheJournal
@@ -0,0 +1,84 @@
+#ifndef ESCAPEMENT_CACHEJOURNAL_HPP
+#define ESCAPEMENT_CACHEJOURNAL_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <stdexcept>
+#include <functional>
+#include <cstdint>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_CacheJournal {
+
+    //
+    // Append-only journal of file-state cache changes (entry updated/removed) made since
+    // the last cache snapshot. Each record carries a length and CRC-32 so that replay
+    // stops cleanly at a record torn by a crash (which is then truncated away). Records
+    // are written as they happen and synced to disk in batches (or on sync()). Failures
+    // are reported by throwing CCacheJournal::Exception.
+    //
+
+    class CCacheJournal {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CCacheJournal Failure: " + message) {
+            }
+
+        };
+
+        //
+        // Replay callback (path of each entry changed)
+        //
+
+        typedef std::function<void(const std::string &)> ReplayFn;
+
+        CCacheJournal(const std::string &journalFile, Escapement::FileInfoMap &fileInfoMap, ReplayFn replayFn = nullptr);
+        virtual ~CCacheJournal();
+
+        CCacheJournal(const CCacheJournal &orig) = delete;
+        CCacheJournal(const CCacheJournal &&orig) = delete;
+        CCacheJournal& operator=(CCacheJournal other) = delete;
+
+        static std::uint64_t replay(const std::string &journalFile, Escapement::FileInfoMap &fileInfoMap, ReplayFn replayFn = nullptr);
+
+        void update(const std::string &filePath, const Escapement::FileInfo &fileInfo);
+        void remove(const std::string &filePath);
+        void sync(void);
+        void rotate(const std::string &rotatedFile);
+        std::uint64_t getRecordCount(void) const;
+
+    private:
+
+        void open(void);
+        void append(const std::string &payload);
+
+        std::string m_journalFile;              // Journal file name
+        int m_journalFd { -1 };                 // Journal file (open for append)
+        std::uint64_t m_recordCount { 0 };      // Records in journal
+        std::uint64_t m_unsyncedRecords { 0 };  // Records written since last sync
+
+    };
+
+} // namespace Escapement_CacheJournal
+
+#endif /* ESCAPEMENT_CACHEJOURNAL_HPP */
+
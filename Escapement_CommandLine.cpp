@@ -19,6 +19,9 @@
 //
 
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <cctype>
 
 //
 // Antik Classes
@@ -74,11 +77,30 @@ namespace Escapement_CommandLine {
                 ("password,p", po::value<std::string>(&optionData.userPassword)->required(), "User password")
                 ("remote,r", po::value<std::string>(&optionData.remoteDirectory)->required(), "Remote directory to restore")
                 ("local,l", po::value<std::string>(&optionData.localDirectory)->required(), "Local directory as base for restore")
-                ("cache,c", po::value<std::string>(&optionData.fileCache), "JSON file cache")
+                ("cache,c", po::value<std::string>(&optionData.fileCache), "File cache")
                 ("polltime,t", po::value<int>(&optionData.pollTime), "Server poll time in minutes")
                 ("command,m", po::value<int>(&optionData.command), "Command: 0 (Synchronise), 1 (Pull) , 2 (Refresh cache)")
                 ("nossl,n", "Switch off ssl for connection")
-                ("override,v", "Override any command line options from cache file");
+                ("noverify", "Do not verify server TLS certificate")
+                ("override,v", "Override any command line options from cache file")
+                ("connections", po::value<int>(&optionData.transferConnections), "Number of parallel transfer connections")
+                ("smallfile", po::value<std::uint64_t>(&optionData.smallFileSize), "Small file transfer lane threshold in bytes")
+                ("segments", po::value<int>(&optionData.downloadSegments), "Number of connections per segmented download")
+                ("segmentsize", po::value<std::uint64_t>(&optionData.segmentSize), "Segmented download threshold in bytes")
+                ("journal", po::value<std::string>(&optionData.journalFile), "Partial transfer journal file")
+                ("resumesize", po::value<std::uint64_t>(&optionData.resumeSize), "Resumable transfer threshold in bytes")
+                ("buffersize", po::value<size_t>(&optionData.ioBufferSize), "Transfer buffer size in bytes")
+                ("compress", "Compress transfers (MODE Z) where server supports it")
+                ("append", "Upload only the appended tail of files that have grown")
+                ("persistent", "Keep server connection open between polls")
+                ("fullpull", "Pull all files from server (not just missing/stale ones)")
+                ("clockprobe", "Measure server clock skew on pull by uploading a probe file")
+                ("directio", po::value<std::uint64_t>(&optionData.directIOSize), "Direct I/O (O_DIRECT) download threshold in bytes (0 == off)")
+                ("cacheexport", po::value<std::string>(&optionData.cacheExport), "Export file cache as JSON to file")
+                ("serverconnections", po::value<int>(&optionData.serverConnections), "Maximum pooled transfer connections per server (0 == no limit)")
+                ("priority", po::value<int>(&optionData.jobPriority), "Job weight in fair share of server connections and bandwidth")
+                ("minconnections", po::value<int>(&optionData.minConnections), "Server connections job is served first up to")
+                ("maxconnections", po::value<int>(&optionData.maxConnections), "Maximum server connections job may hold (0 == no limit)");
 
     }
 
@@ -99,7 +121,9 @@ namespace Escapement_CommandLine {
         po::options_description commandLine("Program Options");
         commandLine.add_options()
                 ("help", "Print help messages")
-                ("config,c", po::value<std::string>(&optionData.configFileName), "Config File Name");
+                ("config,c", po::value<std::string>(&optionData.configFileName), "Config File Name")
+                ("jobs", po::value<std::string>(&optionData.jobListFile), "Run as daemon for jobs in list file (one job's options per line)")
+                ("jobthreads", po::value<int>(&optionData.jobThreads), "Number of daemon worker threads running jobs");
 
         addCommonOptions(commandLine, optionData);
 
@@ -133,6 +157,28 @@ namespace Escapement_CommandLine {
                 }
             }
 
+            // Daemon only needs its job list (each job's options are fetched from it)
+
+            if (vm.count("jobs")) {
+                optionData.jobListFile = vm["jobs"].as<std::string>();
+                if (vm.count("jobthreads")) {
+                    if (vm["jobthreads"].as<int>() < 1) {
+                        throw po::error("Number of job threads must be at least 1.");
+                    }
+                    optionData.jobThreads = vm["jobthreads"].as<int>();
+                }
+                if (vm.count("serverconnections")) {
+                    if (vm["serverconnections"].as<int>() < 0) {
+                        throw po::error("Number of server connections cannot be negative.");
+                    }
+                    optionData.serverConnections = vm["serverconnections"].as<int>();
+                }
+                if (!CFile::exists(optionData.jobListFile)) {
+                    throw po::error("Specified job list file does not exist.");
+                }
+                return (optionData);
+            }
+
             if (vm.count("command")) {
                 if ((vm["command"].as<int>() < kEscapementSynchronise) || 
                     (vm["command"].as<int>() > kEscapementRefreshCache)) {
@@ -140,8 +186,60 @@ namespace Escapement_CommandLine {
                 }
             }
             
+            if (vm.count("connections")) {
+                if (vm["connections"].as<int>() < 1) {
+                    throw po::error("Number of transfer connections must be at least 1.");
+                }
+            }
+            
+            if (vm.count("segments")) {
+                if (vm["segments"].as<int>() < 1) {
+                    throw po::error("Number of download segments must be at least 1.");
+                }
+            }
+            
+            if (vm.count("serverconnections")) {
+                if (vm["serverconnections"].as<int>() < 0) {
+                    throw po::error("Number of server connections cannot be negative.");
+                }
+            }
+            
+            if (vm.count("priority")) {
+                if (vm["priority"].as<int>() < 1) {
+                    throw po::error("Job priority must be at least 1.");
+                }
+            }
+            
+            if (vm.count("minconnections")) {
+                if (vm["minconnections"].as<int>() < 0) {
+                    throw po::error("Minimum job connections cannot be negative.");
+                }
+            }
+            
+            if (vm.count("maxconnections")) {
+                if (vm["maxconnections"].as<int>() < 0) {
+                    throw po::error("Maximum job connections cannot be negative.");
+                }
+                if ((vm["maxconnections"].as<int>() != 0) && vm.count("minconnections") &&
+                    (vm["maxconnections"].as<int>() < vm["minconnections"].as<int>())) {
+                    throw po::error("Maximum job connections cannot be less than minimum.");
+                }
+            }
+            
+            if (vm.count("buffersize")) {
+                if (vm["buffersize"].as<size_t>() == 0) {
+                    throw po::error("Transfer buffer size must be greater than 0.");
+                }
+            }
+            
             optionData.noSSL=vm.count("nossl");
+            optionData.noVerify=vm.count("noverify");
             optionData.override=vm.count("override");
+            optionData.compress=vm.count("compress");
+            optionData.appendUploads=vm.count("append");
+            optionData.persistentSession=vm.count("persistent");
+            optionData.fullPull=vm.count("fullpull");
+            optionData.clockProbe=vm.count("clockprobe");
             
             po::notify(vm);
 
@@ -157,5 +255,66 @@ namespace Escapement_CommandLine {
         
     }
 
+    //
+    // Read daemon job list and fetch each job's options. Each non blank line (other than
+    // # comments) holds one job's command line options (for example --config job.cfg),
+    // split on white space with double quotes grouping.
+    //
+
+    std::vector<EscapementOptions> fetchJobListOptions(const std::string &jobListFile) {
+
+        std::vector<EscapementOptions> jobOptions;
+        std::ifstream jobListStream { jobListFile };
+        std::string jobLine;
+
+        while (std::getline(jobListStream, jobLine)) {
+
+            std::vector<std::string> jobArguments { "Escapement" };
+            bool quoted { false }, inArgument { false };
+
+            for (char jobChar : jobLine) {
+                if (jobChar == '"') {
+                    quoted = !quoted;
+                    if (!inArgument) {
+                        jobArguments.emplace_back();
+                        inArgument = true;
+                    }
+                } else if (!quoted && std::isspace(static_cast<unsigned char> (jobChar))) {
+                    inArgument = false;
+                } else {
+                    if (!inArgument) {
+                        if ((jobChar == '#') && (jobArguments.size() == 1)) {
+                            break;
+                        }
+                        jobArguments.emplace_back();
+                        inArgument = true;
+                    }
+                    jobArguments.back().push_back(jobChar);
+                }
+            }
+
+            if (jobArguments.size() == 1) {
+                continue;
+            }
+
+            std::vector<char *> jobArgv;
+            for (auto &argument : jobArguments) {
+                jobArgv.push_back(&argument[0]);
+            }
+            jobArgv.push_back(nullptr);
+
+            jobOptions.push_back(fetchCommandLineOptions(static_cast<int> (jobArguments.size()), jobArgv.data()));
+
+            if (!jobOptions.back().jobListFile.empty()) {
+                std::cerr << "Escapement Error: Job [" << jobLine << "] cannot itself be a daemon." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+
+        }
+
+        return (jobOptions);
+
+    }
+
 } // namespace Escapement_CommandLine
 
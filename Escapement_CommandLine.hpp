@@ -6,6 +6,7 @@
 //
 
 #include <string>
+#include <vector>
 
 //
 // Escapement
@@ -20,6 +21,7 @@
 namespace Escapement_CommandLine {
 
     Escapement::EscapementOptions fetchCommandLineOptions(int argc, char** argv);
+    std::vector<Escapement::EscapementOptions> fetchJobListOptions(const std::string &jobListFile);
 
 } // namespace Escapement_CommandLine
 
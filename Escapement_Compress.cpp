@@ -0,0 +1,193 @@
+//
+// Module: Escapement_Compress
+//
+// Description: Escapement MODE Z (deflate) compression policy. Decides whether a
+// file is worth compressing (by file extension for already compressed formats and,
+// where the file is local, by deflating a sample of it), adapts the compression level
+// to the measured link throughput and formats per file transfer reports.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : File I/O (pread).
+// zlib               : Sample compression.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <vector>
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+#include <iomanip>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+
+//
+// zlib
+//
+
+#include <zlib.h>
+
+//
+// Escapement compression
+//
+
+#include "Escapement_Compress.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Compress {
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Extensions of file formats that are already compressed
+    //
+
+    static const std::vector<std::string> kCompressedExtensions {
+        "7z", "apk", "avi", "bz2", "docx", "flac", "gif", "gz", "heic", "jar", "jpeg", "jpg",
+        "lz4", "m4a", "mkv", "mov", "mp3", "mp4", "ogg", "png", "pptx", "rar", "tgz", "webm",
+        "webp", "xlsx", "xz", "zip", "zst"
+    };
+
+    //
+    // Sample size and the compressed/original percentage below which a file is compressed
+    //
+
+    static const size_t kSampleSize { 64 * 1024 };
+    static const uLong kCompressiblePercent { 90 };
+
+    //
+    // Level adaptation: minimum transfer size measured, fractions of the link rate below
+    // which compression is holding back the link and above which the link is the
+    // bottleneck, and the decay applied to the link rate estimate per transfer.
+    //
+
+    static const std::uint64_t kAdaptMinimumBytes { 1024 * 1024 };
+    static const double kCompressionBoundRate { 0.5 };
+    static const double kLinkBoundRate { 0.8 };
+    static const double kLinkRateDecay { 0.9 };
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Return false if file name has the extension of an already compressed format.
+    //
+
+    bool isCompressibleName(const std::string &fileName) {
+
+        size_t extensionStart = fileName.find_last_of("./");
+
+        if ((extensionStart == std::string::npos) || (fileName[extensionStart] != '.')) {
+            return (true);
+        }
+
+        std::string extension { fileName.substr(extensionStart + 1) };
+        std::transform(extension.begin(), extension.end(), extension.begin(), [] (unsigned char c) {
+            return (std::tolower(c));
+        });
+
+        return (!std::binary_search(kCompressedExtensions.begin(), kCompressedExtensions.end(), extension));
+
+    }
+
+    //
+    // Return true if a local file is worth compressing; its name is checked and then
+    // a sample from the start of the file deflated at the lowest level.
+    //
+
+    bool isCompressibleFile(const std::string &fileName, int localFile) {
+
+        if (!isCompressibleName(fileName)) {
+            return (false);
+        }
+
+        std::vector<Bytef> sampleBuffer(kSampleSize);
+        ssize_t sampleLength = pread(localFile, sampleBuffer.data(), sampleBuffer.size(), 0);
+
+        if (sampleLength <= 0) {
+            return (false);
+        }
+
+        uLongf compressedLength = compressBound(sampleLength);
+        std::vector<Bytef> compressedBuffer(compressedLength);
+
+        if (compress2(compressedBuffer.data(), &compressedLength, sampleBuffer.data(), sampleLength, kMinimumCompressionLevel) != Z_OK) {
+            return (false);
+        }
+
+        return ((compressedLength * 100) < (static_cast<uLong> (sampleLength) * kCompressiblePercent));
+
+    }
+
+    //
+    // Update link rate estimate and compression level from a completed transfer. When
+    // compressed data crosses the data connection at well below the link rate the
+    // compressor (ours for uploads, the server's for downloads) is the bottleneck and
+    // the level is lowered; when it goes at close to link rate the level is raised.
+    //
+
+    void adaptCompressionLevel(CompressionControl &compressionControl, const TransferStats &transferStats) {
+
+        if ((transferStats.fileBytes < kAdaptMinimumBytes) || (transferStats.seconds <= 0.0)) {
+            return;
+        }
+
+        double wireRate = transferStats.wireBytes / transferStats.seconds;
+
+        if (transferStats.compressed && (compressionControl.linkRate > 0.0)) {
+            if (wireRate < (compressionControl.linkRate * kCompressionBoundRate)) {
+                compressionControl.level = std::max(compressionControl.level - 1, kMinimumCompressionLevel);
+            } else if (wireRate >= (compressionControl.linkRate * kLinkBoundRate)) {
+                compressionControl.level = std::min(compressionControl.level + 1, kMaximumCompressionLevel);
+            }
+        }
+
+        compressionControl.linkRate = std::max(wireRate, compressionControl.linkRate * kLinkRateDecay);
+
+    }
+
+    //
+    // Return report line for a file transfer (throughput and compression ratio).
+    //
+
+    std::string transferReport(const std::string &fileName, const TransferStats &transferStats) {
+
+        std::ostringstream report;
+
+        report << std::fixed << std::setprecision(2);
+        report << "Transferred [" << fileName << "] " << transferStats.fileBytes << " bytes in " << transferStats.seconds << "s";
+        if (transferStats.seconds > 0.0) {
+            report << " (" << (transferStats.fileBytes / transferStats.seconds / (1024 * 1024)) << " MB/s)";
+        }
+        if (transferStats.compressed) {
+            report << " compressed level " << transferStats.level;
+            if (transferStats.wireBytes != 0) {
+                report << " ratio " << (static_cast<double> (transferStats.fileBytes) / transferStats.wireBytes);
+            }
+        } else {
+            report << " uncompressed";
+        }
+
+        return (report.str());
+
+    }
+
+} // namespace Escapement_Compress
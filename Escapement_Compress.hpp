@@ -0,0 +1,55 @@
+#ifndef ESCAPEMENT_COMPRESS_HPP
+#define ESCAPEMENT_COMPRESS_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <cstdint>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Compress {
+
+    //
+    // Deflate compression levels
+    //
+
+    const int kMinimumCompressionLevel { 1 };
+    const int kMaximumCompressionLevel { 9 };
+    const int kDefaultCompressionLevel { 6 };
+
+    //
+    // Statistics for a single file transfer
+    //
+
+    struct TransferStats {
+        std::uint64_t fileBytes { 0 };      // File bytes transferred
+        std::uint64_t wireBytes { 0 };      // Bytes sent/received over data connection
+        double seconds { 0.0 };             // Transfer time
+        bool compressed { false };          // == true transferred with MODE Z
+        int level { 0 };                    // Compression level used (if compressed)
+    };
+
+    //
+    // Compression level control for a connection. The level moves up while the
+    // link is the bottleneck and down when compression is holding back the link.
+    //
+
+    struct CompressionControl {
+        int level { kDefaultCompressionLevel }; // Current compression level
+        double linkRate { 0.0 };                // Estimated link throughput (bytes/second)
+    };
+
+    bool isCompressibleName(const std::string &fileName);
+    bool isCompressibleFile(const std::string &fileName, int localFile);
+    void adaptCompressionLevel(CompressionControl &compressionControl, const TransferStats &transferStats);
+    std::string transferReport(const std::string &fileName, const TransferStats &transferStats);
+
+} // namespace Escapement_Compress
+
+#endif /* ESCAPEMENT_COMPRESS_HPP */
+
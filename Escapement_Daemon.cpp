@@ -0,0 +1,152 @@
+//
+// Class: CJobScheduler
+//
+// Description: Job scheduler for Escapement daemon mode, in which one process runs
+// every job in a job list instead of one process per job. A fixed number of worker
+// threads take whichever job is next due, run it and then schedule it again its poll
+// interval later, so jobs poll independently of each other while sharing the worker
+// threads (and through them the session pool, TLS session and server capability caches).
+// A job that throws is reported and rescheduled as normal.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <thread>
+
+//
+// Escapement daemon
+//
+
+#include "Escapement_Daemon.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Daemon {
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Worker thread. Wait for the earliest due job not already running, run it and
+    // reschedule it; return once every job has finished.
+    //
+
+    void CJobScheduler::runWorker(void) {
+
+        std::unique_lock<std::mutex> jobLock(m_jobMutex);
+
+        while (m_jobsFinished != m_jobs.size()) {
+
+            Job *nextJob { nullptr };
+
+            for (auto &job : m_jobs) {
+                if (!job.running && !job.finished && (!nextJob || (job.nextRun < nextJob->nextRun))) {
+                    nextJob = &job;
+                }
+            }
+
+            if (!nextJob) {
+                m_jobChanged.wait(jobLock);
+                continue;
+            }
+
+            if (nextJob->nextRun > std::chrono::steady_clock::now()) {
+                m_jobChanged.wait_until(jobLock, nextJob->nextRun);
+                continue;
+            }
+
+            nextJob->running = true;
+            jobLock.unlock();
+
+            try {
+                nextJob->jobFn();
+            } catch (const std::exception &e) {
+                std::cerr << "Escapement error: Job [" << nextJob->name << "] failed [" << e.what() << "]" << std::endl;
+            }
+
+            jobLock.lock();
+            nextJob->running = false;
+            if (nextJob->pollInterval.count() == 0) {
+                nextJob->finished = true;
+                m_jobsFinished++;
+            } else {
+                nextJob->nextRun = std::chrono::steady_clock::now() + nextJob->pollInterval;
+            }
+
+            m_jobChanged.notify_all();
+
+        }
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Create scheduler with a given number of worker threads
+    //
+
+    CJobScheduler::CJobScheduler(int workerThreads) : m_workerThreads(workerThreads) {
+
+        if (m_workerThreads < 1) {
+            throw Exception("Number of worker threads must be at least 1.");
+        }
+
+    }
+
+    CJobScheduler::~CJobScheduler() {
+
+    }
+
+    //
+    // Add job (first due immediately); jobs are all added before run().
+    //
+
+    void CJobScheduler::addJob(const std::string &jobName, std::chrono::minutes pollInterval, JobFn jobFn) {
+
+        Job job;
+
+        job.name = jobName;
+        job.pollInterval = pollInterval;
+        job.jobFn = jobFn;
+        job.nextRun = std::chrono::steady_clock::now();
+
+        std::lock_guard<std::mutex> jobLock(m_jobMutex);
+        m_jobs.push_back(std::move(job));
+
+    }
+
+    //
+    // Run jobs until all have finished (never if any job polls).
+    //
+
+    void CJobScheduler::run(void) {
+
+        std::vector<std::thread> workers;
+
+        for (int worker = 0; worker < m_workerThreads; worker++) {
+            workers.emplace_back(&CJobScheduler::runWorker, this);
+        }
+
+        for (auto &worker : workers) {
+            worker.join();
+        }
+
+    }
+
+} // namespace Escapement_Daemon
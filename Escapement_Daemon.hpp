@@ -0,0 +1,87 @@
+#ifndef ESCAPEMENT_DAEMON_HPP
+#define ESCAPEMENT_DAEMON_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Daemon {
+
+    //
+    // Runs jobs on a fixed pool of worker threads, each job on its own schedule (run
+    // again its poll interval after it last finished; a zero interval runs it once).
+    // A job never runs on two workers at once.
+    //
+
+    class CJobScheduler {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CJobScheduler Failure: " + message) {
+            }
+
+        };
+
+        //
+        // Job function
+        //
+
+        typedef std::function<void(void)> JobFn;
+
+        explicit CJobScheduler(int workerThreads);
+        virtual ~CJobScheduler();
+
+        CJobScheduler(const CJobScheduler &orig) = delete;
+        CJobScheduler(const CJobScheduler &&orig) = delete;
+        CJobScheduler& operator=(CJobScheduler other) = delete;
+
+        void addJob(const std::string &jobName, std::chrono::minutes pollInterval, JobFn jobFn);
+        void run(void);
+
+    private:
+
+        //
+        // Scheduled job
+        //
+
+        struct Job {
+            std::string name;                               // Job name (for errors)
+            std::chrono::minutes pollInterval { 0 };        // Time between runs (0 == run once)
+            JobFn jobFn;                                    // Job function
+            std::chrono::steady_clock::time_point nextRun;  // Time job next due
+            bool running { false };                         // == true job running on a worker
+            bool finished { false };                        // == true job will not run again
+        };
+
+        void runWorker(void);
+
+        int m_workerThreads { 1 };              // Worker thread count
+        std::vector<Job> m_jobs;                // Scheduled jobs
+        size_t m_jobsFinished { 0 };            // Jobs that will not run again
+        std::mutex m_jobMutex;                  // Job list mutex
+        std::condition_variable m_jobChanged;   // Signalled when a job finishes a run
+
+    };
+
+} // namespace Escapement_Daemon
+
+#endif /* ESCAPEMENT_DAEMON_HPP */
+
@@ -0,0 +1,363 @@
+//
+// Module: Escapement_Delete
+//
+// Description: Escapement remote file deletion. The entries to delete are split
+// into branches: each directory subtree being deleted in its entirety is a branch
+// of its own and any remaining entries form one more. Branches are spread (largest
+// first) over sessions from the shared session pool and removed concurrently.
+//
+// A session whose server offers a recursive remove (SITE RMDIR) deletes a whole
+// subtree with one command once a fresh listing shows the subtree holds nothing
+// outside the branch. Otherwise each entry is removed with the one command its known
+// type needs (DELE for files, RMD for directories) and the commands pipelined in
+// windows. As the server handles commands in order, children listed before their
+// parents are gone by the time a parent directory is removed.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+//
+// Escapement delete
+//
+
+#include "Escapement_Delete.hpp"
+#include "Escapement_Session.hpp"
+#include "Escapement_SessionPool.hpp"
+#include "Escapement_Async.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Delete {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+    using namespace Escapement_Session;
+    using namespace Escapement_SessionPool;
+
+    using namespace Antik;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Attempts made at deleting a branch before it is given up on
+    //
+
+    static const int kDeleteAttempts { 3 };
+
+    //
+    // Branches waiting to be deleted and entries deleted so far
+    //
+
+    struct DeleteQueue {
+        std::deque<DeleteBranch> branches;  // Branches to delete
+        FileList deletedList;               // Entries deleted
+        std::mutex queueMutex;              // Queue access mutex
+    };
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Return parent of remote path ("" if none).
+    //
+
+    static std::string parentPath(const std::string &filePath) {
+
+        size_t parentEnd = filePath.find_last_of(kServerPathSep);
+
+        return ((parentEnd == std::string::npos) ? "" : filePath.substr(0, parentEnd));
+
+    }
+
+    //
+    // Return true if server supports a recursive remove (SITE RMDIR).
+    //
+
+    static bool isRecursiveRemoveSupported(CSession &ftpSession) {
+
+        std::uint16_t statusCode = ftpSession.command("SITE HELP");
+
+        return (((statusCode == 200) || (statusCode == 211) || (statusCode == 214)) &&
+                (ftpSession.getCommandResponse().find("RMDIR") != std::string::npos));
+
+    }
+
+    //
+    // Return true if a fresh listing of a branch's subtree shows no entry outside the
+    // branch, so a recursive remove of its root deletes nothing the cache did not know
+    // about. Any listing failure counts as not covered.
+    //
+
+    static bool isSubtreeCovered(CSession &ftpSession, const DeleteBranch &branch) {
+
+        std::unordered_set<std::string> branchFiles(branch.fileList.begin(), branch.fileList.end());
+        std::vector<std::string> directories { branch.root };
+        std::string listing;
+
+        while (!directories.empty()) {
+            std::string directory { std::move(directories.back()) };
+            directories.pop_back();
+            if (ftpSession.listDirectory(directory, listing) / 100 != 2) {
+                return (false);
+            }
+            for (auto &entry : Escapement_Async::parseListing(listing)) {
+                std::string entryPath { directory + kServerPathSep + entry.name };
+                if (!branchFiles.count(entryPath)) {
+                    return (false);
+                }
+                if (entry.directory) {
+                    directories.push_back(entryPath);
+                }
+            }
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Delete entries (children before parents) using their type from remoteFiles. Entries
+    // sent DELE that fail (their type may be wrong, for example from an old cache without
+    // types) get a second, in order, pass with RMD; a failed RMD is not retried. Returns
+    // the entries deleted.
+    //
+
+    static FileList deleteBranchFiles(CSession &ftpSession, const FileList &fileList, const FileInfoMap &remoteFiles) {
+
+        FileList deletedList;
+        FileList retryList;
+        std::vector<std::string> commandLines;
+        std::vector<bool> directories;
+
+        for (auto &file : fileList) {
+            auto remoteFile = remoteFiles.find(file);
+            directories.push_back((remoteFile != remoteFiles.end()) && remoteFile->second.directory);
+            commandLines.push_back(((directories.back()) ? "RMD " : "DELE ") + file);
+        }
+
+        std::vector<std::uint16_t> statusCodes { ftpSession.commandPipeline(commandLines) };
+
+        for (size_t file = 0; file < fileList.size(); file++) {
+            if (statusCodes[file] == 250) {
+                deletedList.push_back(fileList[file]);
+            } else if (!directories[file]) {
+                retryList.push_back(fileList[file]);
+            }
+        }
+
+        if (!retryList.empty()) {
+            commandLines.clear();
+            for (auto &file : retryList) {
+                commandLines.push_back("RMD " + file);
+            }
+            statusCodes = ftpSession.commandPipeline(commandLines);
+            for (size_t file = 0; file < retryList.size(); file++) {
+                if (statusCodes[file] == 250) {
+                    deletedList.push_back(retryList[file]);
+                }
+            }
+        }
+
+        return (deletedList);
+
+    }
+
+    //
+    // Delete branches from queue over a pooled session until none are left (with a pool
+    // checkpoint after each branch). A branch that fails is put back on the queue (up to
+    // kDeleteAttempts tries) and the session reconnected for the next one; if the session
+    // cannot be (re)connected the branch is put back for the other lanes and this lane ends.
+    //
+
+    static void deleteLane(const EscapementOptions &optionData, DeleteQueue &deleteQueue, const FileInfoMap &remoteFiles) {
+
+        std::unique_ptr<CPooledSession> ftpSession;
+        bool recursiveRemove { false };
+
+        for (;;) {
+
+            DeleteBranch branch;
+            FileList deletedList;
+
+            {
+                std::lock_guard<std::mutex> queueLock(deleteQueue.queueMutex);
+                if (deleteQueue.branches.empty()) {
+                    break;
+                }
+                branch = std::move(deleteQueue.branches.front());
+                deleteQueue.branches.pop_front();
+            }
+
+            try {
+                if (!ftpSession) {
+                    ftpSession.reset(new CPooledSession(optionData));
+                    recursiveRemove = isRecursiveRemoveSupported(**ftpSession);
+                } else {
+                    ftpSession->checkpoint();
+                    if (!(*ftpSession)->isConnected()) {
+                        (*ftpSession)->connect(optionData);
+                    }
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Escapement error: Remote delete connection failed [" << e.what() << "]" << std::endl;
+                std::lock_guard<std::mutex> queueLock(deleteQueue.queueMutex);
+                deleteQueue.branches.push_front(std::move(branch));
+                break;
+            }
+
+            try {
+                if (recursiveRemove && !branch.root.empty() && isSubtreeCovered(**ftpSession, branch) &&
+                        ((*ftpSession)->command("SITE RMDIR " + branch.root) / 100 == 2)) {
+                    deletedList = branch.fileList;
+                } else {
+                    deletedList = deleteBranchFiles(**ftpSession, branch.fileList, remoteFiles);
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Escapement error: Remote delete failed [" << e.what() << "]" << std::endl;
+                (*ftpSession)->close();
+                if (++branch.attempts < kDeleteAttempts) {
+                    std::lock_guard<std::mutex> queueLock(deleteQueue.queueMutex);
+                    deleteQueue.branches.push_back(std::move(branch));
+                }
+                continue;
+            }
+
+            std::lock_guard<std::mutex> queueLock(deleteQueue.queueMutex);
+            deleteQueue.deletedList.insert(deleteQueue.deletedList.end(), deletedList.begin(), deletedList.end());
+
+        }
+
+    }
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Split entries to delete into branches, largest first. A directory (known from
+    // remoteFiles) heads a subtree branch when no remote entry under it is being kept
+    // and its parent does not head one.
+    //
+
+    std::deque<DeleteBranch> splitIntoBranches(const FileList &fileList, const FileInfoMap &remoteFiles) {
+
+        std::unordered_set<std::string> deleteFiles(fileList.begin(), fileList.end());
+        std::unordered_set<std::string> keptDirectories;
+        std::unordered_set<std::string> subtreeDirectories;
+        std::unordered_map<std::string, size_t> branchIndex;
+        std::deque<DeleteBranch> branches(1);
+
+        // Directories with an entry under them not being deleted
+
+        for (auto &remoteFile : remoteFiles) {
+            if (!deleteFiles.count(remoteFile.first)) {
+                for (std::string directory { parentPath(remoteFile.first) }; !directory.empty(); directory = parentPath(directory)) {
+                    if (!keptDirectories.insert(directory).second) {
+                        break;
+                    }
+                }
+            }
+        }
+
+        // Directories deleted in their entirety
+
+        for (auto &file : fileList) {
+            auto remoteFile = remoteFiles.find(file);
+            if ((remoteFile != remoteFiles.end()) && remoteFile->second.directory && !keptDirectories.count(file)) {
+                subtreeDirectories.insert(file);
+            }
+        }
+
+        // Place each entry in the branch of the topmost such directory above (or at) it
+
+        for (auto &file : fileList) {
+            std::string root;
+            for (std::string directory { file }; !directory.empty(); directory = parentPath(directory)) {
+                if (subtreeDirectories.count(directory)) {
+                    root = directory;
+                }
+            }
+            if (root.empty()) {
+                branches[0].fileList.push_back(file);
+            } else {
+                auto branch = branchIndex.find(root);
+                if (branch == branchIndex.end()) {
+                    branch = branchIndex.emplace(root, branches.size()).first;
+                    branches.emplace_back();
+                    branches.back().root = root;
+                }
+                branches[branch->second].fileList.push_back(file);
+            }
+        }
+
+        std::stable_sort(branches.begin(), branches.end(), [] (const DeleteBranch &branch1, const DeleteBranch &branch2) {
+            return (branch1.fileList.size() > branch2.fileList.size());
+        });
+
+        while (!branches.empty() && branches.back().fileList.empty()) {
+            branches.pop_back();
+        }
+
+        return (branches);
+
+    }
+
+    //
+    // Delete remote files/directories (children listed before their parents) over up to
+    // optionData.transferConnections sessions. Returns the entries deleted.
+    //
+
+    FileList deleteRemoteFiles(const EscapementOptions &optionData, const FileList &fileList, const FileInfoMap &remoteFiles) {
+
+        DeleteQueue deleteQueue;
+        std::vector<std::thread> deleteThreads;
+
+        deleteQueue.branches = splitIntoBranches(fileList, remoteFiles);
+
+        int connections = std::min(optionData.transferConnections, static_cast<int> (deleteQueue.branches.size()));
+
+        for (int connection = 1; connection < connections; connection++) {
+            deleteThreads.emplace_back(deleteLane, std::cref(optionData), std::ref(deleteQueue), std::cref(remoteFiles));
+        }
+
+        if (connections > 0) {
+            deleteLane(optionData, deleteQueue, remoteFiles);
+        }
+
+        for (auto &deleteThread : deleteThreads) {
+            deleteThread.join();
+        }
+
+        return (deleteQueue.deletedList);
+
+    }
+
+} // namespace Escapement_Delete
@@ -0,0 +1,40 @@
+#ifndef ESCAPEMENT_DELETE_HPP
+#define ESCAPEMENT_DELETE_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <deque>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Delete {
+
+    //
+    // Branch of entries to delete (children before parents). The root is the top of a
+    // subtree being deleted in its entirety ("" for the branch of remaining entries).
+    //
+
+    struct DeleteBranch {
+        std::string root;           // Subtree root directory
+        Antik::FileList fileList;   // Entries in branch
+        int attempts { 0 };         // Failed delete attempts
+    };
+
+    std::deque<DeleteBranch> splitIntoBranches(const Antik::FileList &fileList, const Escapement::FileInfoMap &remoteFiles);
+    Antik::FileList deleteRemoteFiles(const Escapement::EscapementOptions &optionData, const Antik::FileList &fileList, const Escapement::FileInfoMap &remoteFiles);
+
+} // namespace Escapement_Delete
+
+#endif /* ESCAPEMENT_DELETE_HPP */
+
@@ -1,13 +1,21 @@
 //
 // Module: Escapement_FileCache
 //
-// Description: Escapement file information cache handling code.
+// Description: Escapement file information cache handling code. The cache is held
+// in a binary format (see CBinaryCache) that is mapped rather than parsed; JSON is only
+// used to import an existing cache and to export one on request. The cache file holds
+// the options and the remote file information is split across shard files by top-level
+// directory, loaded and written in parallel. Changes made by a synchronise are appended
+// to a journal (see CCacheJournal) and mark their shard as changed; once the journal
+// grows large it is rotated out and only the changed shards rewritten on a background
+// thread. State is held per cache file so concurrent daemon jobs each have their own.
 // 
 // Dependencies: 
 // 
 // C11++              : Use of C11++ features.
 // Antik Classes      : CFTP.
-// Misc.              : Lohmann JSON library
+// Linux              : access.
+// zlib               : CRC-32.
 //
 
 // =============
@@ -19,7 +27,27 @@
 //
 
 #include <iostream>
-#include <fstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <bitset>
+#include <unordered_map>
+#include <vector>
+#include <exception>
+#include <algorithm>
+#include <cstdio>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+
+//
+// zlib
+//
+
+#include <zlib.h>
 
 //
 // Antik Classes
@@ -32,10 +60,9 @@
 //
 
 #include "Escapement_FileCache.hpp"
-
-// Lohmann JSON library
-
-#include "json.hpp"
+#include "Escapement_BinaryCache.hpp"
+#include "Escapement_CacheJournal.hpp"
+#include "Escapement_JSONCache.hpp"
 
 // =========
 // NAMESPACE
@@ -48,129 +75,493 @@ namespace Escapement_FileCache {
     // =======
     
     using namespace Escapement;
+    using namespace Escapement_BinaryCache;
+    using namespace Escapement_CacheJournal;
+    using namespace Escapement_JSONCache;
             
     using namespace Antik::FTP;
-    
-    using json = nlohmann::json;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Journal and rotated journal (being compacted) file name suffixes
+    //
+
+    static const char *kJournalSuffix { ".journal" };
+    static const char *kRotatedJournalSuffix { ".journal.old" };
+
+    //
+    // Minimum journal records before compaction (also at least a quarter of entries)
+    //
+
+    static const std::uint64_t kCompactionMinRecords { 4096 };
+
+    //
+    // Number of cache shards (entries are sharded by top-level directory) and shard
+    // file name suffix
+    //
+
+    static const int kCacheShards { 16 };
+    static const char *kShardSuffix { ".shard" };
+
+    typedef std::bitset<kCacheShards> ShardSet;
+
+    //
+    // Loaded cache state: journal, shards changed since written and any background
+    // compaction (joined on exit)
+    //
+
+    struct CacheState {
+        std::unique_ptr<CCacheJournal> journal;     // Journal for loaded cache
+        std::string remoteDirectory;                // Remote directory (shard paths relative to)
+        std::mutex shardMutex;                      // Dirty shard guard
+        ShardSet dirtyShards;                       // Shards changed since written
+        std::thread compactionThread;               // Background shard writer
+        void waitForCompaction(void) {
+            if (compactionThread.joinable()) {
+                compactionThread.join();
+            }
+        }
+        ~CacheState() {
+            waitForCompaction();
+        }
+    };
+
+    //
+    // Cache state by cache file (daemon jobs each have their own cache)
+    //
+
+    static struct CacheStates {
+        std::unordered_map<std::string, std::unique_ptr<CacheState>> states;   // State by cache file
+        std::mutex statesMutex;                                                 // States map guard
+    } cacheStates;
 
     // ===============
     // LOCAL FUNCTIONS
     // ===============
 
+    //
+    // Return state for cache file (created on first use)
+    //
+
+    static CacheState &cacheStateOf(const std::string &fileCache) {
+
+        std::lock_guard<std::mutex> statesLock(cacheStates.statesMutex);
+        std::unique_ptr<CacheState> &cacheState { cacheStates.states[fileCache] };
+
+        if (!cacheState) {
+            cacheState.reset(new CacheState());
+        }
+
+        return (*cacheState);
+
+    }
+
+    //
+    // Return options to be cached with file information
+    //
+
+    static CachedOptions cachedOptions(const EscapementOptions &optionData) {
+
+        return (CachedOptions {
+            { "ServerName", optionData.serverName },
+            { "ServerPort", optionData.serverPort },
+            { "UserName", optionData.userName },
+            { "UserPassword", optionData.userPassword },
+            { "RemoteDirectory", optionData.remoteDirectory },
+            { "LocalDirectory", optionData.localDirectory }
+        });
+
+    }
+
+    //
+    // Set options from cached values
+    //
+
+    static void setCachedOptions(const CachedOptions &cachedOptions, EscapementOptions &optionData) {
+
+        for (auto &option : cachedOptions) {
+            if (option.first == "ServerName") {
+                optionData.serverName = option.second;
+            } else if (option.first == "ServerPort") {
+                optionData.serverPort = option.second;
+            } else if (option.first == "UserName") {
+                optionData.userName = option.second;
+            } else if (option.first == "UserPassword") {
+                optionData.userPassword = option.second;
+            } else if (option.first == "RemoteDirectory") {
+                optionData.remoteDirectory = option.second;
+            } else if (option.first == "LocalDirectory") {
+                optionData.localDirectory = option.second;
+            }
+        }
+
+    }
+
+    //
+    // Return shard file name
+    //
+
+    static std::string shardFile(const std::string &fileCache, int shard) {
+
+        return (fileCache + kShardSuffix + (shard < 10 ? "0" : "") + std::to_string(shard));
+
+    }
+
+    //
+    // Mark shard holding a remote path as changed
+    //
+
+    static void markShardDirty(CacheState &cacheState, const std::string &filePath) {
+
+        std::lock_guard<std::mutex> shardLock(cacheState.shardMutex);
+        cacheState.dirtyShards.set(shardOf(cacheState.remoteDirectory, filePath));
+
+    }
+
+    //
+    // Write shards in parallel (one thread per shard) from the entries of remoteFiles
+    // that fall in them. Any failure is rethrown once all writes have finished.
+    //
+
+    static void writeShards(const std::string &fileCache, const std::string &remoteDirectory, const FileInfoMap &remoteFiles, ShardSet shards) {
+
+        std::vector<CBinaryCache::EntryList> shardEntries(kCacheShards);
+        std::vector<std::exception_ptr> shardErrors(kCacheShards);
+        std::vector<std::thread> shardThreads;
+
+        for (auto &file : remoteFiles) {
+            int shard = shardOf(remoteDirectory, file.first);
+            if (shards.test(shard)) {
+                shardEntries[shard].push_back(&file);
+            }
+        }
+
+        for (int shard = 0; shard < kCacheShards; shard++) {
+            if (shards.test(shard)) {
+                shardThreads.emplace_back([&fileCache, &shardEntries, &shardErrors, shard] () {
+                    try {
+                        CBinaryCache::write(shardFile(fileCache, shard), CachedOptions(), shardEntries[shard]);
+                    } catch (...) {
+                        shardErrors[shard] = std::current_exception();
+                    }
+                });
+            }
+        }
+
+        for (auto &shardThread : shardThreads) {
+            shardThread.join();
+        }
+
+        for (auto &shardError : shardErrors) {
+            if (shardError) {
+                std::rethrow_exception(shardError);
+            }
+        }
+
+    }
+
+    //
+    // Load shards in parallel (one thread per shard) into remoteFiles. A missing shard is
+    // empty; a corrupt one throws CBinaryCache::Exception.
+    //
+
+    static void loadShards(const std::string &fileCache, FileInfoMap &remoteFiles) {
+
+        std::vector<std::vector<FileInfoMap::value_type>> shardEntries(kCacheShards);
+        std::vector<std::exception_ptr> shardErrors(kCacheShards);
+        std::vector<std::thread> shardThreads;
+
+        for (int shard = 0; shard < kCacheShards; shard++) {
+            if (access(shardFile(fileCache, shard).c_str(), F_OK) == 0) {
+                shardThreads.emplace_back([&fileCache, &shardEntries, &shardErrors, shard] () {
+                    try {
+                        CBinaryCache binaryCache { shardFile(fileCache, shard) };
+                        shardEntries[shard].reserve(binaryCache.size());
+                        binaryCache.forEach([&shardEntries, shard] (const std::string &filePath, const FileInfo &fileInfo) {
+                            shardEntries[shard].emplace_back(filePath, fileInfo);
+                        });
+                    } catch (...) {
+                        shardErrors[shard] = std::current_exception();
+                    }
+                });
+            }
+        }
+
+        for (auto &shardThread : shardThreads) {
+            shardThread.join();
+        }
+
+        for (auto &shardError : shardErrors) {
+            if (shardError) {
+                std::rethrow_exception(shardError);
+            }
+        }
+
+        size_t entryCount { remoteFiles.size() };
+        for (auto &entries : shardEntries) {
+            entryCount += entries.size();
+        }
+        remoteFiles.reserve(entryCount);
+
+        for (auto &entries : shardEntries) {
+            for (auto &entry : entries) {
+                remoteFiles[entry.first] = std::move(entry.second);
+            }
+            entries.clear();
+            entries.shrink_to_fit();
+        }
+
+    }
+
+    //
+    // Write cache snapshot (all shards and the options file) and discard any journal
+    // (its changes are now in the snapshot). Each file is on disk before its write
+    // returns, so a crash never leaves the journals gone but the snapshot incomplete.
+    //
+
+    static void writeCacheSnapshot(const EscapementRunContext &runContext) {
+
+        const std::string &fileCache { runContext.optionData.fileCache };
+        CacheState &cacheState { cacheStateOf(fileCache) };
+
+        cacheState.waitForCompaction();
+
+        cacheState.remoteDirectory = runContext.optionData.remoteDirectory;
+
+        writeShards(fileCache, cacheState.remoteDirectory, runContext.remoteFiles, ShardSet().set());
+        CBinaryCache::write(fileCache, cachedOptions(runContext.optionData), FileInfoMap());
+
+        cacheState.journal.reset();
+        cacheState.dirtyShards.reset();
+
+        std::remove((fileCache + kJournalSuffix).c_str());
+        std::remove((fileCache + kRotatedJournalSuffix).c_str());
+
+        FileInfoMap emptyJournal;
+        cacheState.journal.reset(new CCacheJournal(fileCache + kJournalSuffix, emptyJournal));
+
+    }
+
     // ================
     // PUBLIC FUNCTIONS
     // ================
-  
-    
+
+    //
+    // Return shard for a remote path (CRC-32 of its top-level directory below the remote
+    // directory, so that a subtree always lives in one shard)
+    //
+
+    int shardOf(const std::string &remoteDirectory, const std::string &filePath) {
+
+        size_t start { 0 };
+
+        if (filePath.compare(0, remoteDirectory.size(), remoteDirectory) == 0) {
+            start = remoteDirectory.size();
+        }
+        start = std::min(filePath.find_first_not_of('/', start), filePath.size());
+
+        size_t end = std::min(filePath.find('/', start), filePath.size());
+
+        return (crc32(0L, reinterpret_cast<const Bytef *> (filePath.data() + start), end - start) % kCacheShards);
+
+    }
+
+    //
+    // Load options from cache (if overriding command line options). Only the options
+    // section is read; file state is left until (and unless) it is needed.
+    //
+
     void loadEscapmentOptions(EscapementOptions &optionData) {
 
         if (optionData.override) {
+            if (CBinaryCache::isBinaryCache(optionData.fileCache)) {
+                setCachedOptions(CBinaryCache::readOptions(optionData.fileCache), optionData);
+            } else {
+                CachedOptions jsonOptions;
+                CJSONCache::read(optionData.fileCache, &jsonOptions, nullptr);
+                setCachedOptions(jsonOptions, optionData);
+            }
+        }
 
-            std::ifstream jsonFileCacheStream{ optionData.fileCache};
+    }
 
-            if (jsonFileCacheStream) {
+    //
+    // Load remote file information from cache. The shards are mapped and walked in place
+    // in parallel and any journalled changes since they were written (including those
+    // of a rotated journal whose compaction did not finish) replayed on top, marking
+    // their shards as changed. A JSON cache (from an older version or an export) or an
+    // unsharded binary cache is imported and written straight out as a snapshot. A
+    // corrupt cache is ignored so that it is rebuilt from the server.
+    //
 
-                json completeJSONFile;
-                jsonFileCacheStream >> completeJSONFile;
+    void loadCachedFiles( EscapementRunContext &runContext) {
 
-                json::iterator findOptions = completeJSONFile.find("EscapementOptions");
-                if (findOptions != completeJSONFile.end()) {
-                    json escapementOptions = findOptions.value();
-                    optionData.serverName = escapementOptions["ServerName"];
-                    optionData.serverPort = escapementOptions["ServerPort"];
-                    optionData.userName = escapementOptions["UserName"];
-                    optionData.userPassword = escapementOptions["UserPassword"];
-                    optionData.remoteDirectory = escapementOptions["RemoteDirectory"];
-                    optionData.localDirectory = escapementOptions["LocalDirectory"];
+        const std::string &fileCache { runContext.optionData.fileCache };
+
+        if (!fileCache.empty()) {
+
+            CacheState &cacheState { cacheStateOf(fileCache) };
+            auto replayFn = [&cacheState] (const std::string &filePath) {
+                markShardDirty(cacheState, filePath);
+            };
+
+            cacheState.waitForCompaction();
+            cacheState.journal.reset();
+            cacheState.dirtyShards.reset();
+            cacheState.remoteDirectory = runContext.optionData.remoteDirectory;
+
+            if (CBinaryCache::isBinaryCache(fileCache)) {
+                bool unsharded { false };
+                try {
+                    CBinaryCache binaryCache { fileCache };
+                    if (binaryCache.size() != 0) {
+                        unsharded = true;
+                        runContext.remoteFiles.reserve(binaryCache.size());
+                        binaryCache.forEach([&runContext] (const std::string &filePath, const FileInfo &fileInfo) {
+                            runContext.remoteFiles[filePath] = fileInfo;
+                        });
+                    }
+                    loadShards(fileCache, runContext.remoteFiles);
+                } catch (const CBinaryCache::Exception &e) {
+                    std::cerr << "Escapement error: Ignoring corrupt cache [" << e.what() << "]" << std::endl;
+                    runContext.remoteFiles.clear();
                 }
+                if (!runContext.remoteFiles.empty()) {
+                    CCacheJournal::replay(fileCache + kRotatedJournalSuffix, runContext.remoteFiles, replayFn);
+                    cacheState.journal.reset(new CCacheJournal(fileCache + kJournalSuffix, runContext.remoteFiles, replayFn));
+                    if (unsharded) {
+                        writeCacheSnapshot(runContext);
+                    }
+                }
+            } else {
+                CJSONCache::read(fileCache, nullptr, &runContext.remoteFiles);
+                if (!runContext.remoteFiles.empty()) {
+                    writeCacheSnapshot(runContext);
+                }
+            }
 
+        }
+
+    }
+
+    //
+    // Journal remote file added/updated
+    //
+
+    void journalFileUpdate(const EscapementOptions &optionData, const std::string &filePath, const FileInfo &fileInfo) {
+
+        if (!optionData.fileCache.empty()) {
+            CacheState &cacheState { cacheStateOf(optionData.fileCache) };
+            if (cacheState.journal) {
+                cacheState.journal->update(filePath, fileInfo);
+                markShardDirty(cacheState, filePath);
             }
+        }
 
+    }
+
+    //
+    // Journal remote file removed
+    //
+
+    void journalFileRemove(const EscapementOptions &optionData, const std::string &filePath) {
+
+        if (!optionData.fileCache.empty()) {
+            CacheState &cacheState { cacheStateOf(optionData.fileCache) };
+            if (cacheState.journal) {
+                cacheState.journal->remove(filePath);
+                markShardDirty(cacheState, filePath);
+            }
         }
-    
+
     }
+
     //
-    // Load local and remote file information from cache
+    // Commit journalled changes to disk. If the journal has grown large it is rotated
+    // out and the shards changed since last written are rewritten (from a copy of their
+    // entries) in the background, after which the rotated journal is discarded. If that
+    // fails the shards stay marked as changed and the rotated journal is kept (and
+    // replayed on load) until a later compaction succeeds. A cache with no journal open
+    // (none loaded) is written as a full snapshot.
     //
 
-    void loadCachedFiles( EscapementRunContext &runContext) {
+    void commitCachedFiles(const EscapementRunContext &runContext) {
 
-        if (!runContext.optionData.fileCache.empty()) {
-            
-            json fileArray = json::array();
-            json completeJSONFile;
+        const std::string &fileCache { runContext.optionData.fileCache };
+
+        if (fileCache.empty()) {
+            return;
+        }
+
+        CacheState &cacheState { cacheStateOf(fileCache) };
+
+        if (!cacheState.journal) {
+            writeCacheSnapshot(runContext);
+        } else {
+
+            cacheState.journal->sync();
 
-            std::ifstream jsonFileCacheStream { runContext.optionData.fileCache };
+            if (cacheState.journal->getRecordCount() >= std::max(kCompactionMinRecords, runContext.remoteFiles.size() / 4)) {
 
-            if (jsonFileCacheStream) {
+                cacheState.waitForCompaction();
 
-                jsonFileCacheStream >> completeJSONFile;
+                if (access((fileCache + kRotatedJournalSuffix).c_str(), F_OK) != 0) {
+                    cacheState.journal->rotate(fileCache + kRotatedJournalSuffix);
+                }
 
-                json::iterator findFiles;
+                ShardSet shards;
+                {
+                    std::lock_guard<std::mutex> shardLock(cacheState.shardMutex);
+                    shards = cacheState.dirtyShards;
+                    cacheState.dirtyShards.reset();
+                }
 
-                findFiles = completeJSONFile.find("RemoteFiles");
-                if (findFiles != completeJSONFile.end()) {
-                    fileArray = findFiles.value();
-                    for (auto file : fileArray) {
-                        runContext.remoteFiles[file["Filename"]] = static_cast<CFTP::DateTime> (file["Modified"].get<std::string>());
+                FileInfoMap shardFiles;
+                for (auto &file : runContext.remoteFiles) {
+                    if (shards.test(shardOf(cacheState.remoteDirectory, file.first))) {
+                        shardFiles.insert(file);
                     }
                 }
 
+                cacheState.compactionThread = std::thread([&cacheState, fileCache, shards, remoteDirectory = cacheState.remoteDirectory] (FileInfoMap remoteFiles) {
+                    try {
+                        writeShards(fileCache, remoteDirectory, remoteFiles, shards);
+                        std::remove((fileCache + kRotatedJournalSuffix).c_str());
+                    } catch (const std::exception &e) {
+                        std::lock_guard<std::mutex> shardLock(cacheState.shardMutex);
+                        cacheState.dirtyShards |= shards;
+                        std::cerr << "Escapement error: Cache compaction failed [" << e.what() << "]" << std::endl;
+                    }
+                }, std::move(shardFiles));
+
             }
 
         }
 
+        if (!runContext.optionData.cacheExport.empty()) {
+            CJSONCache::write(runContext.optionData.cacheExport, cachedOptions(runContext.optionData), runContext.remoteFiles);
+        }
+
     }
 
     //
-    // Save  local and remote file information to cache
+    // Save options and remote file information to (binary) cache as a full snapshot
+    // (discarding any journal) and export it as JSON if requested
     //
 
     void saveCachedFiles(const EscapementRunContext &runContext) {
 
         if (!runContext.optionData.fileCache.empty()) {
+            writeCacheSnapshot(runContext);
+        }
 
-            json fileArray = json::array();
-            json completeJSONFile;
-            json escapementOptions;
-            
-            escapementOptions["ServerName"] = runContext.optionData.serverName;
-            escapementOptions["ServerPort"] = runContext.optionData.serverPort;
-            escapementOptions["UserName"] = runContext.optionData.userName;
-            escapementOptions["UserPassword"] = runContext.optionData.userPassword;    
-            escapementOptions["RemoteDirectory"] = runContext.optionData.remoteDirectory;    
-            escapementOptions["LocalDirectory"] = runContext.optionData.localDirectory;  
-         
-            completeJSONFile["EscapementOptions"] = escapementOptions;
- 
-            for (auto file : runContext.remoteFiles) {
-                json fileJSON;
-                fileJSON["Filename"] = file.first;
-                fileJSON["Modified"] = static_cast<std::string> (file.second);
-                fileArray.push_back(fileJSON);
-            }
-
-            completeJSONFile["RemoteFiles"] = fileArray;
-            fileArray.clear();
-
-            for (auto file : runContext.localFiles) {
-                json fileJSON;
-                fileJSON["Filename"] = file.first;
-                fileJSON["Modified"] = static_cast<std::string> (file.second);
-                fileArray.push_back(fileJSON);
-            }
-
-            completeJSONFile["LocalFiles"] = fileArray;
-
-            std::ofstream jsonFileCacheStream(runContext.optionData.fileCache);
-
-            if (jsonFileCacheStream) {
-                jsonFileCacheStream << std::setw(4) << completeJSONFile << std::endl;
-            }
-
+        if (!runContext.optionData.cacheExport.empty()) {
+            CJSONCache::write(runContext.optionData.cacheExport, cachedOptions(runContext.optionData), runContext.remoteFiles);
         }
 
     }
 
 } // namespace Escapement_FileCache
-
@@ -21,7 +21,11 @@ namespace Escapement_FileCache {
 
     void loadEscapmentOptions(Escapement::EscapementOptions &optionData); 
     void loadCachedFiles(Escapement::EscapementRunContext &runContext);
+    void journalFileUpdate(const Escapement::EscapementOptions &optionData, const std::string &filePath, const Escapement::FileInfo &fileInfo);
+    void journalFileRemove(const Escapement::EscapementOptions &optionData, const std::string &filePath);
+    void commitCachedFiles(const Escapement::EscapementRunContext &runContext);
     void saveCachedFiles(const Escapement::EscapementRunContext &runContext); 
+    int shardOf(const std::string &remoteDirectory, const std::string &filePath);
 
 } // namespace Escapement_FileCache
 
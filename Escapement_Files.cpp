@@ -6,7 +6,8 @@
 // Dependencies: 
 // 
 // C11++              : Use of C11++ features.
-// Antik Classes      : CFile, CPath.
+// Antik Classes      : CFTP, CFile, CPath.
+// Linux              : stat, mkstemp.
 // Misc.              : Lohmann JSON library
 //
 
@@ -19,6 +20,19 @@
 //
 
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <ctime>
+#include <cstdlib>
+
+//
+// Linux
+//
+
+#include <sys/stat.h>
+#include <unistd.h>
 
 //
 // Antik Classes
@@ -34,6 +48,12 @@
 
 #include "Escapement_FileCache.hpp"
 #include "Escapement_Files.hpp"
+#include "Escapement_Transfer.hpp"
+#include "Escapement_Journal.hpp"
+#include "Escapement_Session.hpp"
+#include "Escapement_SessionPool.hpp"
+#include "Escapement_Delete.hpp"
+#include "Escapement_Async.hpp"
 
 // Lohmann JSON library
 
@@ -52,11 +72,64 @@ namespace Escapement_Files {
     using namespace Escapement;
     using namespace Escapement_FileCache;
     using namespace Escapement_CommandLine;
+    using namespace Escapement_Transfer;
+    using namespace Escapement_Journal;
+    using namespace Escapement_Session;
+    using namespace Escapement_SessionPool;
+    using namespace Escapement_Delete;
+    using namespace Escapement_Async;
     
     using namespace Antik;
     using namespace Antik::FTP;
     using namespace Antik::File;
 
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Files pushed (keyed on remote file): content fingerprints for append uploads and
+    // the information of files whose modified time was set to the local one with MFMT
+    //
+
+    struct UploadedFiles {
+        std::unordered_map<std::string, std::string> fingerprints;
+        FileInfoMap remoteFileInfo;
+        std::mutex uploadMutex;
+    };
+
+    //
+    // Incremental pull: server clock probe file name and the allowance (seconds) made
+    // for modified time resolution and probe round trips when comparing times.
+    //
+
+    static const char *kClockProbeFile { ".escapement_clock_probe" };
+    static const time_t kClockSkewTolerance { 2 };
+
+    //
+    // Measured server clock skews (keyed on user@server:port) so that the jobs of a
+    // daemon polling the same server probe its clock once between them.
+    //
+
+    struct ServerClock {
+        bool measured { false };                // == true server clock skew measured
+        time_t skew { 0 };                      // Seconds server clock is ahead of local one
+        std::mutex clockMutex;                  // Held while measuring
+    };
+
+    struct ClockSkewCache {
+        std::unordered_map<std::string, ServerClock> servers; // Server clocks
+        std::mutex cacheMutex;                                // Cache access mutex
+    };
+
+    static ClockSkewCache clockSkewCache;
+
+    //
+    // Remote file lists at least this long are queried over the asynchronous engine
+    //
+
+    static const size_t kAsyncQueryThreshold { 32 };
+
     // ===============
     // LOCAL FUNCTIONS
     // ===============
@@ -78,38 +151,227 @@ namespace Escapement_Files {
     }
        
     //
-    // Get all remote file last modified date/time and return as FileInfoMap
+    // Find which of the remote entries the server could not size are directories from the
+    // listings of their parent directories (MLSD type fact or, if the server will not list
+    // that way, LIST entry type). Entries left untyped keep an unknown size.
     //
 
-    static FileInfoMap getRemoteFileListDateTime(CFTP &ftpServer, const FileList &fileList) {
+    static void typeUnsizedEntries(const EscapementOptions &optionData, FileInfoMap &fileInfoMap, const FileList &unsizedList) {
+
+        std::unordered_map<std::string, FileList> parentDirectories;
+
+        for (auto &file : unsizedList) {
+            size_t nameStart = file.find_last_of(kServerPathSep);
+            if (nameStart != std::string::npos) {
+                parentDirectories[(nameStart == 0) ? std::string(1, kServerPathSep) : file.substr(0, nameStart)].push_back(file);
+            }
+        }
+
+        if (parentDirectories.empty()) {
+            return;
+        }
+
+        try {
+
+            CPooledSession ftpSession { optionData };
+
+            for (auto &parentDirectory : parentDirectories) {
+                std::string listing;
+                std::vector<ListEntry> entries;
+                if ((ftpSession->listDirectory(parentDirectory.first, listing) / 100) == 2) {
+                    entries = parseListing(listing);
+                } else if ((ftpSession->listDirectory(parentDirectory.first, listing, false) / 100) == 2) {
+                    entries = parseLongListing(listing);
+                }
+                for (auto &entry : entries) {
+                    std::string filePath { parentDirectory.first };
+                    if (filePath.back() != kServerPathSep) {
+                        filePath += kServerPathSep;
+                    }
+                    filePath += entry.name;
+                    if (entry.directory && (std::find(parentDirectory.second.begin(), parentDirectory.second.end(), filePath) != parentDirectory.second.end())) {
+                        fileInfoMap[filePath].directory = true;
+                    }
+                }
+            }
+
+        } catch (const std::exception &e) {
+            std::cerr << "Escapement error: Could not list remote directories [" << e.what() << "]" << std::endl;
+        }
+
+    }
+
+    //
+    // Get all remote file information (last modified date/time and size) and return as FileInfoMap.
+    // Whether entries that the server cannot size are directories is taken from their listing.
+    // Longer lists are queried (MDTM/SIZE) concurrently over the asynchronous engine; any entries
+    // it could not query (connection failures) are then queried over the main connection.
+    //
+
+    static FileInfoMap getRemoteFileListInfo(const EscapementOptions &optionData, CFTP &ftpServer, const FileList &fileList) {
 
         FileInfoMap fileInfoMap;
+        FileList serialList;
+        FileList unsizedList;
+
+        if (fileList.size() >= kAsyncQueryThreshold) {
+
+            try {
+
+                CReservedSessions reservedSessions { optionData, optionData.transferConnections };
+                CAsyncEngine asyncEngine;
+                std::mutex queryMutex;
+                std::unordered_set<std::string> failedFiles;
+                int server = asyncEngine.addServer(optionData, reservedSessions.count());
+
+                for (auto &file : fileList) {
+                    asyncEngine.mdtm(server, file, [&fileInfoMap, &failedFiles, &queryMutex, file] (const AsyncResult &result) {
+                        std::lock_guard<std::mutex> queryLock(queryMutex);
+                        FileInfo &fileInfo = fileInfoMap[file];
+                        if ((result.statusCode == 213) && (result.response.size() > 4)) {
+                            fileInfo.modified = static_cast<CFTP::DateTime> (result.response.substr(4, 14));
+                        } else if (result.statusCode == 0) {
+                            failedFiles.insert(file);
+                        }
+                    });
+                    asyncEngine.size(server, file, [&fileInfoMap, &failedFiles, &unsizedList, &queryMutex, file] (const AsyncResult &result) {
+                        std::lock_guard<std::mutex> queryLock(queryMutex);
+                        FileInfo &fileInfo = fileInfoMap[file];
+                        if ((result.statusCode == 213) && (result.response.size() > 4)) {
+                            fileInfo.size = std::strtoll(result.response.c_str() + 4, nullptr, 10);
+                        } else if (result.statusCode == 0) {
+                            failedFiles.insert(file);
+                        } else {
+                            unsizedList.push_back(file);
+                        }
+                    });
+                }
 
-        for (auto file : fileList) {
-            CFTP::DateTime modifiedDateTime;
-            ftpServer.getModifiedDateTime(file, modifiedDateTime);
-            fileInfoMap[file] = modifiedDateTime;
+                asyncEngine.wait();
+
+                for (auto &file : failedFiles) {
+                    fileInfoMap.erase(file);
+                    serialList.push_back(file);
+                }
+
+                unsizedList.erase(std::remove_if(unsizedList.begin(), unsizedList.end(), [&failedFiles] (const std::string &file) {
+                    return (failedFiles.count(file) != 0);
+                }), unsizedList.end());
+
+            } catch (const CAsyncEngine::Exception &e) {
+                std::cerr << "Escapement error: " << e.what() << std::endl;
+                fileInfoMap.clear();
+                unsizedList.clear();
+                serialList = fileList;
+            }
+
+        } else {
+            serialList = fileList;
+        }
+
+        for (auto file : serialList) {
+            FileInfo fileInfo;
+            size_t fileSize { 0 };
+            ftpServer.getModifiedDateTime(file, fileInfo.modified);
+            if (ftpServer.getFileSize(file, fileSize) == 213) {
+                fileInfo.size = fileSize;
+            } else {
+                unsizedList.push_back(file);
+            }
+            fileInfoMap[file] = fileInfo;
         }
 
+        typeUnsizedEntries(optionData, fileInfoMap, unsizedList);
+
         return (fileInfoMap);
 
     }
     
     //
-    // Get all local file last modified date/time and return as FileInfoMap
+    // Get remote file information (last modified date/time, size and type) for everything
+    // under remote directory by listing its directories (MLSD) concurrently over the
+    // asynchronous engine. Returns false if the server cannot list that way.
     //
 
-    static FileInfoMap getLocalFileListDateTime(const FileList &fileList) {
+    static bool listRemoteFileListInfo(const EscapementOptions &optionData, FileInfoMap &fileInfoMap) {
+
+        try {
+
+            CReservedSessions reservedSessions { optionData, optionData.transferConnections };
+            CAsyncEngine asyncEngine;
+            std::mutex listMutex;
+            bool listed { true };
+            int server = asyncEngine.addServer(optionData, reservedSessions.count());
+
+            std::function<void(const std::string &)> listDirectory = [&] (const std::string &directory) {
+                asyncEngine.list(server, directory, [&, directory] (const AsyncResult &result) {
+                    if ((result.statusCode / 100) != 2) {
+                        std::lock_guard<std::mutex> listLock(listMutex);
+                        listed = false;
+                        return;
+                    }
+                    for (auto &entry : result.entries) {
+                        std::string filePath { directory };
+                        FileInfo fileInfo;
+                        if (filePath.back() != kServerPathSep) {
+                            filePath += kServerPathSep;
+                        }
+                        filePath += entry.name;
+                        fileInfo.directory = entry.directory;
+                        if (!entry.directory) {
+                            fileInfo.size = entry.size;
+                        }
+                        if (!entry.modified.empty()) {
+                            fileInfo.modified = static_cast<CFTP::DateTime> (entry.modified);
+                        }
+                        {
+                            std::lock_guard<std::mutex> listLock(listMutex);
+                            fileInfoMap[filePath] = fileInfo;
+                        }
+                        if (entry.directory) {
+                            listDirectory(filePath);
+                        }
+                    }
+                });
+            };
+
+            listDirectory(optionData.remoteDirectory);
+
+            asyncEngine.wait();
+
+            return (listed);
+
+        } catch (const CAsyncEngine::Exception &e) {
+            std::cerr << "Escapement error: " << e.what() << std::endl;
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Get all local file information (last modified date/time and size) and return as FileInfoMap
+    //
+
+    static FileInfoMap getLocalFileListInfo(const FileList &fileList) {
 
         FileInfoMap fileInfoMap;
 
           for (auto file : fileList) {
              if (CFile::isFile(file)) {
+                FileInfo fileInfo;
+                struct stat fileStat;
                 time_t localModifiedTime{ 0};
                 localModifiedTime = CFile::lastWriteTime(file);
-                fileInfoMap[file] = static_cast<CFTP::DateTime> (localtime(&localModifiedTime));
+                fileInfo.modified = static_cast<CFTP::DateTime> (localtime(&localModifiedTime));
+                if (stat(file.c_str(), &fileStat) == 0) {
+                    fileInfo.size = fileStat.st_size;
+                }
+                fileInfoMap[file] = fileInfo;
             } else if (CFile::isDirectory(file)) { 
-                fileInfoMap[file] = CFTP::DateTime();
+                FileInfo fileInfo;
+                fileInfo.directory = true;
+                fileInfoMap[file] = fileInfo;
             }
         }
 
@@ -117,6 +379,108 @@ namespace Escapement_Files {
 
     }
     
+    //
+    // Convert modified date/time (YYYYMMDDHHMMSS) to seconds since the epoch. Server
+    // (MDTM) times are UTC and local ones local time. Returns -1 if not convertible.
+    //
+
+    static time_t modifiedTime(const CFTP::DateTime &modified, bool utc) {
+
+        std::tm dateTime {};
+        std::string modifiedString { static_cast<std::string> (modified) };
+
+        if (strptime(modifiedString.c_str(), "%Y%m%d%H%M%S", &dateTime) == nullptr) {
+            return (-1);
+        }
+
+        if (utc) {
+            return (timegm(&dateTime));
+        }
+
+        dateTime.tm_isdst = -1;
+
+        return (mktime(&dateTime));
+
+    }
+
+    //
+    // Return seconds the server clock is ahead of the local one. Only measured if asked
+    // for (--clockprobe) as it writes to the server: an empty probe file is uploaded and
+    // its modified time compared with the local time of the upload. Otherwise, or if the
+    // server refuses the probe (for example a read only restore source), the clocks are
+    // taken to be in step. The result is cached per server for later polls by any job.
+    //
+
+    static time_t calibrateClockSkew(EscapementRunContext &runContext) {
+
+        char localProbeFile[] { "/tmp/escapementXXXXXX" };
+        std::string remoteProbeFile { runContext.optionData.remoteDirectory + kServerPathSep + kClockProbeFile };
+
+        if (!runContext.optionData.clockProbe) {
+            return (0);
+        }
+
+        ServerClock *serverClock;
+        {
+            std::lock_guard<std::mutex> cacheLock(clockSkewCache.cacheMutex);
+            serverClock = &clockSkewCache.servers[runContext.optionData.userName + "@" +
+                    runContext.optionData.serverName + ":" + runContext.optionData.serverPort];
+        }
+
+        std::lock_guard<std::mutex> clockLock(serverClock->clockMutex);
+
+        if (serverClock->measured) {
+            return (serverClock->skew);
+        }
+
+        serverClock->measured = true;
+
+        int localProbe = mkstemp(localProbeFile);
+        if (localProbe == -1) {
+            return (serverClock->skew);
+        }
+        close(localProbe);
+
+        time_t uploadStart = time(nullptr);
+        if (runContext.ftpServer.putFile(remoteProbeFile, localProbeFile) == 226) {
+            time_t uploadEnd = time(nullptr);
+            CFTP::DateTime probeModified;
+            if (runContext.ftpServer.getModifiedDateTime(remoteProbeFile, probeModified) == 213) {
+                time_t serverTime = modifiedTime(probeModified, true);
+                if (serverTime != -1) {
+                    serverClock->skew = serverTime - (uploadStart + (uploadEnd - uploadStart) / 2);
+                }
+            }
+            runContext.ftpServer.deleteFile(remoteProbeFile);
+        }
+
+        unlink(localProbeFile);
+
+        if (serverClock->skew != 0) {
+            std::cout << "*** Server clock is " << serverClock->skew << " seconds ahead of local ***" << std::endl;
+        }
+
+        return (serverClock->skew);
+
+    }
+
+    //
+    // Split file list into directories and files using file information map
+    //
+
+    static void splitDirectoriesAndFiles(const FileList &fileList, const FileInfoMap &fileInfoMap, FileList &directoryList, FileList &regularFileList) {
+
+        for (auto &file : fileList) {
+            auto fileInfo = fileInfoMap.find(file);
+            if ((fileInfo != fileInfoMap.end()) && fileInfo->second.directory) {
+                directoryList.push_back(file);
+            } else {
+                regularFileList.push_back(file);
+            }
+        }
+
+    }
+    
     // ================
     // PUBLIC FUNCTIONS
     // ================
@@ -149,11 +513,19 @@ namespace Escapement_Files {
 
     void getAllRemoteFiles(EscapementRunContext &runContext){
 
-        FileList fileList;
-             
-        listRemoteRecursive(runContext.ftpServer, runContext.optionData.remoteDirectory, fileList);
+        runContext.remoteFiles.clear();
+
+        if (!listRemoteFileListInfo(runContext.optionData, runContext.remoteFiles)) {
+
+            FileList fileList;
 
-        runContext.remoteFiles = getRemoteFileListDateTime(runContext.ftpServer, fileList);
+            runContext.remoteFiles.clear();
+
+            listRemoteRecursive(runContext.ftpServer, runContext.optionData.remoteDirectory, fileList);
+
+            runContext.remoteFiles = getRemoteFileListInfo(runContext.optionData, runContext.ftpServer, fileList);
+
+        }
 
         if (runContext.remoteFiles.empty()) {
             std::cout << "*** Remote server directory empty ***" << std::endl;
@@ -170,7 +542,7 @@ namespace Escapement_Files {
         FileList fileList;
              
         listLocalRecursive(runContext.optionData.localDirectory, fileList);
-        runContext.localFiles = getLocalFileListDateTime(fileList);
+        runContext.localFiles = getLocalFileListInfo(fileList);
 
         if (runContext.localFiles.empty()) {
             std::cout << "*** Local directory empty ***" << std::endl;
@@ -179,21 +551,273 @@ namespace Escapement_Files {
     }
 
     //
-    // Pull files from remote server to local directory
+    // Return true if a local file was modified after its remote copy. Times are compared
+    // as instants (remote times are UTC, local ones local time) so a file pushed with MFMT
+    // or pulled compares equal to its remote copy.
+    //
+
+    bool isLocalFileNewer(const FileInfo &localFileInfo, const FileInfo &remoteFileInfo) {
+
+        time_t localModified = modifiedTime(localFileInfo.modified, false);
+        time_t remoteModified = modifiedTime(remoteFileInfo.modified, true);
+
+        if ((localModified == -1) || (remoteModified == -1)) {
+            return (remoteFileInfo.modified < localFileInfo.modified);
+        }
+
+        return (localModified > remoteModified);
+
+    }
+
+    //
+    // Select remote files to pull. For a full pull every remote entry is selected; otherwise
+    // the local directory is scanned and only entries missing locally, or files whose size
+    // differs or that were modified on the server (clock skew allowed for) after the local
+    // copy was written, are. A local file carrying the remote modified time (as pulled files
+    // do) is up to date; the server clock is only calibrated if a file needs a time check.
+    //
+
+    void selectFilesToPull(EscapementRunContext &runContext) {
+
+        if (runContext.optionData.fullPull) {
+            for (auto &file : runContext.remoteFiles) {
+                runContext.filesToProcess.push_back(file.first);
+            }
+            return;
+        }
+
+        std::cout << "*** Getting file list from local directory... ***" << std::endl;
+
+        getAllLocalFiles(runContext);
+
+        for (auto &file : runContext.remoteFiles) {
+            auto localFile = runContext.localFiles.find(convertFilePath(runContext.optionData, file.first));
+            bool upToDate { false };
+            if ((localFile != runContext.localFiles.end()) && (localFile->second.directory == file.second.directory)) {
+                if (file.second.directory) {
+                    upToDate = true;
+                } else if (localFile->second.size == file.second.size) {
+                    time_t remoteModified = modifiedTime(file.second.modified, true);
+                    time_t localModified = modifiedTime(localFile->second.modified, false);
+                    if ((remoteModified != -1) && (localModified != -1) && (remoteModified != localModified)) {
+                        upToDate = ((remoteModified - calibrateClockSkew(runContext)) <= (localModified + kClockSkewTolerance));
+                    } else {
+                        upToDate = (remoteModified != -1) && (localModified != -1);
+                    }
+                }
+            }
+            if (!upToDate) {
+                runContext.filesToProcess.push_back(file.first);
+            }
+        }
+
+        std::cout << "*** " << (runContext.remoteFiles.size() - runContext.filesToProcess.size()) << " local files already up to date ***" << std::endl;
+
+    }
+
+    //
+    // Return true if a file is to be downloaded in segments (segments enabled and file large enough)
+    //
+
+    static bool isSegmented(const EscapementOptions &optionData, const FileInfo &fileInfo) {
+        return ((optionData.downloadSegments > 1) && (fileInfo.size != kUnknownFileSize) &&
+                (static_cast<std::uint64_t> (fileInfo.size) >= optionData.segmentSize));
+    }
+
+    //
+    // Return true if a file is to be transferred resumably (journal enabled and file large enough)
+    //
+
+    static bool isResumable(const EscapementOptions &optionData, const FileInfo &fileInfo) {
+        return (!optionData.journalFile.empty() && (fileInfo.size != kUnknownFileSize) &&
+                (static_cast<std::uint64_t> (fileInfo.size) >= optionData.resumeSize));
+    }
+
+    //
+    // Pull a list of files over a transfer session; very large files are pulled in segments
+    // and large ones resumably (both journaled). Returns list of local files created.
+    //
+
+    static FileList pullFileList(const EscapementRunContext &runContext, TransferJournal &transferJournal, CSession &ftpSession, const FileList &fileList, FileCompletionFn completionFn) {
+
+        FileList successList;
+
+        for (auto &file : fileList) {
+            auto remoteFile = runContext.remoteFiles.find(file);
+            std::string localFile { convertFilePath(runContext.optionData, file) };
+            bool transferred;
+            if ((remoteFile != runContext.remoteFiles.end()) && isSegmented(runContext.optionData, remoteFile->second)) {
+                transferred = getFileSegmented(ftpSession, runContext.optionData, transferJournal, file, localFile, remoteFile->second);
+            } else if ((remoteFile != runContext.remoteFiles.end()) && isResumable(runContext.optionData, remoteFile->second)) {
+                transferred = getFileResumable(ftpSession, transferJournal, file, localFile, remoteFile->second);
+            } else {
+                transferred = getFile(ftpSession, file, localFile,
+                        (remoteFile != runContext.remoteFiles.end()) ? remoteFile->second : FileInfo());
+            }
+            if (transferred) {
+                completionFn(localFile);
+                successList.push_back(localFile);
+            }
+        }
+
+        return (successList);
+
+    }
+
+    //
+    // Return true if a file may only have been appended to since it was last pushed
+    // (append uploads enabled and remote copy known to be shorter than local file)
+    //
+
+    static bool isAppendable(const EscapementRunContext &runContext, const std::string &localFile, const std::string &remoteFile) {
+
+        if (runContext.optionData.appendUploads) {
+            auto localFileInfo = runContext.localFiles.find(localFile);
+            auto remoteFileInfo = runContext.remoteFiles.find(remoteFile);
+            return ((localFileInfo != runContext.localFiles.end()) && (remoteFileInfo != runContext.remoteFiles.end()) &&
+                    !remoteFileInfo->second.directory && (remoteFileInfo->second.size > 0) &&
+                    (remoteFileInfo->second.size < localFileInfo->second.size));
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Push a list of files over a transfer session; grown files just have their tail
+    // appended (if enabled) and large files are pushed resumably. Where the server supports
+    // MFMT each file pushed is given the local modified time, which is then recorded as is
+    // (no MDTM needed). Returns list of remote files created.
+    //
+
+    static FileList pushFileList(const EscapementRunContext &runContext, TransferJournal &transferJournal, UploadedFiles &uploadedFiles, CSession &ftpSession, const FileList &fileList, FileCompletionFn completionFn) {
+
+        FileList successList;
+
+        for (auto &file : fileList) {
+            auto localFile = runContext.localFiles.find(file);
+            std::string remoteFile { convertFilePath(runContext.optionData, file) };
+            std::string fingerprint;
+            bool transferred;
+            if (isAppendable(runContext, file, remoteFile) && putFileTail(ftpSession, file, remoteFile, runContext.remoteFiles.at(remoteFile), fingerprint)) {
+                transferred = true;
+            } else if ((localFile != runContext.localFiles.end()) && isResumable(runContext.optionData, localFile->second)) {
+                transferred = putFileResumable(ftpSession, transferJournal, file, remoteFile, localFile->second);
+            } else {
+                transferred = putFile(ftpSession, file, remoteFile);
+            }
+            if (transferred) {
+                if (runContext.optionData.appendUploads) {
+                    if (fingerprint.empty()) {
+                        fingerprint = fileFingerprint(file);
+                    }
+                    std::lock_guard<std::mutex> uploadLock(uploadedFiles.uploadMutex);
+                    uploadedFiles.fingerprints[remoteFile] = fingerprint;
+                }
+                if (ftpSession.isModifyTimeSupported() && (localFile != runContext.localFiles.end())) {
+                    time_t localModified = modifiedTime(localFile->second.modified, false);
+                    std::tm remoteModified {};
+                    if ((localModified != -1) && (gmtime_r(&localModified, &remoteModified) != nullptr)) {
+                        FileInfo remoteFileInfo;
+                        remoteFileInfo.modified = static_cast<CFTP::DateTime> (&remoteModified);
+                        remoteFileInfo.size = localFile->second.size;
+                        if (ftpSession.setModifiedTime(remoteFile, static_cast<std::string> (remoteFileInfo.modified)) == 213) {
+                            std::lock_guard<std::mutex> uploadLock(uploadedFiles.uploadMutex);
+                            uploadedFiles.remoteFileInfo[remoteFile] = remoteFileInfo;
+                        }
+                    }
+                }
+                completionFn(file);
+                successList.push_back(remoteFile);
+            }
+        }
+
+        return (successList);
+
+    }
+
+    //
+    // Return remote directories a push needs (directories being pushed and the parents
+    // of every file) that are not already known to exist on the server, parents first.
+    //
+
+    static FileList remoteDirectoriesToCreate(const EscapementRunContext &runContext, const FileList &directoryList, const FileList &regularFileList) {
+
+        std::unordered_set<std::string> requiredDirectories;
+
+        auto addDirectory = [&runContext, &requiredDirectories] (std::string remoteDirectory) {
+            while (remoteDirectory.size() > runContext.optionData.remoteDirectory.size()) {
+                auto remoteFile = runContext.remoteFiles.find(remoteDirectory);
+                if (((remoteFile != runContext.remoteFiles.end()) && remoteFile->second.directory) ||
+                    !requiredDirectories.insert(remoteDirectory).second) {
+                    break;
+                }
+                remoteDirectory = remoteDirectory.substr(0, remoteDirectory.find_last_of(kServerPathSep));
+            }
+        };
+
+        for (auto &directory : directoryList) {
+            addDirectory(convertFilePath(runContext.optionData, directory));
+        }
+
+        for (auto &file : regularFileList) {
+            std::string remoteFile { convertFilePath(runContext.optionData, file) };
+            addDirectory(remoteFile.substr(0, remoteFile.find_last_of(kServerPathSep)));
+        }
+
+        FileList createList(requiredDirectories.begin(), requiredDirectories.end());
+
+        std::sort(createList.begin(), createList.end(), [] (const std::string &directory1, const std::string &directory2) {
+            auto depth1 = std::count(directory1.begin(), directory1.end(), kServerPathSep);
+            auto depth2 = std::count(directory2.begin(), directory2.end(), kServerPathSep);
+            return ((depth1 < depth2) || ((depth1 == depth2) && (directory1 < directory2)));
+        });
+
+        return (createList);
+
+    }
+
+    //
+    // Pull files from remote server to local directory. Directories are created first over
+    // the main connection, then files are pulled by transfer sessions through the size
+    // aware transfer queue (very large ones in segments, large ones resumably).
     //
     
     void pullFiles (EscapementRunContext &runContext) {
         
         int fileCount { 0 };
-        FileCompletionFn completionFn = [&fileCount] (std::string fileName) {std::cout << "Pulled file No " << ++fileCount << " [" << fileName << "]" << std::endl;};
+        std::mutex completionMutex;
+        FileCompletionFn completionFn = [&fileCount, &completionMutex] (std::string fileName) {
+            std::lock_guard<std::mutex> completionLock(completionMutex);
+            std::cout << "Pulled file No " << ++fileCount << " [" << fileName << "]" << std::endl;
+        };
         
         if (!runContext.filesToProcess.empty()) {
 
+            FileList directoryList, regularFileList, successList;
+            TransferQueue transferQueue;
+            TransferJournal transferJournal;
+
+            loadTransferJournal(runContext.optionData.journalFile, transferJournal);
+
             std::sort(runContext.filesToProcess.begin(), runContext.filesToProcess.end()); // getFiles() requires list to be sorted
             
-            FileList successList { getFiles(runContext.ftpServer, runContext.optionData.localDirectory, runContext.filesToProcess, completionFn, true) };
+            splitDirectoriesAndFiles(runContext.filesToProcess, runContext.remoteFiles, directoryList, regularFileList);
+            
+            if (!directoryList.empty()) {
+                successList = getFiles(runContext.ftpServer, runContext.optionData.localDirectory, directoryList, completionFn, true);
+            }
+
+            buildTransferQueue(regularFileList, runContext.remoteFiles, runContext.optionData.smallFileSize, transferQueue);
+            
+            FileList transferList { transferFiles(runContext.optionData, transferQueue, 
+                    [&runContext, &transferJournal, &completionFn] (CSession &ftpSession, const FileList &fileList) {
+                        return (pullFileList(runContext, transferJournal, ftpSession, fileList, completionFn));
+                    }) };
+            
+            successList.insert(successList.end(), transferList.begin(), transferList.end());
             
-            FileInfoMap filesTransfered {getLocalFileListDateTime(successList)};
+            FileInfoMap filesTransfered {getLocalFileListInfo(successList)};
             
             if (!filesTransfered.empty()) {
                 for (auto &file : filesTransfered) {
@@ -215,26 +839,78 @@ namespace Escapement_Files {
     }
     
     //
-    // Push files from local directory to server
+    // Push files from local directory to server. Any missing remote directories are
+    // created first in one pipelined pass so that transfers never need directory
+    // commands; files are then pushed by transfer sessions (zero copy where possible)
+    // through the size aware transfer queue (grown ones by appending their tail if
+    // enabled, large ones resumably).
     //
     
     void pushFiles (EscapementRunContext &runContext) {
   
         int fileCount { 0 };
-        FileCompletionFn completionFn = [&fileCount] (std::string fileName) {std::cout << "Pushed file No " << ++fileCount << " [" << fileName << "]" << std::endl;};
+        std::mutex completionMutex;
+        FileCompletionFn completionFn = [&fileCount, &completionMutex] (std::string fileName) {
+            std::lock_guard<std::mutex> completionLock(completionMutex);
+            std::cout << "Pushed file No " << ++fileCount << " [" << fileName << "]" << std::endl;
+        };
                
         if (!runContext.filesToProcess.empty()) {
             
-            std::sort(runContext.filesToProcess.begin(), runContext.filesToProcess.end()); // Putfiles() requires list to be sorted
+            FileList directoryList, regularFileList, successList;
+            TransferQueue transferQueue;
+            TransferJournal transferJournal;
+            UploadedFiles uploadedFiles;
+
+            loadTransferJournal(runContext.optionData.journalFile, transferJournal);
+
+            std::sort(runContext.filesToProcess.begin(), runContext.filesToProcess.end());
+            
+            splitDirectoriesAndFiles(runContext.filesToProcess, runContext.localFiles, directoryList, regularFileList);
+
+            FileList createdList { makeRemoteDirectories(runContext.optionData, remoteDirectoriesToCreate(runContext, directoryList, regularFileList)) };
+            std::unordered_set<std::string> createdDirectories(createdList.begin(), createdList.end());
+
+            for (auto &directory : directoryList) {
+                std::string remoteDirectory { convertFilePath(runContext.optionData, directory) };
+                auto remoteFile = runContext.remoteFiles.find(remoteDirectory);
+                if (createdDirectories.count(remoteDirectory) ||
+                    ((remoteFile != runContext.remoteFiles.end()) && remoteFile->second.directory)) {
+                    completionFn(directory);
+                    successList.push_back(remoteDirectory);
+                }
+            }
+            
+            buildTransferQueue(regularFileList, runContext.localFiles, runContext.optionData.smallFileSize, transferQueue);
+
+            FileList transferList { transferFiles(runContext.optionData, transferQueue, 
+                    [&runContext, &transferJournal, &uploadedFiles, &completionFn] (CSession &ftpSession, const FileList &fileList) {
+                        return (pushFileList(runContext, transferJournal, uploadedFiles, ftpSession, fileList, completionFn));
+                    }) };
             
-            FileList successList {  putFiles(runContext.ftpServer, runContext.optionData.localDirectory, runContext.filesToProcess, completionFn, true) };
+            successList.insert(successList.end(), transferList.begin(), transferList.end());
+
+            // Only files whose modified time could not be set need querying
 
-            FileInfoMap filesTransfered { getRemoteFileListDateTime(runContext.ftpServer, successList ) };
+            FileList queryList;
+            for (auto &file : successList) {
+                if (!uploadedFiles.remoteFileInfo.count(file)) {
+                    queryList.push_back(file);
+                }
+            }
+
+            FileInfoMap filesTransfered { getRemoteFileListInfo(runContext.optionData, runContext.ftpServer, queryList) };
+            filesTransfered.insert(uploadedFiles.remoteFileInfo.begin(), uploadedFiles.remoteFileInfo.end());
      
             if (!filesTransfered.empty()) {
                 std::cout << "Number of files to transfer [" << filesTransfered.size() << "]" << std::endl;
                 for (auto &file : filesTransfered) {
+                    auto fingerprint = uploadedFiles.fingerprints.find(file.first);
+                    if (fingerprint != uploadedFiles.fingerprints.end()) {
+                        file.second.fingerprint = fingerprint->second;
+                    }
                     runContext.remoteFiles[file.first] = file.second;
+                    journalFileUpdate(runContext.optionData, file.first, file.second);
                 }
                 runContext.totalFilesProcessed += filesTransfered.size();
             }
@@ -263,14 +939,16 @@ namespace Escapement_Files {
             
             sort(runContext.filesToProcess.rbegin(), runContext.filesToProcess.rend()); 
 
+            FileList deletedList { deleteRemoteFiles(runContext.optionData, runContext.filesToProcess, runContext.remoteFiles) };
+            std::unordered_set<std::string> deletedFiles(deletedList.begin(), deletedList.end());
+
             for (auto &file : runContext.filesToProcess) {
-                if (runContext.ftpServer.deleteFile(file) == 250) {
-                    std::cout << "File [" << file << " ] removed from server." << std::endl;
-                    runContext.remoteFiles.erase(file);
-                    runContext.totalFilesProcessed++;
-                } else if (runContext.ftpServer.removeDirectory(file) == 250) {
-                    std::cout << "Directory [" << file << " ] removed from server." << std::endl;
+                auto remoteFile = runContext.remoteFiles.find(file);
+                bool directory = (remoteFile != runContext.remoteFiles.end()) && remoteFile->second.directory;
+                if (deletedFiles.count(file)) {
+                    std::cout << ((directory) ? "Directory [" : "File [") << file << " ] removed from server." << std::endl;
                     runContext.remoteFiles.erase(file);
+                    journalFileRemove(runContext.optionData, file);
                     runContext.totalFilesProcessed++;
                 } else {
                     std::cerr << "File [" << file << " ] could not be removed from server." << std::endl;
@@ -287,14 +965,18 @@ namespace Escapement_Files {
 
     void loadFilesBeforeSynchronise(EscapementRunContext &runContext) {
 
-        // Load any cached file information
+        // Load any cached file information (once; it is kept up to date in memory
+        // between polls)
 
-        loadCachedFiles(runContext);
+        if (runContext.remoteFiles.empty()) {
+            loadCachedFiles(runContext);
+        }
 
-        // No cached remote files so get list from server
+        // No cached remote files so get list from server (and cache it)
 
         if (runContext.remoteFiles.empty()) {
             getAllRemoteFiles(runContext);
+            saveCachedFiles(runContext);
         }
 
         // Create local file list (done at runtime to pickup changes).
@@ -304,11 +986,23 @@ namespace Escapement_Files {
     }
     
     //
-    // Save maps containing local and remote files after synchronise
+    // Commit remote file changes journalled during synchronise
     //
 
     void saveFilesAfterSynchronise(const EscapementRunContext &runContext) {
 
+        // Commit any cached file information
+
+        commitCachedFiles(runContext);
+
+    }
+
+    //
+    // Save remote file information after a full refresh/pull from server
+    //
+
+    void saveFilesAfterRefresh(const EscapementRunContext &runContext) {
+
         // Save any cached file information
 
         saveCachedFiles(runContext);
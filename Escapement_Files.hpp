@@ -22,12 +22,15 @@ namespace Escapement_Files {
 
     void getAllRemoteFiles(Escapement::EscapementRunContext &runContext);
     void getAllLocalFiles(Escapement::EscapementRunContext &runContext);
+    void selectFilesToPull(Escapement::EscapementRunContext &runContext);
+    bool isLocalFileNewer(const Escapement::FileInfo &localFileInfo, const Escapement::FileInfo &remoteFileInfo);
     std::string convertFilePath(const Escapement::EscapementOptions &optionData, const std::string &filePath);
     void pullFiles (Escapement::EscapementRunContext &runContext);
     void pushFiles (Escapement::EscapementRunContext &runContext);
     void deleteFiles (Escapement::EscapementRunContext &runContext);
     void loadFilesBeforeSynchronise(Escapement::EscapementRunContext &runContext);
     void saveFilesAfterSynchronise(const Escapement::EscapementRunContext &runContext);   
+    void saveFilesAfterRefresh(const Escapement::EscapementRunContext &runContext);
 
 } // namespace Escapement_Files
 
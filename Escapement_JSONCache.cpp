@@ -0,0 +1,688 @@
+//
+// Class: CJSONCache
+//
+// Description: Streaming JSON file cache reader and writer used by Escapement. Caches
+// from older versions can run to hundreds of megabytes, so rather than building a
+// document tree and then copying it into the file map the reader runs a small
+// tokenising state machine over a fixed size read buffer and inserts each entry as its
+// object closes. String bodies (the bulk of a cache) are scanned for their closing
+// quote/escape with memchr() which the C library vectorises. The writer formats
+// entries straight into a buffered stream.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+
+//
+// Antik Classes
+//
+
+#include "CFTP.hpp"
+
+//
+// Escapement JSON cache
+//
+
+#include "Escapement_JSONCache.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_JSONCache {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+    using namespace Escapement_BinaryCache;
+
+    using namespace Antik::FTP;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Read buffer size and writer flush threshold
+    //
+
+    static const size_t kJSONBufferSize { 1024 * 1024 };
+
+    //
+    // Indentation per nesting level in written cache
+    //
+
+    static const std::string kIndent { "    " };
+
+    //
+    // JSON tokens
+    //
+
+    enum class Token {
+        ObjectStart,    // {
+        ObjectEnd,      // }
+        ArrayStart,     // [
+        ArrayEnd,       // ]
+        Colon,          // :
+        Comma,          // ,
+        String,         // String (value() holds it unescaped)
+        Literal,        // Number, true, false or null (value() holds its text)
+        End             // End of input
+    };
+
+    //
+    // JSON tokeniser over a stream read a block at a time. Only the current block and
+    // current token value are held in memory.
+    //
+
+    class JSONTokenizer {
+    public:
+
+        explicit JSONTokenizer(std::istream &jsonStream) : m_jsonStream { jsonStream }, m_buffer(kJSONBufferSize) {
+        }
+
+        Token next(void);
+        const std::string &value(void) const {
+            return (m_value);
+        }
+        std::string &value(void) {
+            return (m_value);
+        }
+
+    private:
+
+        bool fill(void);
+        char nextChar(void);
+        void readString(void);
+        void readEscape(void);
+        std::uint32_t readHex(void);
+        void readLiteral(char first);
+
+        std::istream &m_jsonStream;         // JSON input
+        std::vector<char> m_buffer;         // Read buffer
+        const char *m_position { nullptr }; // Next unread character
+        const char *m_end { nullptr };      // End of buffered characters
+        std::string m_value;                // Current string/literal token value
+
+    };
+
+    //
+    // Refill read buffer. Returns false at end of input.
+    //
+
+    bool JSONTokenizer::fill(void) {
+
+        m_jsonStream.read(m_buffer.data(), m_buffer.size());
+        m_position = m_buffer.data();
+        m_end = m_position + m_jsonStream.gcount();
+
+        return (m_position != m_end);
+
+    }
+
+    //
+    // Return next character (inside a token, so end of input is an error).
+    //
+
+    char JSONTokenizer::nextChar(void) {
+
+        if ((m_position == m_end) && !fill()) {
+            throw CJSONCache::Exception("Unexpected end of JSON.");
+        }
+
+        return (*m_position++);
+
+    }
+
+    //
+    // Read four hex digits of a \u escape.
+    //
+
+    std::uint32_t JSONTokenizer::readHex(void) {
+
+        std::uint32_t codePoint { 0 };
+
+        for (int digit = 0; digit < 4; digit++) {
+            char hexChar = nextChar();
+            codePoint <<= 4;
+            if ((hexChar >= '0') && (hexChar <= '9')) {
+                codePoint |= hexChar - '0';
+            } else if ((hexChar >= 'a') && (hexChar <= 'f')) {
+                codePoint |= hexChar - 'a' + 10;
+            } else if ((hexChar >= 'A') && (hexChar <= 'F')) {
+                codePoint |= hexChar - 'A' + 10;
+            } else {
+                throw CJSONCache::Exception("Invalid \\u escape in JSON string.");
+            }
+        }
+
+        return (codePoint);
+
+    }
+
+    //
+    // Decode escape sequence (backslash consumed) onto current value. \u escapes
+    // (including surrogate pairs) are converted to UTF-8.
+    //
+
+    void JSONTokenizer::readEscape(void) {
+
+        char escape = nextChar();
+
+        switch (escape) {
+            case '"':
+            case '\\':
+            case '/':
+                m_value.push_back(escape);
+                return;
+            case 'b':
+                m_value.push_back('\b');
+                return;
+            case 'f':
+                m_value.push_back('\f');
+                return;
+            case 'n':
+                m_value.push_back('\n');
+                return;
+            case 'r':
+                m_value.push_back('\r');
+                return;
+            case 't':
+                m_value.push_back('\t');
+                return;
+            case 'u':
+                break;
+            default:
+                throw CJSONCache::Exception("Invalid escape in JSON string.");
+        }
+
+        std::uint32_t codePoint = readHex();
+
+        if ((codePoint >= 0xD800) && (codePoint <= 0xDBFF)) {
+            if ((nextChar() != '\\') || (nextChar() != 'u')) {
+                throw CJSONCache::Exception("Unpaired surrogate in JSON string.");
+            }
+            std::uint32_t lowSurrogate = readHex();
+            if ((lowSurrogate < 0xDC00) || (lowSurrogate > 0xDFFF)) {
+                throw CJSONCache::Exception("Unpaired surrogate in JSON string.");
+            }
+            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (lowSurrogate - 0xDC00);
+        }
+
+        if (codePoint < 0x80) {
+            m_value.push_back(static_cast<char> (codePoint));
+        } else if (codePoint < 0x800) {
+            m_value.push_back(static_cast<char> (0xC0 | (codePoint >> 6)));
+            m_value.push_back(static_cast<char> (0x80 | (codePoint & 0x3F)));
+        } else if (codePoint < 0x10000) {
+            m_value.push_back(static_cast<char> (0xE0 | (codePoint >> 12)));
+            m_value.push_back(static_cast<char> (0x80 | ((codePoint >> 6) & 0x3F)));
+            m_value.push_back(static_cast<char> (0x80 | (codePoint & 0x3F)));
+        } else {
+            m_value.push_back(static_cast<char> (0xF0 | (codePoint >> 18)));
+            m_value.push_back(static_cast<char> (0x80 | ((codePoint >> 12) & 0x3F)));
+            m_value.push_back(static_cast<char> (0x80 | ((codePoint >> 6) & 0x3F)));
+            m_value.push_back(static_cast<char> (0x80 | (codePoint & 0x3F)));
+        }
+
+    }
+
+    //
+    // Read string body (opening quote consumed). Runs of plain characters are found
+    // with memchr() and appended in one go.
+    //
+
+    void JSONTokenizer::readString(void) {
+
+        m_value.clear();
+
+        for (;;) {
+            if ((m_position == m_end) && !fill()) {
+                throw CJSONCache::Exception("Unterminated JSON string.");
+            }
+            const char *quote = static_cast<const char *> (std::memchr(m_position, '"', m_end - m_position));
+            const char *runEnd = (quote != nullptr) ? quote : m_end;
+            const char *backslash = static_cast<const char *> (std::memchr(m_position, '\\', runEnd - m_position));
+            if (backslash != nullptr) {
+                m_value.append(m_position, backslash);
+                m_position = backslash + 1;
+                readEscape();
+            } else {
+                m_value.append(m_position, runEnd);
+                m_position = runEnd;
+                if (quote != nullptr) {
+                    m_position++;
+                    return;
+                }
+            }
+        }
+
+    }
+
+    //
+    // Read a literal (number, true, false or null) starting with first.
+    //
+
+    void JSONTokenizer::readLiteral(char first) {
+
+        m_value.assign(1, first);
+
+        for (;;) {
+            if ((m_position == m_end) && !fill()) {
+                return;
+            }
+            char literalChar = *m_position;
+            if (std::isspace(static_cast<unsigned char> (literalChar)) || (std::strchr("{}[],:\"", literalChar) != nullptr)) {
+                return;
+            }
+            m_value.push_back(literalChar);
+            m_position++;
+        }
+
+    }
+
+    //
+    // Return next token.
+    //
+
+    Token JSONTokenizer::next(void) {
+
+        for (;;) {
+
+            if ((m_position == m_end) && !fill()) {
+                return (Token::End);
+            }
+
+            char tokenChar = *m_position++;
+
+            switch (tokenChar) {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\r':
+                    continue;
+                case '{':
+                    return (Token::ObjectStart);
+                case '}':
+                    return (Token::ObjectEnd);
+                case '[':
+                    return (Token::ArrayStart);
+                case ']':
+                    return (Token::ArrayEnd);
+                case ':':
+                    return (Token::Colon);
+                case ',':
+                    return (Token::Comma);
+                case '"':
+                    readString();
+                    return (Token::String);
+                default:
+                    readLiteral(tokenChar);
+                    return (Token::Literal);
+            }
+
+        }
+
+    }
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Check token is the one expected.
+    //
+
+    static void expectToken(Token token, Token expected) {
+        if (token != expected) {
+            throw CJSONCache::Exception("Malformed JSON cache.");
+        }
+    }
+
+    //
+    // Skip a value whose first token is token.
+    //
+
+    static void skipValue(JSONTokenizer &jsonTokenizer, Token token) {
+
+        if ((token == Token::String) || (token == Token::Literal)) {
+            return;
+        }
+
+        if ((token != Token::ObjectStart) && (token != Token::ArrayStart)) {
+            throw CJSONCache::Exception("Malformed JSON cache.");
+        }
+
+        for (int depth = 1; depth > 0;) {
+            token = jsonTokenizer.next();
+            if ((token == Token::ObjectStart) || (token == Token::ArrayStart)) {
+                depth++;
+            } else if ((token == Token::ObjectEnd) || (token == Token::ArrayEnd)) {
+                depth--;
+            } else if (token == Token::End) {
+                throw CJSONCache::Exception("Unexpected end of JSON.");
+            }
+        }
+
+    }
+
+    //
+    // Read members of an object (opening brace consumed), calling memberFn with each key
+    // and the first token of its value. memberFn returns false to stop reading (the rest
+    // of the input is then left unread).
+    //
+
+    template <typename MemberFn>
+    static bool readObject(JSONTokenizer &jsonTokenizer, MemberFn memberFn) {
+
+        Token token = jsonTokenizer.next();
+
+        if (token == Token::ObjectEnd) {
+            return (true);
+        }
+
+        for (;;) {
+            expectToken(token, Token::String);
+            std::string key { std::move(jsonTokenizer.value()) };
+            expectToken(jsonTokenizer.next(), Token::Colon);
+            if (!memberFn(key, jsonTokenizer.next())) {
+                return (false);
+            }
+            token = jsonTokenizer.next();
+            if (token == Token::ObjectEnd) {
+                return (true);
+            }
+            expectToken(token, Token::Comma);
+            token = jsonTokenizer.next();
+        }
+
+    }
+
+    //
+    // Read elements of an array (opening bracket consumed), calling elementFn with the
+    // first token of each.
+    //
+
+    template <typename ElementFn>
+    static void readArray(JSONTokenizer &jsonTokenizer, ElementFn elementFn) {
+
+        Token token = jsonTokenizer.next();
+
+        if (token == Token::ArrayEnd) {
+            return;
+        }
+
+        for (;;) {
+            elementFn(token);
+            token = jsonTokenizer.next();
+            if (token == Token::ArrayEnd) {
+                return;
+            }
+            expectToken(token, Token::Comma);
+            token = jsonTokenizer.next();
+        }
+
+    }
+
+    //
+    // Read a string value.
+    //
+
+    static std::string readStringValue(JSONTokenizer &jsonTokenizer, Token token) {
+        expectToken(token, Token::String);
+        return (std::move(jsonTokenizer.value()));
+    }
+
+    //
+    // Read options object (name/value pairs).
+    //
+
+    static void readOptions(JSONTokenizer &jsonTokenizer, Token token, CachedOptions &cachedOptions) {
+
+        expectToken(token, Token::ObjectStart);
+
+        readObject(jsonTokenizer, [&jsonTokenizer, &cachedOptions] (const std::string &name, Token valueToken) {
+            cachedOptions.emplace_back(name, readStringValue(jsonTokenizer, valueToken));
+            return (true);
+        });
+
+    }
+
+    //
+    // Read file array, inserting each entry into file information as it completes.
+    //
+
+    static void readFiles(JSONTokenizer &jsonTokenizer, Token token, FileInfoMap &fileInfoMap) {
+
+        expectToken(token, Token::ArrayStart);
+
+        readArray(jsonTokenizer, [&jsonTokenizer, &fileInfoMap] (Token elementToken) {
+            std::string fileName;
+            FileInfo fileInfo;
+            expectToken(elementToken, Token::ObjectStart);
+            readObject(jsonTokenizer, [&jsonTokenizer, &fileName, &fileInfo] (const std::string &name, Token valueToken) {
+                if (name == "Filename") {
+                    fileName = readStringValue(jsonTokenizer, valueToken);
+                } else if (name == "Modified") {
+                    fileInfo.modified = static_cast<CFTP::DateTime> (readStringValue(jsonTokenizer, valueToken));
+                } else if (name == "Fingerprint") {
+                    fileInfo.fingerprint = readStringValue(jsonTokenizer, valueToken);
+                } else if ((name == "Size") && (valueToken == Token::Literal)) {
+                    char *numberEnd;
+                    fileInfo.size = std::strtoll(jsonTokenizer.value().c_str(), &numberEnd, 10);
+                    if (*numberEnd != '\0') {
+                        throw CJSONCache::Exception("Invalid file size in JSON cache.");
+                    }
+                } else if ((name == "Directory") && (valueToken == Token::Literal)) {
+                    fileInfo.directory = (jsonTokenizer.value() == "true");
+                } else {
+                    skipValue(jsonTokenizer, valueToken);
+                }
+                return (true);
+            });
+            fileInfoMap[std::move(fileName)] = std::move(fileInfo);
+        });
+
+    }
+
+    //
+    // Append string to output quoted and escaped.
+    //
+
+    static void putString(std::string &output, const std::string &value) {
+
+        static const char kHexDigits[] { "0123456789abcdef" };
+
+        output.push_back('"');
+
+        for (unsigned char valueChar : value) {
+            switch (valueChar) {
+                case '"':
+                    output.append("\\\"");
+                    break;
+                case '\\':
+                    output.append("\\\\");
+                    break;
+                case '\b':
+                    output.append("\\b");
+                    break;
+                case '\f':
+                    output.append("\\f");
+                    break;
+                case '\n':
+                    output.append("\\n");
+                    break;
+                case '\r':
+                    output.append("\\r");
+                    break;
+                case '\t':
+                    output.append("\\t");
+                    break;
+                default:
+                    if (valueChar < 0x20) {
+                        output.append("\\u00");
+                        output.push_back(kHexDigits[valueChar >> 4]);
+                        output.push_back(kHexDigits[valueChar & 0xF]);
+                    } else {
+                        output.push_back(valueChar);
+                    }
+                    break;
+            }
+        }
+
+        output.push_back('"');
+
+    }
+
+    //
+    // Append "name": (at indentation level) to output.
+    //
+
+    static void putName(std::string &output, int level, const std::string &name) {
+        for (int indent = 0; indent < level; indent++) {
+            output.append(kIndent);
+        }
+        putString(output, name);
+        output.append(": ");
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Read options and/or file information (when passed non-null) from a JSON cache.
+    // Other top level sections are skipped without being decoded, and reading stops as
+    // soon as everything asked for has been read. Returns false if the file could not be
+    // opened.
+    //
+
+    bool CJSONCache::read(const std::string &jsonFile, CachedOptions *cachedOptions, FileInfoMap *fileInfoMap) {
+
+        std::ifstream jsonFileStream { jsonFile, std::ios::binary };
+
+        if (!jsonFileStream) {
+            return (false);
+        }
+
+        JSONTokenizer jsonTokenizer { jsonFileStream };
+        int sectionsWanted = (cachedOptions != nullptr) + (fileInfoMap != nullptr);
+
+        expectToken(jsonTokenizer.next(), Token::ObjectStart);
+
+        readObject(jsonTokenizer, [&] (const std::string &name, Token valueToken) {
+            if ((name == "EscapementOptions") && (cachedOptions != nullptr)) {
+                readOptions(jsonTokenizer, valueToken, *cachedOptions);
+                sectionsWanted--;
+            } else if ((name == "RemoteFiles") && (fileInfoMap != nullptr)) {
+                readFiles(jsonTokenizer, valueToken, *fileInfoMap);
+                sectionsWanted--;
+            } else {
+                skipValue(jsonTokenizer, valueToken);
+            }
+            return (sectionsWanted > 0);
+        });
+
+        return (true);
+
+    }
+
+    //
+    // Write options and file information to a JSON cache (same layout as read).
+    //
+
+    void CJSONCache::write(const std::string &jsonFile, const CachedOptions &cachedOptions, const FileInfoMap &fileInfoMap) {
+
+        std::ofstream jsonFileStream { jsonFile, std::ios::binary | std::ios::trunc };
+        std::string output;
+        bool firstEntry { true };
+
+        if (!jsonFileStream) {
+            throw Exception("Could not open [" + jsonFile + "]");
+        }
+
+        auto flushOutput = [&jsonFileStream, &output, &jsonFile] (size_t threshold) {
+            if (output.size() >= threshold) {
+                if (!jsonFileStream.write(output.data(), output.size())) {
+                    throw Exception("Could not write [" + jsonFile + "]");
+                }
+                output.clear();
+            }
+        };
+
+        output.reserve(kJSONBufferSize + 4096);
+
+        // Options (in name order)
+
+        CachedOptions sortedOptions { cachedOptions };
+        std::sort(sortedOptions.begin(), sortedOptions.end());
+
+        output.append("{\n");
+        putName(output, 1, "EscapementOptions");
+        output.append("{");
+        for (auto &option : sortedOptions) {
+            output.append((&option == &sortedOptions.front()) ? "\n" : ",\n");
+            putName(output, 2, option.first);
+            putString(output, option.second);
+        }
+        output.append(sortedOptions.empty() ? "},\n" : ("\n" + kIndent + "},\n"));
+
+        // Remote files
+
+        putName(output, 1, "RemoteFiles");
+        output.append("[");
+
+        for (auto &file : fileInfoMap) {
+            output.append(firstEntry ? "\n" : ",\n");
+            firstEntry = false;
+            output.append(kIndent + kIndent + "{\n");
+            putName(output, 3, "Directory");
+            output.append(file.second.directory ? "true,\n" : "false,\n");
+            putName(output, 3, "Filename");
+            putString(output, file.first);
+            output.append(",\n");
+            if (!file.second.fingerprint.empty()) {
+                putName(output, 3, "Fingerprint");
+                putString(output, file.second.fingerprint);
+                output.append(",\n");
+            }
+            putName(output, 3, "Modified");
+            putString(output, static_cast<std::string> (file.second.modified));
+            output.append(",\n");
+            putName(output, 3, "Size");
+            output.append(std::to_string(file.second.size));
+            output.append("\n" + kIndent + kIndent + "}");
+            flushOutput(kJSONBufferSize);
+        }
+
+        output.append(firstEntry ? "]\n}\n" : ("\n" + kIndent + "]\n}\n"));
+
+        flushOutput(0);
+
+        jsonFileStream.close();
+        if (!jsonFileStream) {
+            throw Exception("Could not write [" + jsonFile + "]");
+        }
+
+    }
+
+} // namespace Escapement_JSONCache
@@ -0,0 +1,58 @@
+#ifndef ESCAPEMENT_JSONCACHE_HPP
+#define ESCAPEMENT_JSONCACHE_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <stdexcept>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+#include "Escapement_BinaryCache.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_JSONCache {
+
+    //
+    // Streaming reader/writer for JSON file caches (import of caches written by older
+    // versions and export on request). The reader tokenises the file a block at a time
+    // and inserts entries straight into the file map, skipping sections that are not
+    // wanted, so memory use is bounded by the map rather than the file. The writer
+    // emits the same layout entry by entry. Malformed JSON is reported by throwing
+    // CJSONCache::Exception.
+    //
+
+    class CJSONCache {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CJSONCache Failure: " + message) {
+            }
+
+        };
+
+        CJSONCache() = delete;
+
+        static bool read(const std::string &jsonFile, Escapement_BinaryCache::CachedOptions *cachedOptions, Escapement::FileInfoMap *fileInfoMap);
+        static void write(const std::string &jsonFile, const Escapement_BinaryCache::CachedOptions &cachedOptions, const Escapement::FileInfoMap &fileInfoMap);
+
+    };
+
+} // namespace Escapement_JSONCache
+
+#endif /* ESCAPEMENT_JSONCACHE_HPP */
+
@@ -0,0 +1,284 @@
+//
+// Module: Escapement_Journal
+//
+// Description: Escapement partial transfer journal. Large transfers record what
+// is in flight (source, destination, direction, expected size and bytes confirmed,
+// per byte range for a segmented download) so that a transfer interrupted by a
+// dropped connection can be resumed on the next run rather than started again. The
+// journal is a small JSON file that is rewritten (to a temporary file that is flushed
+// to disk then renamed) whenever an entry changes. Daemon jobs given the same journal
+// file share one set of entries, so that none overwrites another's.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : mkstemp, fsync.
+// Misc.              : Lohmann JSON library
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+
+//
+// Escapement journal
+//
+
+#include "Escapement_Journal.hpp"
+
+// Lohmann JSON library
+
+#include "json.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Journal {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using json = nlohmann::json;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Journal states by journal file (kept while a transfer is using them)
+    //
+
+    static struct JournalStates {
+        std::unordered_map<std::string, std::weak_ptr<JournalState>> states; // State by journal file
+        std::mutex statesMutex;                                              // States map guard
+    } journalStates;
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Write buffer to file in full. Returns false on failure.
+    //
+
+    static bool writeAll(int fileFd, const char *buffer, size_t length) {
+
+        while (length > 0) {
+            ssize_t bytesWritten = ::write(fileFd, buffer, length);
+            if (bytesWritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return (false);
+            }
+            buffer += bytesWritten;
+            length -= bytesWritten;
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Flush the directory holding a file to disk (so a file renamed into it survives a
+    // crash). Returns false on failure.
+    //
+
+    static bool syncDirectory(const std::string &filePath) {
+
+        size_t directoryEnd = filePath.find_last_of('/');
+        std::string directory { (directoryEnd == std::string::npos) ? "." : filePath.substr(0, std::max(directoryEnd, static_cast<size_t> (1))) };
+
+        int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd == -1) {
+            return (false);
+        }
+
+        bool synced = (fsync(directoryFd) == 0);
+
+        ::close(directoryFd);
+
+        return (synced);
+
+    }
+
+    //
+    // Read journal file entries into journal state.
+    //
+
+    static void readTransferJournal(const std::string &journalFile, JournalState &journalState) {
+
+        std::ifstream journalFileStream { journalFile };
+
+        if (journalFileStream) {
+            try {
+                json journalArray;
+                journalFileStream >> journalArray;
+                for (auto &entryJSON : journalArray) {
+                    JournalEntry entry;
+                    entry.source = entryJSON["Source"];
+                    entry.destination = entryJSON["Destination"];
+                    entry.direction = entryJSON["Direction"];
+                    entry.size = entryJSON["Size"];
+                    entry.modified = entryJSON["Modified"];
+                    entry.confirmed = entryJSON["Confirmed"];
+                    if (entryJSON.count("Segments")) {
+                        entry.segments = entryJSON["Segments"].get<std::vector<std::uint64_t>>();
+                    }
+                    journalState.entries[entry.source] = entry;
+                }
+            } catch (...) {
+                std::cerr << "Escapement error: Ignoring corrupt journal [" << journalFile << "]" << std::endl;
+                journalState.entries.clear();
+            }
+        }
+
+    }
+
+    //
+    // Write journal to file (journal mutex must be held). The entries go to a uniquely
+    // named temporary file that is flushed to disk before being renamed over the journal,
+    // so a crash leaves either the old journal or the new one.
+    //
+
+    static void saveTransferJournal(const TransferJournal &transferJournal) {
+
+        if (!transferJournal.journalFile.empty()) {
+
+            json journalArray = json::array();
+            std::string journalFileTemp { transferJournal.journalFile + ".XXXXXX" };
+
+            for (auto &entry : transferJournal.journalState->entries) {
+                json entryJSON;
+                entryJSON["Source"] = entry.second.source;
+                entryJSON["Destination"] = entry.second.destination;
+                entryJSON["Direction"] = entry.second.direction;
+                entryJSON["Size"] = entry.second.size;
+                entryJSON["Modified"] = entry.second.modified;
+                entryJSON["Confirmed"] = entry.second.confirmed;
+                if (!entry.second.segments.empty()) {
+                    entryJSON["Segments"] = entry.second.segments;
+                }
+                journalArray.push_back(entryJSON);
+            }
+
+            std::string journal { journalArray.dump() + "\n" };
+            int journalFileFd = mkstemp(&journalFileTemp[0]);
+
+            if (journalFileFd != -1) {
+                bool written { writeAll(journalFileFd, journal.data(), journal.size()) && (fsync(journalFileFd) == 0) };
+                if ((::close(journalFileFd) == 0) && written &&
+                    (std::rename(journalFileTemp.c_str(), transferJournal.journalFile.c_str()) == 0)) {
+                    if (!syncDirectory(transferJournal.journalFile)) {
+                        std::cerr << "Escapement error: Could not flush directory of journal [" << transferJournal.journalFile << "]" << std::endl;
+                    }
+                    return;
+                }
+                std::remove(journalFileTemp.c_str());
+            }
+
+            std::cerr << "Escapement error: Could not update journal [" << transferJournal.journalFile << "]" << std::endl;
+
+        }
+
+    }
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Load any transfers left in flight by a previous run. A journal file already in use
+    // by another transfer in the process is shared with it rather than read again; with
+    // no journal file the entries are kept in memory for this journal alone.
+    //
+
+    void loadTransferJournal(const std::string &journalFile, TransferJournal &transferJournal) {
+
+        transferJournal.journalFile = journalFile;
+
+        if (journalFile.empty()) {
+            transferJournal.journalState = std::make_shared<JournalState>();
+            return;
+        }
+
+        std::lock_guard<std::mutex> statesLock(journalStates.statesMutex);
+        std::weak_ptr<JournalState> &journalState { journalStates.states[journalFile] };
+
+        transferJournal.journalState = journalState.lock();
+
+        if (!transferJournal.journalState) {
+            transferJournal.journalState = std::make_shared<JournalState>();
+            readTransferJournal(journalFile, *transferJournal.journalState);
+            journalState = transferJournal.journalState;
+        }
+
+    }
+
+    //
+    // Find journal entry for source file. Returns false if there is none.
+    //
+
+    bool findJournalEntry(TransferJournal &transferJournal, const std::string &source, JournalEntry &journalEntry) {
+
+        std::lock_guard<std::mutex> journalLock(transferJournal.journalState->journalMutex);
+
+        auto entry = transferJournal.journalState->entries.find(source);
+        if (entry != transferJournal.journalState->entries.end()) {
+            journalEntry = entry->second;
+            return (true);
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Add/update journal entry and save journal.
+    //
+
+    void updateJournalEntry(TransferJournal &transferJournal, const JournalEntry &journalEntry) {
+
+        std::lock_guard<std::mutex> journalLock(transferJournal.journalState->journalMutex);
+
+        transferJournal.journalState->entries[journalEntry.source] = journalEntry;
+        saveTransferJournal(transferJournal);
+
+    }
+
+    //
+    // Remove journal entry (transfer complete) and save journal.
+    //
+
+    void removeJournalEntry(TransferJournal &transferJournal, const std::string &source) {
+
+        std::lock_guard<std::mutex> journalLock(transferJournal.journalState->journalMutex);
+
+        if (transferJournal.journalState->entries.erase(source)) {
+            saveTransferJournal(transferJournal);
+        }
+
+    }
+
+} // namespace Escapement_Journal
+
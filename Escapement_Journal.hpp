@@ -0,0 +1,69 @@
+#ifndef ESCAPEMENT_JOURNAL_HPP
+#define ESCAPEMENT_JOURNAL_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Journal {
+
+    //
+    // Transfer directions
+    //
+
+    const int kJournalPull { 0 };
+    const int kJournalPush { 1 };
+
+    //
+    // In-flight transfer journal entry
+    //
+
+    struct JournalEntry {
+        std::string source;                     // Source file (remote for pull, local for push)
+        std::string destination;                // Destination file being written
+        int direction { kJournalPull };         // Transfer direction
+        std::uint64_t size { 0 };               // Expected size of complete file
+        std::string modified;                   // Source last modified date/time when started
+        std::uint64_t confirmed { 0 };          // Bytes confirmed transferred (0 for a segmented pull)
+        std::vector<std::uint64_t> segments;    // Bytes confirmed of each range of a segmented pull
+    };
+
+    //
+    // In-flight transfers (indexed by source file) of a journal file; shared by every
+    // transfer (and daemon job) in the process using that file
+    //
+
+    struct JournalState {
+        std::unordered_map<std::string, JournalEntry> entries;  // In-flight transfers
+        std::mutex journalMutex;                                // Journal access mutex
+    };
+
+    //
+    // Journal of in-flight transfers
+    //
+
+    struct TransferJournal {
+        std::string journalFile;                                // Journal file name ("" == no journal)
+        std::shared_ptr<JournalState> journalState;             // In-flight transfers
+    };
+
+    void loadTransferJournal(const std::string &journalFile, TransferJournal &transferJournal);
+    bool findJournalEntry(TransferJournal &transferJournal, const std::string &source, JournalEntry &journalEntry);
+    void updateJournalEntry(TransferJournal &transferJournal, const JournalEntry &journalEntry);
+    void removeJournalEntry(TransferJournal &transferJournal, const std::string &source);
+
+} // namespace Escapement_Journal
+
+#endif /* ESCAPEMENT_JOURNAL_HPP */
+
@@ -0,0 +1,245 @@
+//
+// Module: Escapement_Pipeline
+//
+// Description: Escapement double buffered transfer pipeline. One stage fills
+// buffers (disk reads for uploads, network reads for downloads) while the other
+// drains them (encrypt and send, or disk writes) so that disk and network I/O
+// overlap. One of the stages runs on a background thread; with a fixed number of
+// buffers a slow stage holds back the other (bounded backpressure). An exception
+// in either stage stops the pipeline and is rethrown to the caller.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+//
+// Escapement pipeline
+//
+
+#include "Escapement_Pipeline.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Pipeline {
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Pipeline buffers and their free/filled queues
+    //
+
+    struct TransferPipeline {
+
+        TransferPipeline(size_t bufferSize) : buffers(kPipelineBuffers, std::vector<char>(bufferSize)) {
+            for (int buffer = 0; buffer < kPipelineBuffers; buffer++) {
+                freeBuffers.push_back(buffer);
+            }
+        }
+
+        std::vector<std::vector<char>> buffers;         // Transfer buffers
+        std::deque<int> freeBuffers;                    // Buffers waiting to be filled
+        std::deque<std::pair<int, size_t>> fullBuffers; // Buffers (and lengths) waiting to be drained
+        std::mutex pipelineMutex;                       // Queue access mutex
+        std::condition_variable pipelineCondition;      // Signalled on any queue change
+        bool aborted { false };                         // == true a stage has failed
+
+    };
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Wait for a free buffer. Returns -1 if the pipeline has been aborted.
+    //
+
+    static int acquireFreeBuffer(TransferPipeline &pipeline) {
+
+        std::unique_lock<std::mutex> pipelineLock(pipeline.pipelineMutex);
+
+        pipeline.pipelineCondition.wait(pipelineLock, [&pipeline] { return (pipeline.aborted || !pipeline.freeBuffers.empty()); });
+
+        if (pipeline.aborted) {
+            return (-1);
+        }
+
+        int buffer = pipeline.freeBuffers.front();
+        pipeline.freeBuffers.pop_front();
+
+        return (buffer);
+
+    }
+
+    //
+    // Wait for a filled buffer. Returns buffer -1 if the pipeline has been aborted.
+    //
+
+    static std::pair<int, size_t> acquireFullBuffer(TransferPipeline &pipeline) {
+
+        std::unique_lock<std::mutex> pipelineLock(pipeline.pipelineMutex);
+
+        pipeline.pipelineCondition.wait(pipelineLock, [&pipeline] { return (pipeline.aborted || !pipeline.fullBuffers.empty()); });
+
+        if (pipeline.aborted) {
+            return (std::make_pair(-1, 0));
+        }
+
+        std::pair<int, size_t> buffer = pipeline.fullBuffers.front();
+        pipeline.fullBuffers.pop_front();
+
+        return (buffer);
+
+    }
+
+    //
+    // Queue a filled buffer (length 0 marks end of data).
+    //
+
+    static void releaseFullBuffer(TransferPipeline &pipeline, int buffer, size_t length) {
+
+        std::lock_guard<std::mutex> pipelineLock(pipeline.pipelineMutex);
+
+        pipeline.fullBuffers.emplace_back(buffer, length);
+        pipeline.pipelineCondition.notify_all();
+
+    }
+
+    //
+    // Return a drained buffer to be filled again.
+    //
+
+    static void releaseFreeBuffer(TransferPipeline &pipeline, int buffer) {
+
+        std::lock_guard<std::mutex> pipelineLock(pipeline.pipelineMutex);
+
+        pipeline.freeBuffers.push_back(buffer);
+        pipeline.pipelineCondition.notify_all();
+
+    }
+
+    //
+    // Stop both pipeline stages.
+    //
+
+    static void abortPipeline(TransferPipeline &pipeline) {
+
+        std::lock_guard<std::mutex> pipelineLock(pipeline.pipelineMutex);
+
+        pipeline.aborted = true;
+        pipeline.pipelineCondition.notify_all();
+
+    }
+
+    //
+    // Fill stage: fill free buffers until end of data.
+    //
+
+    static void fillStage(TransferPipeline &pipeline, FillFn &fillFn) {
+
+        for (;;) {
+            int buffer = acquireFreeBuffer(pipeline);
+            if (buffer == -1) {
+                return;
+            }
+            size_t length = fillFn(pipeline.buffers[buffer].data(), pipeline.buffers[buffer].size());
+            releaseFullBuffer(pipeline, buffer, length);
+            if (length == 0) {
+                return;
+            }
+        }
+
+    }
+
+    //
+    // Drain stage: drain filled buffers until end of data. Returns bytes drained.
+    //
+
+    static std::uint64_t drainStage(TransferPipeline &pipeline, DrainFn &drainFn) {
+
+        std::uint64_t bytesDrained { 0 };
+
+        for (;;) {
+            std::pair<int, size_t> buffer = acquireFullBuffer(pipeline);
+            if ((buffer.first == -1) || (buffer.second == 0)) {
+                return (bytesDrained);
+            }
+            drainFn(pipeline.buffers[buffer.first].data(), buffer.second);
+            bytesDrained += buffer.second;
+            releaseFreeBuffer(pipeline, buffer.first);
+        }
+
+    }
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Run fill and drain stages over double buffers of bufferSize bytes, with the fill
+    // stage (backgroundFill == true) or drain stage on a background thread. Returns the
+    // number of bytes drained.
+    //
+
+    std::uint64_t pipelineTransfer(size_t bufferSize, FillFn fillFn, DrainFn drainFn, bool backgroundFill) {
+
+        TransferPipeline pipeline(bufferSize);
+        std::exception_ptr backgroundError;
+        std::uint64_t bytesDrained { 0 };
+
+        std::thread backgroundThread([&pipeline, &fillFn, &drainFn, &backgroundError, &bytesDrained, backgroundFill] () {
+            try {
+                if (backgroundFill) {
+                    fillStage(pipeline, fillFn);
+                } else {
+                    bytesDrained = drainStage(pipeline, drainFn);
+                }
+            } catch (...) {
+                backgroundError = std::current_exception();
+                abortPipeline(pipeline);
+            }
+        });
+
+        try {
+            if (backgroundFill) {
+                bytesDrained = drainStage(pipeline, drainFn);
+            } else {
+                fillStage(pipeline, fillFn);
+            }
+        } catch (...) {
+            abortPipeline(pipeline);
+            backgroundThread.join();
+            throw;
+        }
+
+        backgroundThread.join();
+
+        if (backgroundError) {
+            std::rethrow_exception(backgroundError);
+        }
+
+        return (bytesDrained);
+
+    }
+
+} // namespace Escapement_Pipeline
+
@@ -0,0 +1,37 @@
+#ifndef ESCAPEMENT_PIPELINE_HPP
+#define ESCAPEMENT_PIPELINE_HPP
+
+//
+// C++ STL
+//
+
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Pipeline {
+
+    //
+    // Pipeline stages. A fill function places up to size bytes in buffer and returns the
+    // number placed (0 == end of data); a drain function consumes a filled buffer.
+    //
+
+    typedef std::function<size_t (char *buffer, size_t size)> FillFn;
+    typedef std::function<void (const char *buffer, size_t length)> DrainFn;
+
+    //
+    // Number of transfer buffers in a pipeline (double buffering)
+    //
+
+    const int kPipelineBuffers { 2 };
+
+    std::uint64_t pipelineTransfer(size_t bufferSize, FillFn fillFn, DrainFn drainFn, bool backgroundFill);
+
+} // namespace Escapement_Pipeline
+
+#endif /* ESCAPEMENT_PIPELINE_HPP */
+
@@ -0,0 +1,1675 @@
+//
+// Class: CSession
+//
+// Description: Minimal blocking FTP session (control connection plus passive data
+// connections, optionally over explicit TLS) used by Escapement for file transfers.
+// It provides what Antik CFTP does not expose, such as restarted and byte range
+// transfers with REST and uploads sent without copying through user space (sendfile()
+// on plain connections, kernel TLS on TLS connections where the kernel supports it).
+// Other transfers stream through large double buffers so disk and network I/O overlap;
+// downloads are written through io_uring from registered buffers (O_DIRECT for large
+// files if requested) where the kernel supports it.
+// Where the server supports it whole file transfers may be deflate compressed (MODE Z).
+// TLS sessions are resumed on data connections (from the control connection, as many
+// servers require) and on control reconnects to cut the cost of full handshakes. The
+// data connection for the next transfer is negotiated as the current one completes.
+// A server's FEAT reply is cached so later sessions to it skip the round trip.
+// Replies are handled as status codes in the same manner as CFTP and connection level
+// failures reported by throwing CSession::Exception.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : Sockets, sendfile, io_uring.
+// OpenSSL            : TLS for control and data connections (kTLS when available).
+// zlib               : MODE Z compression.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <cstring>
+#include <cerrno>
+#include <cctype>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <sstream>
+#include <mutex>
+#include <unordered_map>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <poll.h>
+
+//
+// zlib
+//
+
+#include <zlib.h>
+
+//
+// Escapement session
+//
+
+#include "Escapement_Session.hpp"
+#include "Escapement_Pipeline.hpp"
+#include "Escapement_Uring.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Session {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+    using namespace Escapement_Pipeline;
+    using namespace Escapement_Compress;
+    using namespace Escapement_Uring;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Socket send/receive timeout (seconds) and data transfer buffer size
+    //
+
+    static const int kSocketTimeout { 60 };
+
+    //
+    // Maximum bytes per zero copy send (between progress reports)
+    //
+
+    static const std::uint64_t kZeroCopyChunkSize { 4 * 1024 * 1024 };
+
+    //
+    // Compression/decompression output buffer size
+    //
+
+    static const size_t kCompressionBufferSize { 256 * 1024 };
+
+    //
+    // Maximum commands sent before their replies are read when pipelining
+    //
+
+    static const size_t kCommandPipelineWindow { 64 };
+
+    //
+    // Directory listing read buffer size
+    //
+
+    static const size_t kListBufferSize { 16 * 1024 };
+
+    //
+    // TLS sessions kept for resumption by later control connections (keyed on
+    // user@server:port) and TLS handshake statistics; shared by all sessions. Emptied
+    // by CSession::clearTLSSessionCache() before exit.
+    //
+
+    struct TLSSessionCache {
+        std::unordered_map<std::string, SSL_SESSION *> sessions; // Cached TLS sessions
+        CSession::TLSStatistics statistics;                      // Handshake statistics
+        std::mutex cacheMutex;                                   // Cache access mutex
+    };
+
+    static TLSSessionCache tlsSessionCache;
+
+    //
+    // Server FEAT replies (keyed on user@server:port) so that only the first control
+    // connection to a server asks for its features; shared by all sessions.
+    //
+
+    struct FeatureCache {
+        std::unordered_map<std::string, std::string> features; // Cached FEAT replies
+        std::mutex cacheMutex;                                  // Cache access mutex
+    };
+
+    static FeatureCache featureCache;
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Return TLS session and FEAT cache key for options (user@server:port, marked if the
+    // server certificate is not verified so such sessions are never resumed otherwise).
+    //
+
+    static std::string sessionCacheKey(const EscapementOptions &optionData) {
+
+        return (optionData.userName + "@" + optionData.serverName + ":" + optionData.serverPort +
+                ((optionData.noVerify) ? "/noverify" : ""));
+
+    }
+
+    //
+    // Set the name the server certificate must match (an IP address or host name).
+    //
+
+    static bool setCertificateName(SSL *ssl, const std::string &serverName) {
+
+        if (X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), serverName.c_str()) == 1) {
+            return (true);
+        }
+
+        return (SSL_set1_host(ssl, serverName.c_str()) == 1);
+
+    }
+
+    //
+    // Return true if TLS connection sends through kernel TLS.
+    //
+
+    static bool isKernelTLSSend(SSL *ssl) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+        return (BIO_get_ktls_send(SSL_get_wbio(ssl)) > 0);
+#else
+        (void) ssl;
+        return (false);
+#endif
+    }
+
+    //
+    // Send part of a file over a kernel TLS connection.
+    //
+
+    static ssize_t kernelTLSSendFile(SSL *ssl, int localFile, std::uint64_t offset, size_t length) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+        return (SSL_sendfile(ssl, localFile, offset, length, 0));
+#else
+        (void) ssl; (void) localFile; (void) offset; (void) length;
+        return (-1);
+#endif
+    }
+
+    //
+    // Take local file out of direct I/O (for writes that are not aligned).
+    //
+
+    static void clearDirectIO(int localFile) {
+        int fileFlags = fcntl(localFile, F_GETFL);
+        if ((fileFlags != -1) && (fileFlags & O_DIRECT)) {
+            fcntl(localFile, F_SETFL, fileFlags & ~O_DIRECT);
+        }
+    }
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Connect channel socket to host/port. A non-blocking connect returns once the
+    // connection has been started (see waitForConnect()).
+    //
+
+    void CSession::openSocket(Channel &channel, const std::string &host, const std::string &port, bool nonBlocking) {
+
+        struct addrinfo hints, *addressList { nullptr };
+        struct timeval socketTimeout { kSocketTimeout, 0 };
+
+        std::memset(&hints, 0, sizeof (hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addressList) != 0) {
+            throw Exception("Could not resolve " + host + ":" + port);
+        }
+
+        for (auto address = addressList; address != nullptr; address = address->ai_next) {
+            channel.socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (channel.socket == -1) {
+                continue;
+            }
+            setsockopt(channel.socket, SOL_SOCKET, SO_RCVTIMEO, &socketTimeout, sizeof (socketTimeout));
+            setsockopt(channel.socket, SOL_SOCKET, SO_SNDTIMEO, &socketTimeout, sizeof (socketTimeout));
+            if (nonBlocking) {
+                fcntl(channel.socket, F_SETFL, fcntl(channel.socket, F_GETFL) | O_NONBLOCK);
+            }
+            if ((::connect(channel.socket, address->ai_addr, address->ai_addrlen) == 0) ||
+                (nonBlocking && (errno == EINPROGRESS))) {
+                break;
+            }
+            ::close(channel.socket);
+            channel.socket = -1;
+        }
+
+        freeaddrinfo(addressList);
+
+        if (channel.socket == -1) {
+            throw Exception("Could not connect to " + host + ":" + port);
+        }
+
+    }
+
+    //
+    // Negotiate TLS on a connected channel, offering to resume session (if any) for an
+    // abbreviated handshake.
+    //
+
+    void CSession::startTLS(Channel &channel, SSL_SESSION *session) {
+
+        channel.ssl = SSL_new(m_sslContext);
+        if (channel.ssl == nullptr) {
+            throw Exception("Could not create TLS connection.");
+        }
+
+        SSL_set_fd(channel.ssl, channel.socket);
+        SSL_set_tlsext_host_name(channel.ssl, m_serverName.c_str());
+        if (!setCertificateName(channel.ssl, m_serverName)) {
+            throw Exception("Could not set TLS certificate name.");
+        }
+
+        if (session != nullptr) {
+            SSL_set_session(channel.ssl, session);
+        }
+
+        if (SSL_connect(channel.ssl) != 1) {
+            throw Exception("TLS handshake with " + m_serverName + " failed.");
+        }
+
+        std::lock_guard<std::mutex> cacheLock(tlsSessionCache.cacheMutex);
+        tlsSessionCache.statistics.handshakes++;
+        if (SSL_session_reused(channel.ssl)) {
+            tlsSessionCache.statistics.resumed++;
+        }
+
+    }
+
+    //
+    // Keep control connection TLS session for resumption on reconnect. Called once logged
+    // in as by then any TLS 1.3 session tickets will have arrived.
+    //
+
+    void CSession::cacheTLSSession(void) {
+
+        SSL_SESSION *session = SSL_get1_session(m_control.ssl);
+
+        if ((session != nullptr) && SSL_SESSION_is_resumable(session)) {
+            std::lock_guard<std::mutex> cacheLock(tlsSessionCache.cacheMutex);
+            auto cachedSession = tlsSessionCache.sessions.find(m_sessionCacheKey);
+            if (cachedSession != tlsSessionCache.sessions.end()) {
+                SSL_SESSION_free(cachedSession->second);
+                cachedSession->second = session;
+            } else {
+                tlsSessionCache.sessions[m_sessionCacheKey] = session;
+            }
+        } else if (session != nullptr) {
+            SSL_SESSION_free(session);
+        }
+
+    }
+
+    //
+    // Close channel. A graceful close sends any TLS close notify and end of stream and
+    // then waits for the server to close its side, so no data still in flight is lost to
+    // a reset; otherwise the socket is reset so that the server sees any transfer in
+    // progress fail at once.
+    //
+
+    void CSession::closeChannel(Channel &channel, bool graceful) {
+
+        if (channel.ssl != nullptr) {
+            if (graceful) {
+                SSL_shutdown(channel.ssl);
+            }
+            SSL_free(channel.ssl);
+            channel.ssl = nullptr;
+        }
+
+        if (channel.socket != -1) {
+            if (graceful) {
+                char drainBuffer[1024];
+                ::shutdown(channel.socket, SHUT_WR);
+                while (::recv(channel.socket, drainBuffer, sizeof (drainBuffer), 0) > 0) {
+                }
+            } else {
+                struct linger socketLinger { 1, 0 };
+                setsockopt(channel.socket, SOL_SOCKET, SO_LINGER, &socketLinger, sizeof (socketLinger));
+            }
+            ::close(channel.socket);
+            channel.socket = -1;
+        }
+
+    }
+
+    //
+    // Read from channel returning bytes read (0 end of stream). Reads interrupted (for
+    // instance by io_uring completion work) are retried.
+    //
+
+    ssize_t CSession::readChannel(Channel &channel, void *buffer, size_t length) {
+
+        ssize_t bytesRead;
+
+        if (channel.ssl != nullptr) {
+            int sslError;
+            do {
+                bytesRead = SSL_read(channel.ssl, buffer, length);
+                sslError = (bytesRead <= 0) ? SSL_get_error(channel.ssl, bytesRead) : SSL_ERROR_NONE;
+            } while ((sslError == SSL_ERROR_WANT_READ) && (errno == EINTR));
+            if (bytesRead <= 0) {
+                if ((sslError == SSL_ERROR_ZERO_RETURN) || ((sslError == SSL_ERROR_SYSCALL) && (bytesRead == 0))) {
+                    return (0);
+                }
+                throw Exception("TLS read failed.");
+            }
+        } else {
+            do {
+                bytesRead = ::recv(channel.socket, buffer, length, 0);
+            } while ((bytesRead == -1) && (errno == EINTR));
+            if (bytesRead == -1) {
+                throw Exception("Socket read failed: " + std::string(std::strerror(errno)));
+            }
+        }
+
+        return (bytesRead);
+
+    }
+
+    //
+    // Write buffer to channel.
+    //
+
+    void CSession::writeChannel(Channel &channel, const void *buffer, size_t length) {
+
+        const char *data = static_cast<const char *> (buffer);
+
+        while (length > 0) {
+            ssize_t bytesWritten;
+            if (channel.ssl != nullptr) {
+                bytesWritten = SSL_write(channel.ssl, data, length);
+                if (bytesWritten <= 0) {
+                    if ((SSL_get_error(channel.ssl, bytesWritten) == SSL_ERROR_WANT_WRITE) && (errno == EINTR)) {
+                        continue;
+                    }
+                    throw Exception("TLS write failed.");
+                }
+            } else {
+                bytesWritten = ::send(channel.socket, data, length, MSG_NOSIGNAL);
+                if (bytesWritten == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw Exception("Socket write failed: " + std::string(std::strerror(errno)));
+                }
+            }
+            data += bytesWritten;
+            length -= bytesWritten;
+        }
+
+    }
+
+    //
+    // Read (possibly multi-line) reply from control connection and return status code.
+    //
+
+    std::uint16_t CSession::readReply(void) {
+
+        std::string replyCode;
+
+        m_commandResponse.clear();
+
+        for (;;) {
+
+            size_t lineEnd;
+
+            while ((lineEnd = m_replyBuffer.find('\n')) == std::string::npos) {
+                char buffer[1024];
+                ssize_t bytesRead = readChannel(m_control, buffer, sizeof (buffer));
+                if (bytesRead == 0) {
+                    closeChannel(m_control, false);
+                    throw Exception("Server closed control connection.");
+                }
+                m_replyBuffer.append(buffer, bytesRead);
+            }
+
+            std::string line { m_replyBuffer.substr(0, lineEnd + 1) };
+            m_replyBuffer.erase(0, lineEnd + 1);
+            m_commandResponse += line;
+
+            if (replyCode.empty()) {
+                if ((line.size() < 4) || !std::isdigit(line[0]) || !std::isdigit(line[1]) || !std::isdigit(line[2])) {
+                    throw Exception("Invalid server reply [" + line + "]");
+                }
+                replyCode = line.substr(0, 3);
+                if (line[3] != '-') {
+                    break;
+                }
+            } else if ((line.compare(0, 3, replyCode) == 0) && (line.size() > 3) && (line[3] == ' ')) {
+                break;
+            }
+
+        }
+
+        m_commandStatusCode = std::stoi(replyCode);
+
+        return (m_commandStatusCode);
+
+    }
+
+    //
+    // Return data port from passive mode (EPSV/PASV) reply ("" if not in passive mode).
+    // The address given in a PASV reply is ignored in favour of the control connection
+    // address.
+    //
+
+    std::string CSession::passiveDataPort(std::uint16_t statusCode) const {
+
+        if (statusCode == 229) {
+            size_t portStart = m_commandResponse.find("|||");
+            if (portStart != std::string::npos) {
+                return (std::to_string(std::stoi(m_commandResponse.substr(portStart + 3))));
+            }
+        } else if (statusCode == 227) {
+            size_t addressStart = m_commandResponse.find_first_of("0123456789", 4);
+            std::vector<int> addressFields;
+            while ((addressStart != std::string::npos) && (addressFields.size() < 6)) {
+                size_t addressEnd;
+                addressFields.push_back(std::stoi(m_commandResponse.substr(addressStart), &addressEnd));
+                addressStart = m_commandResponse.find_first_of("0123456789", addressStart + addressEnd);
+            }
+            if (addressFields.size() == 6) {
+                return (std::to_string(addressFields[4] * 256 + addressFields[5]));
+            }
+        }
+
+        return ("");
+
+    }
+
+    //
+    // Open passive data connection (EPSV with fallback to PASV), using any connection
+    // already negotiated at the end of the last transfer if it is still good.
+    //
+
+    void CSession::openDataChannel(Channel &dataChannel) {
+
+        std::string dataPort;
+
+        collectNextDataChannel();
+
+        if (m_nextDataChannel.socket != -1) {
+            bool connected = waitForConnect(m_nextDataChannel);
+            std::swap(dataChannel, m_nextDataChannel);
+            if (connected) {
+                return;
+            }
+            closeChannel(dataChannel, false);
+        }
+
+        if (m_passiveCommand == "EPSV") {
+            dataPort = passiveDataPort(command("EPSV"));
+            if (dataPort.empty()) {
+                m_passiveCommand = "PASV";
+            }
+        }
+
+        if (dataPort.empty()) {
+            dataPort = passiveDataPort(command("PASV"));
+        }
+
+        if (dataPort.empty()) {
+            throw Exception("Could not enter passive mode [" + m_commandResponse + "]");
+        }
+
+        openSocket(dataChannel, m_serverAddress, dataPort);
+
+    }
+
+    //
+    // Wait for a non-blocking connect on channel to complete and put the socket back
+    // into blocking mode. Returns false if the connection failed or has since been
+    // closed by the server.
+    //
+
+    bool CSession::waitForConnect(Channel &channel) {
+
+        struct pollfd connectPoll { channel.socket, POLLOUT, 0 };
+        int socketError { 0 };
+        socklen_t socketErrorLength = sizeof (socketError);
+        char peekBuffer[1];
+
+        if ((poll(&connectPoll, 1, kSocketTimeout * 1000) != 1) ||
+            (getsockopt(channel.socket, SOL_SOCKET, SO_ERROR, &socketError, &socketErrorLength) != 0) || (socketError != 0)) {
+            return (false);
+        }
+
+        ssize_t peekLength = ::recv(channel.socket, peekBuffer, sizeof (peekBuffer), MSG_PEEK | MSG_DONTWAIT);
+        if ((peekLength == 0) || ((peekLength == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+            return (false);
+        }
+
+        return (fcntl(channel.socket, F_SETFL, fcntl(channel.socket, F_GETFL) & ~O_NONBLOCK) == 0);
+
+    }
+
+    //
+    // Send the passive mode command for the next transfer without waiting for its reply,
+    // so the server handles it while the caller moves on to the next transfer.
+    //
+
+    void CSession::requestNextDataChannel(void) {
+
+        std::string commandBuffer { m_passiveCommand + "\r\n" };
+
+        writeChannel(m_control, commandBuffer.data(), commandBuffer.size());
+
+        m_nextDataChannelPending = true;
+
+    }
+
+    //
+    // Read the reply to a passive mode command sent by requestNextDataChannel() (if any)
+    // and start a non-blocking connect to the data port it gives. A server that refuses
+    // EPSV is sent PASV from then on.
+    //
+
+    void CSession::collectNextDataChannel(void) {
+
+        if (!m_nextDataChannelPending) {
+            return;
+        }
+
+        m_nextDataChannelPending = false;
+
+        std::string dataPort { passiveDataPort(readReply()) };
+
+        if (!dataPort.empty()) {
+            try {
+                openSocket(m_nextDataChannel, m_serverAddress, dataPort, true);
+            } catch (...) {
+            }
+        } else if (m_passiveCommand == "EPSV") {
+            m_passiveCommand = "PASV";
+        }
+
+    }
+
+    //
+    // Complete transfer on data connection and return its final reply status code. Once
+    // a transfer that ran to completion has its successful final reply the passive mode
+    // command for the next transfer is sent; its reply is read (and a connect to the
+    // new data port started) only when the session is next used, so the next transfer
+    // does not wait on that round trip.
+    //
+
+    std::uint16_t CSession::completeTransfer(Channel &dataChannel, bool graceful) {
+
+        closeChannel(dataChannel, graceful);
+
+        std::uint16_t statusCode = readReply();
+
+        if (graceful && ((statusCode == 226) || (statusCode == 250))) {
+            requestNextDataChannel();
+        }
+
+        return (statusCode);
+
+    }
+
+    //
+    // Open data connection and issue transfer command. Returns false (with the data
+    // connection closed) if the server does not start the transfer.
+    //
+
+    bool CSession::openTransfer(const std::string &commandLine, Channel &dataChannel) {
+
+        openDataChannel(dataChannel);
+
+        std::uint16_t statusCode = command(commandLine);
+        if ((statusCode != 125) && (statusCode != 150)) {
+            closeChannel(dataChannel, false);
+            return (false);
+        }
+
+        if (m_sslContext != nullptr) {
+            try {
+                startTLS(dataChannel, SSL_get_session(m_control.ssl));
+            } catch (...) {
+                closeChannel(dataChannel, false);
+                throw;
+            }
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Receive up to length bytes from data connection writing them to local file at offset.
+    // Network reads fill one registered buffer while writes of the previous ones complete
+    // through io_uring; when all buffers are waiting on the disk reading stops until one
+    // is free. Without io_uring (or if the writer cannot be set up, after which io_uring
+    // is not tried again) network reads fill one buffer while the previous one is written
+    // to disk on a background thread (which also reports progress). Returns bytes
+    // received; endOfFile is set if the server closed the data connection.
+    //
+
+    std::uint64_t CSession::receiveData(Channel &dataChannel, int localFile, std::uint64_t offset, std::uint64_t length, bool &endOfFile, ProgressFn progressFn) {
+
+        std::uint64_t bytesReceived { 0 };
+        std::uint64_t bytesWritten { 0 };
+        std::unique_ptr<CUringWriter> uringWriter;
+
+        endOfFile = false;
+
+        if (CUringWriter::isSupported()) {
+            try {
+                uringWriter.reset(new CUringWriter(localFile, offset, m_ioBufferSize));
+            } catch (const CUringWriter::Exception &e) {
+                std::cerr << "Escapement error: " << e.what() << " (writing without io_uring)" << std::endl;
+            }
+        }
+
+        if (!uringWriter) {
+
+            clearDirectIO(localFile);
+
+            return (pipelineTransfer(m_ioBufferSize,
+                    [this, &dataChannel, &bytesReceived, &endOfFile, length] (char *buffer, size_t size) {
+                        size_t bufferLength { 0 };
+                        while (!endOfFile && (bufferLength < size) && (bytesReceived < length)) {
+                            ssize_t bytesRead = readChannel(dataChannel, buffer + bufferLength,
+                                    std::min(static_cast<std::uint64_t> (size - bufferLength), length - bytesReceived));
+                            if (bytesRead == 0) {
+                                endOfFile = true;
+                            }
+                            bufferLength += bytesRead;
+                            bytesReceived += bytesRead;
+                        }
+                        return (bufferLength);
+                    },
+                    [localFile, offset, &bytesWritten, &progressFn] (const char *buffer, size_t length) {
+                        if (pwrite(localFile, buffer, length, offset + bytesWritten) != static_cast<ssize_t> (length)) {
+                            throw Exception("Local file write failed: " + std::string(std::strerror(errno)));
+                        }
+                        bytesWritten += length;
+                        if (progressFn) {
+                            progressFn(bytesWritten);
+                        }
+                    }, false));
+
+        }
+
+        try {
+
+            CUringWriter &fileWriter { *uringWriter };
+
+            while (!endOfFile && (bytesReceived < length)) {
+                char *buffer = fileWriter.getBuffer();
+                size_t bufferLength { 0 };
+                while (!endOfFile && (bufferLength < fileWriter.getBufferSize()) && (bytesReceived < length)) {
+                    ssize_t bytesRead = readChannel(dataChannel, buffer + bufferLength,
+                            std::min(static_cast<std::uint64_t> (fileWriter.getBufferSize() - bufferLength), length - bytesReceived));
+                    if (bytesRead == 0) {
+                        endOfFile = true;
+                    }
+                    bufferLength += bytesRead;
+                    bytesReceived += bytesRead;
+                }
+                fileWriter.writeBuffer(buffer, bufferLength);
+                if (progressFn && (fileWriter.getBytesWritten() != bytesWritten)) {
+                    bytesWritten = fileWriter.getBytesWritten();
+                    progressFn(bytesWritten);
+                }
+            }
+
+            fileWriter.complete();
+
+            if (progressFn && (fileWriter.getBytesWritten() != bytesWritten)) {
+                progressFn(fileWriter.getBytesWritten());
+            }
+
+        } catch (const CUringWriter::Exception &e) {
+            throw Exception(e.what());
+        }
+
+        return (bytesReceived);
+
+    }
+
+    //
+    // Send local file from offset to its end over data connection. Plain connections
+    // and TLS connections whose keys have been handed to the kernel (kTLS) send straight
+    // from the file with sendfile(); otherwise disk reads fill one buffer on a background
+    // thread while the previous one is encrypted and sent. Returns bytes sent.
+    //
+
+    std::uint64_t CSession::sendData(Channel &dataChannel, int localFile, std::uint64_t offset, ProgressFn progressFn) {
+
+        struct stat fileStat;
+        std::uint64_t bytesTransferred { 0 };
+
+        if (fstat(localFile, &fileStat) != 0) {
+            throw Exception("Local file stat failed: " + std::string(std::strerror(errno)));
+        }
+
+        std::uint64_t fileSize = fileStat.st_size;
+
+        if ((dataChannel.ssl == nullptr) || isKernelTLSSend(dataChannel.ssl)) {
+
+            while ((offset + bytesTransferred) < fileSize) {
+                size_t chunkSize = std::min(kZeroCopyChunkSize, fileSize - offset - bytesTransferred);
+                ssize_t bytesSent;
+                if (dataChannel.ssl == nullptr) {
+                    off_t fileOffset = offset + bytesTransferred;
+                    bytesSent = sendfile(dataChannel.socket, localFile, &fileOffset, chunkSize);
+                    if ((bytesSent == -1) && (errno == EINTR)) {
+                        continue;
+                    }
+                } else {
+                    bytesSent = kernelTLSSendFile(dataChannel.ssl, localFile, offset + bytesTransferred, chunkSize);
+                }
+                if (bytesSent <= 0) {
+                    throw Exception("Zero copy send failed: " + std::string(std::strerror(errno)));
+                }
+                bytesTransferred += bytesSent;
+                if (progressFn) {
+                    progressFn(bytesTransferred);
+                }
+            }
+
+        } else {
+
+            std::uint64_t bytesRead { 0 };
+
+            bytesTransferred = pipelineTransfer(m_ioBufferSize,
+                    [localFile, offset, &bytesRead] (char *buffer, size_t size) {
+                        size_t bufferLength { 0 };
+                        while (bufferLength < size) {
+                            ssize_t readLength = pread(localFile, buffer + bufferLength, size - bufferLength, offset + bytesRead);
+                            if (readLength == -1) {
+                                if (errno == EINTR) {
+                                    continue;
+                                }
+                                throw Exception("Local file read failed: " + std::string(std::strerror(errno)));
+                            }
+                            if (readLength == 0) {
+                                break;
+                            }
+                            bufferLength += readLength;
+                            bytesRead += readLength;
+                        }
+                        return (bufferLength);
+                    },
+                    [this, &dataChannel, &bytesTransferred, &progressFn] (const char *buffer, size_t length) {
+                        writeChannel(dataChannel, buffer, length);
+                        bytesTransferred += length;
+                        if (progressFn) {
+                            progressFn(bytesTransferred);
+                        }
+                    }, true);
+
+        }
+
+        return (bytesTransferred);
+
+    }
+
+    //
+    // Receive a MODE Z (deflate) data stream and write it decompressed to local file.
+    // Network reads fill one buffer while the previous one is decompressed and written
+    // to disk on a background thread. Returns bytes written.
+    //
+
+    std::uint64_t CSession::receiveCompressedData(Channel &dataChannel, int localFile, ProgressFn progressFn) {
+
+        z_stream inflateStream {};
+        std::vector<Bytef> inflateBuffer(kCompressionBufferSize);
+        std::uint64_t bytesWritten { 0 };
+        bool endOfFile { false };
+        bool endOfStream { false };
+
+        if (inflateInit(&inflateStream) != Z_OK) {
+            throw Exception("Could not initialise decompression.");
+        }
+
+        clearDirectIO(localFile);
+
+        try {
+
+            pipelineTransfer(m_ioBufferSize,
+                    [this, &dataChannel, &endOfFile] (char *buffer, size_t size) {
+                        size_t bufferLength { 0 };
+                        while (!endOfFile && (bufferLength < size)) {
+                            ssize_t bytesRead = readChannel(dataChannel, buffer + bufferLength, size - bufferLength);
+                            if (bytesRead == 0) {
+                                endOfFile = true;
+                            }
+                            bufferLength += bytesRead;
+                            m_transferStats.wireBytes += bytesRead;
+                        }
+                        return (bufferLength);
+                    },
+                    [localFile, &inflateStream, &inflateBuffer, &bytesWritten, &endOfStream, &progressFn] (const char *buffer, size_t length) {
+                        inflateStream.next_in = reinterpret_cast<Bytef *> (const_cast<char *> (buffer));
+                        inflateStream.avail_in = length;
+                        while (!endOfStream) {
+                            inflateStream.next_out = inflateBuffer.data();
+                            inflateStream.avail_out = inflateBuffer.size();
+                            int status = inflate(&inflateStream, Z_NO_FLUSH);
+                            if (status == Z_STREAM_END) {
+                                endOfStream = true;
+                            } else if ((status != Z_OK) && (status != Z_BUF_ERROR)) {
+                                throw Exception("Decompression failed.");
+                            }
+                            size_t inflatedLength = inflateBuffer.size() - inflateStream.avail_out;
+                            if (pwrite(localFile, inflateBuffer.data(), inflatedLength, bytesWritten) != static_cast<ssize_t> (inflatedLength)) {
+                                throw Exception("Local file write failed: " + std::string(std::strerror(errno)));
+                            }
+                            bytesWritten += inflatedLength;
+                            if (progressFn) {
+                                progressFn(bytesWritten);
+                            }
+                            if ((inflateStream.avail_in == 0) && (inflateStream.avail_out != 0)) {
+                                break;
+                            }
+                        }
+                    }, false);
+
+            if (!endOfStream) {
+                throw Exception("Compressed data stream truncated.");
+            }
+
+        } catch (...) {
+            inflateEnd(&inflateStream);
+            throw;
+        }
+
+        inflateEnd(&inflateStream);
+
+        return (bytesWritten);
+
+    }
+
+    //
+    // Send local file as a MODE Z (deflate) data stream. Disk reads fill one buffer on a
+    // background thread while the previous one is compressed and sent. Returns file bytes sent.
+    //
+
+    std::uint64_t CSession::sendCompressedData(Channel &dataChannel, int localFile, ProgressFn progressFn) {
+
+        z_stream deflateStream {};
+        std::vector<Bytef> deflateBuffer(kCompressionBufferSize);
+        std::uint64_t bytesRead { 0 };
+        std::uint64_t bytesTransferred { 0 };
+
+        if (deflateInit(&deflateStream, m_compressionControl.level) != Z_OK) {
+            throw Exception("Could not initialise compression.");
+        }
+
+        auto deflateData = [this, &dataChannel, &deflateStream, &deflateBuffer] (const char *buffer, size_t length, int flush) {
+            deflateStream.next_in = reinterpret_cast<Bytef *> (const_cast<char *> (buffer));
+            deflateStream.avail_in = length;
+            for (;;) {
+                deflateStream.next_out = deflateBuffer.data();
+                deflateStream.avail_out = deflateBuffer.size();
+                int status = deflate(&deflateStream, flush);
+                if (status == Z_STREAM_ERROR) {
+                    throw Exception("Compression failed.");
+                }
+                size_t deflatedLength = deflateBuffer.size() - deflateStream.avail_out;
+                writeChannel(dataChannel, deflateBuffer.data(), deflatedLength);
+                m_transferStats.wireBytes += deflatedLength;
+                if ((status == Z_STREAM_END) || ((flush != Z_FINISH) && (deflateStream.avail_out != 0))) {
+                    break;
+                }
+            }
+        };
+
+        try {
+
+            pipelineTransfer(m_ioBufferSize,
+                    [localFile, &bytesRead] (char *buffer, size_t size) {
+                        size_t bufferLength { 0 };
+                        while (bufferLength < size) {
+                            ssize_t readLength = pread(localFile, buffer + bufferLength, size - bufferLength, bytesRead);
+                            if (readLength == -1) {
+                                if (errno == EINTR) {
+                                    continue;
+                                }
+                                throw Exception("Local file read failed: " + std::string(std::strerror(errno)));
+                            }
+                            if (readLength == 0) {
+                                break;
+                            }
+                            bufferLength += readLength;
+                            bytesRead += readLength;
+                        }
+                        return (bufferLength);
+                    },
+                    [&deflateData, &bytesTransferred, &progressFn] (const char *buffer, size_t length) {
+                        deflateData(buffer, length, Z_NO_FLUSH);
+                        bytesTransferred += length;
+                        if (progressFn) {
+                            progressFn(bytesTransferred);
+                        }
+                    }, true);
+
+            deflateData(nullptr, 0, Z_FINISH);
+
+        } catch (...) {
+            deflateEnd(&deflateStream);
+            throw;
+        }
+
+        deflateEnd(&deflateStream);
+
+        return (bytesTransferred);
+
+    }
+
+    //
+    // Put the server into MODE Z (setting its compression level) for a transfer that
+    // is to be compressed, or back into MODE S otherwise. Returns true if the transfer
+    // is to be compressed.
+    //
+
+    bool CSession::selectTransferMode(bool compressible) {
+
+        bool compressed = compressible && m_compressTransfer;
+
+        if (compressed && (m_serverCompressionLevel != m_compressionControl.level)) {
+            command("OPTS MODE Z LEVEL " + std::to_string(m_compressionControl.level));
+            m_serverCompressionLevel = m_compressionControl.level;
+        }
+
+        if (compressed != m_modeZ) {
+            if (command((compressed) ? "MODE Z" : "MODE S") == 200) {
+                m_modeZ = compressed;
+            } else if (compressed) {
+                m_compressionSupported = m_compressTransfer = compressed = false;
+            } else {
+                throw Exception("Could not leave compressed mode [" + m_commandResponse + "]");
+            }
+        }
+
+        m_transferStats = TransferStats();
+        m_transferStats.compressed = compressed;
+        m_transferStats.level = (compressed) ? m_compressionControl.level : 0;
+
+        return (compressed);
+
+    }
+
+    //
+    // Complete transfer statistics and, for a successful transfer, adjust compression level.
+    //
+
+    void CSession::completeTransferStats(std::chrono::steady_clock::time_point startTime, std::uint64_t fileBytes, std::uint16_t statusCode) {
+
+        m_transferStats.fileBytes = fileBytes;
+        m_bytesTransferred += fileBytes;
+        m_transferStats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+        if ((statusCode == 226) || (statusCode == 250)) {
+            adaptCompressionLevel(m_compressionControl, m_transferStats);
+        }
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Main constructor
+    //
+
+    CSession::CSession() {
+
+    }
+
+    //
+    // Destructor
+    //
+
+    CSession::~CSession() {
+
+        closeChannel(m_nextDataChannel, false);
+        closeChannel(m_control, false);
+
+        if (m_sslContext != nullptr) {
+            SSL_CTX_free(m_sslContext);
+        }
+
+    }
+
+    //
+    // Connect and login to server, switch to binary mode and change to remote directory.
+    //
+
+    void CSession::connect(const EscapementOptions &optionData) {
+
+        struct sockaddr_storage peerAddress;
+        socklen_t peerAddressLength = sizeof (peerAddress);
+        char peerHost[NI_MAXHOST];
+
+        closeChannel(m_control, false);
+        closeChannel(m_nextDataChannel, false);
+
+        m_nextDataChannelPending = false;
+        m_passiveCommand = "EPSV";
+        m_serverName = optionData.serverName;
+        m_sessionCacheKey = sessionCacheKey(optionData);
+        m_ioBufferSize = optionData.ioBufferSize;
+        m_directIOSize = optionData.directIOSize;
+        m_replyBuffer.clear();
+
+        openSocket(m_control, optionData.serverName, optionData.serverPort);
+
+        if ((getpeername(m_control.socket, reinterpret_cast<struct sockaddr *> (&peerAddress), &peerAddressLength) != 0) ||
+            (getnameinfo(reinterpret_cast<struct sockaddr *> (&peerAddress), peerAddressLength, peerHost, sizeof (peerHost), nullptr, 0, NI_NUMERICHOST) != 0)) {
+            throw Exception("Could not get server address.");
+        }
+        m_serverAddress = peerHost;
+
+        if (readReply() != 220) {
+            throw Exception("Server refused connection [" + m_commandResponse + "]");
+        }
+
+        if (!optionData.noSSL) {
+            if (m_sslContext == nullptr) {
+                m_sslContext = SSL_CTX_new(TLS_client_method());
+                if (m_sslContext == nullptr) {
+                    throw Exception("Could not create TLS context.");
+                }
+                if (!optionData.noVerify && (SSL_CTX_set_default_verify_paths(m_sslContext) != 1)) {
+                    SSL_CTX_free(m_sslContext);
+                    m_sslContext = nullptr;
+                    throw Exception("Could not load trusted certificates.");
+                }
+                SSL_CTX_set_verify(m_sslContext, (optionData.noVerify) ? SSL_VERIFY_NONE : SSL_VERIFY_PEER, nullptr);
+#if defined(SSL_OP_ENABLE_KTLS)
+                SSL_CTX_set_options(m_sslContext, SSL_OP_ENABLE_KTLS);
+#endif
+            }
+            if (command("AUTH TLS") != 234) {
+                throw Exception("Server refused TLS [" + m_commandResponse + "]");
+            }
+            SSL_SESSION *cachedSession { nullptr };
+            {
+                std::lock_guard<std::mutex> cacheLock(tlsSessionCache.cacheMutex);
+                auto session = tlsSessionCache.sessions.find(m_sessionCacheKey);
+                if ((session != tlsSessionCache.sessions.end()) && SSL_SESSION_up_ref(session->second)) {
+                    cachedSession = session->second;
+                }
+            }
+            try {
+                startTLS(m_control, cachedSession);
+            } catch (...) {
+                SSL_SESSION_free(cachedSession);
+                throw;
+            }
+            SSL_SESSION_free(cachedSession);
+        }
+
+        std::uint16_t statusCode = command("USER " + optionData.userName);
+        if (statusCode == 331) {
+            statusCode = command("PASS " + optionData.userPassword);
+        }
+        if (statusCode != 230) {
+            throw Exception("Login failed [" + m_commandResponse + "]");
+        }
+
+        if (m_control.ssl != nullptr) {
+            cacheTLSSession();
+        }
+
+        if (!optionData.noSSL) {
+            if ((command("PBSZ 0") != 200) || (command("PROT P") != 200)) {
+                throw Exception("Could not protect data connections [" + m_commandResponse + "]");
+            }
+        }
+
+        if (command("TYPE I") != 200) {
+            throw Exception("Could not set binary mode [" + m_commandResponse + "]");
+        }
+
+        if (command("CWD " + optionData.remoteDirectory) != 250) {
+            throw Exception("Could not change to remote directory [" + m_commandResponse + "]");
+        }
+
+        m_modeZ = m_compressTransfer = false;
+        m_serverCompressionLevel = 0;
+        m_compressionSupported = m_hashSupported = m_modifyTimeSupported = false;
+
+        std::string features;
+
+        {
+            std::lock_guard<std::mutex> cacheLock(featureCache.cacheMutex);
+            auto cachedFeatures = featureCache.features.find(m_sessionCacheKey);
+            if (cachedFeatures != featureCache.features.end()) {
+                features = cachedFeatures->second;
+            }
+        }
+
+        if (features.empty() && (command("FEAT") == 211)) {
+            features = m_commandResponse;
+            std::lock_guard<std::mutex> cacheLock(featureCache.cacheMutex);
+            featureCache.features[m_sessionCacheKey] = features;
+        }
+
+        if (!features.empty()) {
+            m_compressionSupported = optionData.compress && (features.find(" MODE Z") != std::string::npos);
+            m_modifyTimeSupported = (features.find(" MFMT") != std::string::npos);
+            m_hashSupported = optionData.appendUploads && (features.find(" HASH") != std::string::npos) &&
+                    (features.find("SHA-256", features.find(" HASH")) != std::string::npos) &&
+                    (command("OPTS HASH SHA-256") == 200);
+        }
+
+    }
+
+    //
+    // Logout and close control connection.
+    //
+
+    void CSession::disconnect(void) {
+
+        if (isConnected()) {
+            try {
+                command("QUIT");
+            } catch (...) {
+            }
+        }
+
+        closeChannel(m_nextDataChannel, false);
+        closeChannel(m_control, true);
+
+        m_nextDataChannelPending = false;
+        m_workingDirectory.clear();
+
+    }
+
+    //
+    // Close control connection without logging out (used to drop a session whose
+    // state is unknown after a failure).
+    //
+
+    void CSession::close(void) {
+
+        closeChannel(m_nextDataChannel, false);
+        closeChannel(m_control, false);
+
+        m_nextDataChannelPending = false;
+        m_workingDirectory.clear();
+
+    }
+
+    //
+    // Drop any data connection negotiated for the next transfer (reading the reply
+    // that negotiates it if still outstanding); done before commands that may make the
+    // server abandon it and when a session goes idle.
+    //
+
+    void CSession::discardNextDataChannel(void) {
+
+        collectNextDataChannel();
+
+        closeChannel(m_nextDataChannel, false);
+
+    }
+
+    //
+    // Return true if control connection open.
+    //
+
+    bool CSession::isConnected(void) const {
+        return (m_control.socket != -1);
+    }
+
+    //
+    // Return working directory the server last accepted a CWD to ("" if not known).
+    //
+
+    std::string CSession::getWorkingDirectory(void) const {
+        return (m_workingDirectory);
+    }
+
+    //
+    // Send command to server and return reply status code. A data connection negotiated
+    // for the next transfer is kept only across the commands that set that transfer up
+    // (REST and MODE).
+    //
+
+    std::uint16_t CSession::command(const std::string &commandLine) {
+
+        if (!isConnected()) {
+            throw Exception("Not connected to server.");
+        }
+
+        collectNextDataChannel();
+
+        if ((commandLine.compare(0, 5, "REST ") != 0) && (commandLine.compare(0, 5, "MODE ") != 0)) {
+            closeChannel(m_nextDataChannel, false);
+        }
+
+        std::string commandBuffer { commandLine + "\r\n" };
+        writeChannel(m_control, commandBuffer.data(), commandBuffer.size());
+
+        trackWorkingDirectory(commandLine, readReply());
+
+        return (m_commandStatusCode);
+
+    }
+
+    //
+    // Send commands to server in pipelined windows (each window written at once and its
+    // replies then read in order). Returns reply status codes in command order.
+    //
+
+    std::vector<std::uint16_t> CSession::commandPipeline(const std::vector<std::string> &commandLines) {
+
+        std::vector<std::uint16_t> statusCodes;
+
+        if (!isConnected()) {
+            throw Exception("Not connected to server.");
+        }
+
+        discardNextDataChannel();
+
+        for (size_t windowStart = 0; windowStart < commandLines.size(); windowStart += kCommandPipelineWindow) {
+            size_t windowEnd = std::min(windowStart + kCommandPipelineWindow, commandLines.size());
+            std::string commandBuffer;
+            for (size_t commandLine = windowStart; commandLine < windowEnd; commandLine++) {
+                commandBuffer += commandLines[commandLine] + "\r\n";
+            }
+            writeChannel(m_control, commandBuffer.data(), commandBuffer.size());
+            for (size_t commandLine = windowStart; commandLine < windowEnd; commandLine++) {
+                statusCodes.push_back(readReply());
+                trackWorkingDirectory(commandLines[commandLine], statusCodes.back());
+            }
+        }
+
+        return (statusCodes);
+
+    }
+
+    //
+    // Return last command response.
+    //
+
+    std::string CSession::getCommandResponse(void) const {
+        return (m_commandResponse);
+    }
+
+    //
+    // Note working directory change made by a command. An accepted CWD sets it and a
+    // refused (5xx) one leaves it as is; CDUP or any other CWD reply makes it unknown.
+    //
+
+    void CSession::trackWorkingDirectory(const std::string &commandLine, std::uint16_t statusCode) {
+
+        if (commandLine.compare(0, 4, "CWD ") == 0) {
+            if (statusCode == 250) {
+                m_workingDirectory = commandLine.substr(4);
+            } else if ((statusCode / 100) != 5) {
+                m_workingDirectory.clear();
+            }
+        } else if (commandLine.compare(0, 4, "CDUP") == 0) {
+            m_workingDirectory.clear();
+        }
+
+    }
+
+    //
+    // Return true if server supports MODE Z and compression has been requested.
+    //
+
+    bool CSession::isCompressionSupported(void) const {
+        return (m_compressionSupported);
+    }
+
+    //
+    // Set whether following full file transfers are to be compressed (if supported).
+    //
+
+    void CSession::setCompression(bool compress) {
+        m_compressTransfer = compress && m_compressionSupported;
+    }
+
+    //
+    // Return statistics for last file transfer.
+    //
+
+    TransferStats CSession::getTransferStats(void) const {
+        return (m_transferStats);
+    }
+
+    //
+    // Return total file bytes transferred over session (all transfers).
+    //
+
+    std::uint64_t CSession::getBytesTransferred(void) const {
+        return (m_bytesTransferred);
+    }
+
+    //
+    // Return TLS handshake statistics (all sessions).
+    //
+
+    CSession::TLSStatistics CSession::getTLSStatistics(void) {
+
+        std::lock_guard<std::mutex> cacheLock(tlsSessionCache.cacheMutex);
+
+        return (tlsSessionCache.statistics);
+
+    }
+
+    //
+    // Free cached TLS sessions (all sessions); later connections do full handshakes.
+    //
+
+    void CSession::clearTLSSessionCache(void) {
+
+        std::lock_guard<std::mutex> cacheLock(tlsSessionCache.cacheMutex);
+
+        for (auto &session : tlsSessionCache.sessions) {
+            SSL_SESSION_free(session.second);
+        }
+
+        tlsSessionCache.sessions.clear();
+
+    }
+
+    //
+    // Return a reference to the cached TLS session for options (nullptr if none) so that
+    // connections made outside CSession can resume it; the caller frees it.
+    //
+
+    SSL_SESSION *CSession::getCachedTLSSession(const EscapementOptions &optionData) {
+
+        std::lock_guard<std::mutex> cacheLock(tlsSessionCache.cacheMutex);
+
+        auto session = tlsSessionCache.sessions.find(sessionCacheKey(optionData));
+        if ((session != tlsSessionCache.sessions.end()) && SSL_SESSION_up_ref(session->second)) {
+            return (session->second);
+        }
+
+        return (nullptr);
+
+    }
+
+    //
+    // Return true if server supports SHA-256 HASH (and append uploads requested).
+    //
+
+    bool CSession::isHashSupported(void) const {
+        return (m_hashSupported);
+    }
+
+    //
+    // Return true if server supports setting file modified times (MFMT).
+    //
+
+    bool CSession::isModifyTimeSupported(void) const {
+        return (m_modifyTimeSupported);
+    }
+
+    //
+    // Set last modified time (YYYYMMDDHHMMSS UTC) of a remote file with MFMT. Returns the
+    // MFMT reply status code (213 on success).
+    //
+
+    std::uint16_t CSession::setModifiedTime(const std::string &remoteFilePath, const std::string &modified) {
+
+        return (command("MFMT " + modified + " " + remoteFilePath));
+
+    }
+
+    //
+    // Return true if a download of fileSize bytes should bypass the page cache (O_DIRECT).
+    //
+
+    bool CSession::isDirectIOSize(std::uint64_t fileSize) const {
+        return ((m_directIOSize != 0) && (fileSize >= m_directIOSize));
+    }
+
+    //
+    // Get SHA-256 hash (hex) of bytes start up to (not including) end of a remote file
+    // using RANG/HASH. Returns the HASH reply status code (213 on success).
+    //
+
+    std::uint16_t CSession::getFileHash(const std::string &remoteFilePath, std::uint64_t start, std::uint64_t end, std::string &fileHash) {
+
+        if ((end <= start) || (command("RANG " + std::to_string(start) + " " + std::to_string(end - 1)) != 350)) {
+            return (m_commandStatusCode);
+        }
+
+        if (command("HASH " + remoteFilePath) == 213) {
+
+            // Reply is "213 <algorithm> <start>-<end> <hash> <file>"
+
+            std::istringstream hashReply { m_commandResponse.substr(4) };
+            std::string algorithm, range;
+            hashReply >> algorithm >> range >> fileHash;
+            if ((algorithm != "SHA-256") || (range != (std::to_string(start) + "-" + std::to_string(end - 1)))) {
+                fileHash.clear();
+                return (0);
+            }
+            std::transform(fileHash.begin(), fileHash.end(), fileHash.begin(), [] (unsigned char c) {
+                return (std::tolower(c));
+            });
+
+        }
+
+        return (m_commandStatusCode);
+
+    }
+
+    //
+    // Get size of remote file.
+    //
+
+    std::uint16_t CSession::getFileSize(const std::string &remoteFilePath, std::uint64_t &fileSize) {
+
+        if (command("SIZE " + remoteFilePath) == 213) {
+            fileSize = std::stoull(m_commandResponse.substr(4));
+        }
+
+        return (m_commandStatusCode);
+
+    }
+
+    //
+    // Rename remote file.
+    //
+
+    std::uint16_t CSession::renameFile(const std::string &sourcePath, const std::string &destinationPath) {
+
+        if (command("RNFR " + sourcePath) == 350) {
+            command("RNTO " + destinationPath);
+        }
+
+        return (m_commandStatusCode);
+
+    }
+
+    //
+    // Get machine readable (MLSD) or, if not asked for, long (LIST) listing of a remote
+    // directory. Returns the final reply status code (226/250 on success).
+    //
+
+    std::uint16_t CSession::listDirectory(const std::string &remotePath, std::string &listing, bool machineReadable) {
+
+        Channel dataChannel;
+        char listBuffer[kListBufferSize];
+
+        listing.clear();
+
+        selectTransferMode(false);
+
+        if (!openTransfer(((machineReadable) ? "MLSD " : "LIST ") + remotePath, dataChannel)) {
+            return (m_commandStatusCode);
+        }
+
+        try {
+            ssize_t bytesRead;
+            while ((bytesRead = readChannel(dataChannel, listBuffer, sizeof (listBuffer))) > 0) {
+                listing.append(listBuffer, bytesRead);
+            }
+        } catch (...) {
+            closeChannel(dataChannel, false);
+            throw;
+        }
+
+        return (completeTransfer(dataChannel, true));
+
+    }
+
+    //
+    // Download remote file from offset to its end writing it at the same offset in
+    // local file. Returns the final reply status code (226/250 on success).
+    //
+
+    std::uint16_t CSession::getFile(const std::string &remoteFilePath, int localFile, std::uint64_t offset, ProgressFn progressFn) {
+
+        Channel dataChannel;
+        std::uint64_t bytesTransferred { 0 };
+        bool endOfFile { false };
+        bool compressed = selectTransferMode(offset == 0);
+        auto startTime = std::chrono::steady_clock::now();
+
+        if ((offset != 0) && (command("REST " + std::to_string(offset)) != 350)) {
+            throw Exception("Server does not support restart [" + m_commandResponse + "]");
+        }
+
+        if (!openTransfer("RETR " + remoteFilePath, dataChannel)) {
+            return (m_commandStatusCode);
+        }
+
+        try {
+            if (compressed) {
+                bytesTransferred = receiveCompressedData(dataChannel, localFile, progressFn);
+            } else {
+                bytesTransferred = receiveData(dataChannel, localFile, offset, std::numeric_limits<std::uint64_t>::max(), endOfFile, progressFn);
+                m_transferStats.wireBytes = bytesTransferred;
+            }
+        } catch (...) {
+            closeChannel(dataChannel, false);
+            throw;
+        }
+
+        std::uint16_t statusCode = completeTransfer(dataChannel, true);
+
+        completeTransferStats(startTime, bytesTransferred, statusCode);
+
+        return (statusCode);
+
+    }
+
+    //
+    // Download length bytes of a remote file starting at offset and write them at the
+    // same offset in local file. If the server has more data than requested the data
+    // connection is reset which ends the transfer. Returns the number of bytes written.
+    //
+
+    std::uint64_t CSession::getFileRange(const std::string &remoteFilePath, int localFile, std::uint64_t offset, std::uint64_t length, ProgressFn progressFn) {
+
+        Channel dataChannel;
+        std::uint64_t bytesTransferred { 0 };
+        bool endOfFile { false };
+
+        selectTransferMode(false);
+
+        if ((offset != 0) && (command("REST " + std::to_string(offset)) != 350)) {
+            throw Exception("Server does not support restart [" + m_commandResponse + "]");
+        }
+
+        if (!openTransfer("RETR " + remoteFilePath, dataChannel)) {
+            return (0);
+        }
+
+        try {
+
+            bytesTransferred = receiveData(dataChannel, localFile, offset, length, endOfFile, progressFn);
+            m_bytesTransferred += bytesTransferred;
+
+            // Range complete; see if server has reached end of file too
+
+            if (!endOfFile) {
+                char endBuffer[1];
+                endOfFile = (readChannel(dataChannel, endBuffer, sizeof (endBuffer)) == 0);
+            }
+
+        } catch (...) {
+            closeChannel(dataChannel, false);
+            throw;
+        }
+
+        std::uint16_t statusCode = completeTransfer(dataChannel, endOfFile);
+
+        if (endOfFile && (statusCode != 226) && (statusCode != 250)) {
+            return (0);
+        }
+
+        return (bytesTransferred);
+
+    }
+
+    //
+    // Upload local file from offset to its end. The upload is either appended to the
+    // remote file (APPE) or restarted at offset (REST/STOR); if the server refuses REST
+    // the upload is appended instead, so for a non-zero offset the remote file must hold
+    // exactly offset bytes. Returns the final reply status code (226/250 on success).
+    //
+
+    std::uint16_t CSession::putFile(const std::string &remoteFilePath, int localFile, std::uint64_t offset, bool append, ProgressFn progressFn) {
+
+        Channel dataChannel;
+        std::uint64_t bytesTransferred { 0 };
+        bool compressed = selectTransferMode(!append && (offset == 0));
+        auto startTime = std::chrono::steady_clock::now();
+
+        if (!append && (offset != 0) && (command("REST " + std::to_string(offset)) != 350)) {
+            append = true;
+        }
+
+        if (!openTransfer(((append) ? "APPE " : "STOR ") + remoteFilePath, dataChannel)) {
+            return (m_commandStatusCode);
+        }
+
+        try {
+            if (compressed) {
+                bytesTransferred = sendCompressedData(dataChannel, localFile, progressFn);
+            } else {
+                bytesTransferred = sendData(dataChannel, localFile, offset, progressFn);
+                m_transferStats.wireBytes = bytesTransferred;
+            }
+        } catch (...) {
+            closeChannel(dataChannel, false);
+            throw;
+        }
+
+        std::uint16_t statusCode = completeTransfer(dataChannel, true);
+
+        completeTransferStats(startTime, bytesTransferred, statusCode);
+
+        return (statusCode);
+
+    }
+
+} // namespace Escapement_Session
@@ -0,0 +1,171 @@
+#ifndef ESCAPEMENT_SESSION_HPP
+#define ESCAPEMENT_SESSION_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <chrono>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+#include "Escapement_Compress.hpp"
+
+//
+// OpenSSL
+//
+
+#include <openssl/ssl.h>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Session {
+
+    //
+    // Minimal FTP session used for file transfers where Antik CFTP does not provide
+    // what is needed (restarted/byte range transfers, zero copy uploads, MODE Z). Always
+    // binary and passive.
+    //
+
+    class CSession {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CSession Failure: " + message) {
+            }
+
+        };
+
+        //
+        // Transfer progress callback (passed total bytes transferred so far)
+        //
+
+        typedef std::function<void(std::uint64_t)> ProgressFn;
+
+        //
+        // TLS handshake statistics
+        //
+
+        struct TLSStatistics {
+            std::uint64_t handshakes { 0 };     // TLS handshakes performed
+            std::uint64_t resumed { 0 };        // Handshakes that resumed a session
+        };
+
+        CSession();
+        virtual ~CSession();
+
+        CSession(const CSession &orig) = delete;
+        CSession(const CSession &&orig) = delete;
+        CSession& operator=(CSession other) = delete;
+
+        void connect(const Escapement::EscapementOptions &optionData);
+        void disconnect(void);
+        void close(void);
+        bool isConnected(void) const;
+        std::string getWorkingDirectory(void) const;
+        void discardNextDataChannel(void);
+
+        std::uint16_t command(const std::string &commandLine);
+        std::vector<std::uint16_t> commandPipeline(const std::vector<std::string> &commandLines);
+        std::string getCommandResponse(void) const;
+
+        bool isCompressionSupported(void) const;
+        void setCompression(bool compress);
+        Escapement_Compress::TransferStats getTransferStats(void) const;
+        std::uint64_t getBytesTransferred(void) const;
+        static TLSStatistics getTLSStatistics(void);
+        static void clearTLSSessionCache(void);
+        static SSL_SESSION *getCachedTLSSession(const Escapement::EscapementOptions &optionData);
+        bool isHashSupported(void) const;
+        bool isDirectIOSize(std::uint64_t fileSize) const;
+        bool isModifyTimeSupported(void) const;
+        std::uint16_t setModifiedTime(const std::string &remoteFilePath, const std::string &modified);
+        std::uint16_t getFileHash(const std::string &remoteFilePath, std::uint64_t start, std::uint64_t end, std::string &fileHash);
+
+        std::uint16_t getFileSize(const std::string &remoteFilePath, std::uint64_t &fileSize);
+        std::uint16_t renameFile(const std::string &sourcePath, const std::string &destinationPath);
+        std::uint16_t listDirectory(const std::string &remotePath, std::string &listing, bool machineReadable = true);
+        std::uint16_t getFile(const std::string &remoteFilePath, int localFile, std::uint64_t offset = 0, ProgressFn progressFn = nullptr);
+        std::uint64_t getFileRange(const std::string &remoteFilePath, int localFile, std::uint64_t offset, std::uint64_t length, ProgressFn progressFn = nullptr);
+        std::uint16_t putFile(const std::string &remoteFilePath, int localFile, std::uint64_t offset = 0, bool append = false, ProgressFn progressFn = nullptr);
+
+    private:
+
+        //
+        // Control/data connection socket and any TLS layered on top of it
+        //
+
+        struct Channel {
+            int socket { -1 };
+            SSL *ssl { nullptr };
+        };
+
+        void openSocket(Channel &channel, const std::string &host, const std::string &port, bool nonBlocking = false);
+        bool waitForConnect(Channel &channel);
+        void startTLS(Channel &channel, SSL_SESSION *session = nullptr);
+        void cacheTLSSession(void);
+        void closeChannel(Channel &channel, bool graceful);
+        ssize_t readChannel(Channel &channel, void *buffer, size_t length);
+        void writeChannel(Channel &channel, const void *buffer, size_t length);
+
+        std::uint16_t readReply(void);
+        void trackWorkingDirectory(const std::string &commandLine, std::uint16_t statusCode);
+        std::string passiveDataPort(std::uint16_t statusCode) const;
+        void openDataChannel(Channel &dataChannel);
+        void requestNextDataChannel(void);
+        void collectNextDataChannel(void);
+        std::uint16_t completeTransfer(Channel &dataChannel, bool graceful);
+        bool openTransfer(const std::string &commandLine, Channel &dataChannel);
+        std::uint64_t receiveData(Channel &dataChannel, int localFile, std::uint64_t offset, std::uint64_t length, bool &endOfFile, ProgressFn progressFn);
+        std::uint64_t sendData(Channel &dataChannel, int localFile, std::uint64_t offset, ProgressFn progressFn);
+        std::uint64_t receiveCompressedData(Channel &dataChannel, int localFile, ProgressFn progressFn);
+        std::uint64_t sendCompressedData(Channel &dataChannel, int localFile, ProgressFn progressFn);
+        bool selectTransferMode(bool compressible);
+        void completeTransferStats(std::chrono::steady_clock::time_point startTime, std::uint64_t fileBytes, std::uint16_t statusCode);
+
+        Channel m_control;                  // Control connection
+        Channel m_nextDataChannel;          // Data connection negotiated for next transfer
+        bool m_nextDataChannelPending { false }; // == true reply negotiating next data connection not yet read
+        std::string m_passiveCommand { "EPSV" }; // Passive mode command (EPSV or PASV)
+        SSL_CTX *m_sslContext { nullptr };  // TLS context (nullptr if not SSL)
+        size_t m_ioBufferSize { Escapement::kDefaultIOBufferSize }; // Transfer buffer size
+        std::uint64_t m_directIOSize { Escapement::kDefaultDirectIOSize }; // Direct I/O download threshold (0 == off)
+        std::string m_serverName;           // Server name
+        std::string m_sessionCacheKey;      // TLS session cache key (user@server:port)
+        std::string m_serverAddress;        // Server numeric address (for data connections)
+        std::string m_replyBuffer;          // Unprocessed control connection input
+        std::string m_commandResponse;      // Last command response
+        std::string m_workingDirectory;     // Working directory ("" if not known)
+        std::uint16_t m_commandStatusCode { 0 }; // Last command status code
+        bool m_compressionSupported { false };  // == true server supports MODE Z (and compression requested)
+        bool m_compressTransfer { false };      // == true compress next full file transfer
+        bool m_modeZ { false };                 // == true server currently in MODE Z
+        int m_serverCompressionLevel { 0 };     // Compression level last sent to server
+        bool m_hashSupported { false };         // == true server supports SHA-256 HASH (and append uploads requested)
+        bool m_modifyTimeSupported { false };   // == true server supports MFMT
+        Escapement_Compress::CompressionControl m_compressionControl; // Compression level control
+        Escapement_Compress::TransferStats m_transferStats;           // Last transfer statistics
+        std::uint64_t m_bytesTransferred { 0 };                       // File bytes transferred over session
+
+    };
+
+} // namespace Escapement_Session
+
+#endif /* ESCAPEMENT_SESSION_HPP */
+
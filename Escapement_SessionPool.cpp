@@ -0,0 +1,637 @@
+//
+// Module: Escapement_SessionPool
+//
+// Description: Process wide pool of logged in transfer sessions (CSession) shared by
+// every transfer, delete and segment lane (and in daemon mode every job). A lane takes
+// an idle session for its server if there is one (so avoiding a new connection, login
+// and TLS handshake) and hands it back when done; sessions left idle too long are logged
+// out. The number of sessions per server can be capped (optionData.serverConnections),
+// in which case they are shared between jobs by weighted fair queuing: each job is
+// charged the bytes it moves (plus a fixed amount per item) over its priority and a
+// session goes to the waiting job charged least, except that jobs holding fewer than
+// their minimum are served first and none may hold more than its maximum. Lanes
+// checkpoint between files, so a job with a large backlog gives sessions up as soon as
+// another job is due them rather than once its whole queue has drained. Connections
+// made outside the pool (by the asynchronous engine) reserve places in it so that they
+// are held to the same limits.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+
+//
+// Escapement session pool
+//
+
+#include "Escapement_SessionPool.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_SessionPool {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+    using namespace Escapement_Session;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Time a session may sit idle in the pool before it is logged out
+    //
+
+    static const std::chrono::seconds kSessionIdleTimeout { 60 };
+
+    //
+    // Bytes charged to a job for each item of work done over a session on top of the
+    // bytes transferred (so that a queue of small files counts for its requests too)
+    //
+
+    static const std::uint64_t kItemCharge { 64 * 1024 };
+
+    //
+    // Idle session and when it was handed back
+    //
+
+    struct IdleSession {
+        std::unique_ptr<CSession> ftpSession;               // Logged in session
+        std::chrono::steady_clock::time_point idleSince;    // Time handed back
+    };
+
+    //
+    // Sessions for one server (and set of session options)
+    //
+
+    struct ServerSessions {
+        std::vector<IdleSession> idleSessions;                  // Sessions available for reuse
+        int sessionCount { 0 };                                 // Sessions open (idle or in use)
+        JobShares jobShares;                                    // Shares by job name
+    };
+
+    //
+    // Session pool (idle sessions logged out by closeIdleSessions() before exit)
+    //
+
+    static struct SessionPool {
+        std::unordered_map<std::string, ServerSessions> servers; // Sessions by pool key
+        std::mutex poolMutex;                                     // Pool access mutex
+        std::condition_variable sessionReleased;                  // Session handed back/closed
+    } sessionPool;
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Return pool key for options (sessions are only shared between users of the same
+    // server, account and session settings)
+    //
+
+    static std::string poolKey(const EscapementOptions &optionData) {
+
+        return (optionData.userName + "@" + optionData.serverName + ":" + optionData.serverPort + "/" +
+                std::to_string(optionData.noSSL) + std::to_string(optionData.noVerify) + std::to_string(optionData.compress) + std::to_string(optionData.appendUploads) + "/" +
+                std::to_string(optionData.ioBufferSize) + "/" + std::to_string(optionData.directIOSize));
+
+    }
+
+    //
+    // Return job's share of server (its settings taken from the job's options)
+    //
+
+    static JobShare &jobShareOf(ServerSessions &server, const EscapementOptions &optionData) {
+
+        JobShare &job { server.jobShares[optionData.jobName] };
+
+        job.weight = std::max(optionData.jobPriority, 1);
+        job.minSessions = optionData.minConnections;
+        job.maxSessions = optionData.maxConnections;
+
+        return (job);
+
+    }
+
+    //
+    // Return true if job may take another session
+    //
+
+    static bool isJobEligible(const JobShare &job) {
+
+        return ((job.maxSessions == 0) || (job.activeSessions < job.maxSessions));
+
+    }
+
+    //
+    // Return true if no other waiting job is served before job (holding jobSessions)
+    //
+
+    static bool isJobDue(const JobShares &jobShares, const JobShare &job, int jobSessions) {
+
+        for (auto &otherJob : jobShares) {
+            if ((&otherJob.second != &job) && (otherJob.second.waitingLanes != 0) && isJobEligible(otherJob.second) &&
+                isServedBefore(otherJob.second, otherJob.second.activeSessions, job, jobSessions)) {
+                return (false);
+            }
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Return true if server has a session free (an idle one or room for a new one)
+    //
+
+    static bool isSessionFree(const ServerSessions &server, const EscapementOptions &optionData) {
+
+        return (!server.idleSessions.empty() || (optionData.serverConnections == 0) ||
+                (server.sessionCount < optionData.serverConnections));
+
+    }
+
+    //
+    // Remove sessions idle for too long from server (they are logged out by the caller
+    // once the pool is unlocked).
+    //
+
+    static void expireIdleSessions(ServerSessions &server, std::vector<std::unique_ptr<CSession>> &expiredSessions) {
+
+        auto now = std::chrono::steady_clock::now();
+
+        for (auto idleSession = server.idleSessions.begin(); idleSession != server.idleSessions.end();) {
+            if ((now - idleSession->idleSince) >= kSessionIdleTimeout) {
+                expiredSessions.push_back(std::move(idleSession->ftpSession));
+                idleSession = server.idleSessions.erase(idleSession);
+                server.sessionCount--;
+            } else {
+                idleSession++;
+            }
+        }
+
+    }
+
+    //
+    // Log out expired sessions.
+    //
+
+    static void closeExpiredSessions(std::vector<std::unique_ptr<CSession>> &expiredSessions) {
+
+        for (auto &ftpSession : expiredSessions) {
+            ftpSession->disconnect();
+        }
+
+        expiredSessions.clear();
+
+    }
+
+    //
+    // Wait (pool locked) until job is due a session and one is free: an idle session is
+    // returned or, if the server is below its session limit, nullptr for a new one to be
+    // connected.
+    //
+
+    static std::unique_ptr<CSession> waitForSession(std::unique_lock<std::mutex> &poolLock, ServerSessions &server, JobShare &job,
+            const EscapementOptions &optionData, std::vector<std::unique_ptr<CSession>> &expiredSessions) {
+
+        std::unique_ptr<CSession> ftpSession;
+
+        queueForSession(server.jobShares, job);
+
+        for (;;) {
+            expireIdleSessions(server, expiredSessions);
+            if (isSessionDue(server.jobShares, job, isSessionFree(server, optionData))) {
+                break;
+            }
+            sessionPool.sessionReleased.wait_for(poolLock, kSessionIdleTimeout);
+        }
+
+        grantSession(job);
+
+        if (!server.idleSessions.empty()) {
+            ftpSession = std::move(server.idleSessions.back().ftpSession);
+            server.idleSessions.pop_back();
+        } else {
+            server.sessionCount++;
+        }
+
+        sessionPool.sessionReleased.notify_all();
+
+        return (ftpSession);
+
+    }
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Make session granted by the pool ready for use. A pooled session is only changed
+    // to the remote directory if it is not known to be there already (one shared with a
+    // job in another directory) and is reconnected if that fails or it has been closed;
+    // a new one is connected. On failure the session's place is given up and
+    // CSession::Exception thrown.
+    //
+
+    void CPooledSession::readySession(void) {
+
+        try {
+            if (m_session) {
+                if (m_session->isConnected() && (m_session->getWorkingDirectory() != m_optionData.remoteDirectory)) {
+                    try {
+                        if (m_session->command("CWD " + m_optionData.remoteDirectory) != 250) {
+                            m_session->close();
+                        }
+                    } catch (const CSession::Exception &e) {
+                        m_session->close();
+                    }
+                }
+                if (!m_session->isConnected()) {
+                    m_session->close();
+                    m_session->connect(m_optionData);
+                }
+            } else {
+                m_session.reset(new CSession());
+                m_session->connect(m_optionData);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            jobShareOf(server, m_optionData).activeSessions--;
+            server.sessionCount--;
+            m_session.reset();
+            sessionPool.sessionReleased.notify_all();
+            throw;
+        }
+
+        m_bytesCharged = m_session->getBytesTransferred();
+
+    }
+
+    //
+    // Drop any data connection the session negotiated for a next transfer before it goes
+    // back to the pool (the server may time it out while the session is idle). A session
+    // that fails doing so is closed.
+    //
+
+    void CPooledSession::releaseDataChannel(void) {
+
+        try {
+            m_session->discardNextDataChannel();
+        } catch (const std::exception &e) {
+            m_session->close();
+        }
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Take session from pool (waiting for the job's turn if sessions are limited). If not
+    // waitForTurn and the job cannot have a session straight away none is taken (see
+    // isTaken()); used for extra sessions a lane only wants if they are going spare.
+    //
+
+    CPooledSession::CPooledSession(const EscapementOptions &optionData, bool waitForTurn) : m_optionData(optionData) {
+
+        std::vector<std::unique_ptr<CSession>> expiredSessions;
+
+        {
+            std::unique_lock<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            JobShare &job { jobShareOf(server, m_optionData) };
+            expireIdleSessions(server, expiredSessions);
+            if (waitForTurn || isSessionDue(server.jobShares, job, isSessionFree(server, m_optionData))) {
+                m_session = waitForSession(poolLock, server, job, m_optionData, expiredSessions);
+                m_taken = true;
+            }
+        }
+
+        closeExpiredSessions(expiredSessions);
+
+        if (!m_taken) {
+            return;
+        }
+
+        readySession();
+
+        m_uncaughtExceptions = std::uncaught_exceptions();
+
+    }
+
+    //
+    // Hand session back to pool (closing it first if an exception is unwinding). A
+    // session that is no longer connected is dropped, freeing its place for another.
+    //
+
+    CPooledSession::~CPooledSession() {
+
+        std::vector<std::unique_ptr<CSession>> expiredSessions;
+
+        if (!m_session) {
+            return;
+        }
+
+        if (std::uncaught_exceptions() > m_uncaughtExceptions) {
+            m_session->close();
+        } else {
+            releaseDataChannel();
+        }
+
+        {
+            std::lock_guard<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            JobShare &job { jobShareOf(server, m_optionData) };
+            chargeJob(job, m_session->getBytesTransferred() - m_bytesCharged);
+            job.activeSessions--;
+            if (m_session->isConnected()) {
+                server.idleSessions.push_back({ std::move(m_session), std::chrono::steady_clock::now() });
+            } else {
+                server.sessionCount--;
+            }
+            expireIdleSessions(server, expiredSessions);
+        }
+
+        sessionPool.sessionReleased.notify_all();
+
+        closeExpiredSessions(expiredSessions);
+
+    }
+
+    //
+    // Charge the job for work done since the last checkpoint and, if another waiting job
+    // is now due ahead of it, pass the session on and wait for the job's next turn. With
+    // no server connection limit nothing waits on a session, so it is never passed on. A
+    // session that cannot then be readied throws CSession::Exception (and is given up).
+    //
+
+    void CPooledSession::checkpoint(void) {
+
+        std::vector<std::unique_ptr<CSession>> expiredSessions;
+
+        {
+            std::unique_lock<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            JobShare &job { jobShareOf(server, m_optionData) };
+
+            chargeJob(job, m_session->getBytesTransferred() - m_bytesCharged);
+            m_bytesCharged = m_session->getBytesTransferred();
+
+            if ((m_optionData.serverConnections == 0) || !m_session->isConnected() ||
+                !isHandoffDue(server.jobShares, job)) {
+                return;
+            }
+        }
+
+        releaseDataChannel();
+
+        if (!m_session->isConnected()) {
+            return;
+        }
+
+        {
+            std::unique_lock<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            JobShare &job { jobShareOf(server, m_optionData) };
+
+            job.activeSessions--;
+            server.idleSessions.push_back({ std::move(m_session), std::chrono::steady_clock::now() });
+            sessionPool.sessionReleased.notify_all();
+
+            m_session = waitForSession(poolLock, server, job, m_optionData, expiredSessions);
+        }
+
+        closeExpiredSessions(expiredSessions);
+
+        readySession();
+
+    }
+
+    //
+    // Return true if a session was taken from the pool.
+    //
+
+    bool CPooledSession::isTaken(void) const {
+        return (m_taken);
+    }
+
+    //
+    // Access pooled session.
+    //
+
+    CSession& CPooledSession::operator*(void) const {
+        return (*m_session);
+    }
+
+    CSession* CPooledSession::operator->(void) const {
+        return (m_session.get());
+    }
+
+    //
+    // Reserve up to sessions places in the pool (at least one).
+    //
+
+    CReservedSessions::CReservedSessions(const EscapementOptions &optionData, int sessions) : m_optionData(optionData) {
+
+        std::vector<std::unique_ptr<CSession>> expiredSessions;
+
+        {
+            std::unique_lock<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            JobShare &job { jobShareOf(server, m_optionData) };
+            expireIdleSessions(server, expiredSessions);
+            do {
+                std::unique_ptr<CSession> ftpSession { waitForSession(poolLock, server, job, m_optionData, expiredSessions) };
+                if (ftpSession) {
+                    m_heldSessions.push_back(std::move(ftpSession));
+                }
+                m_count++;
+            } while ((m_count < sessions) && isSessionDue(server.jobShares, job, isSessionFree(server, m_optionData)));
+        }
+
+        closeExpiredSessions(expiredSessions);
+
+    }
+
+    //
+    // Give reserved places back to the pool along with any idle sessions held.
+    //
+
+    CReservedSessions::~CReservedSessions() {
+
+        std::vector<std::unique_ptr<CSession>> expiredSessions;
+
+        {
+            std::lock_guard<std::mutex> poolLock(sessionPool.poolMutex);
+            ServerSessions &server = sessionPool.servers[poolKey(m_optionData)];
+            JobShare &job { jobShareOf(server, m_optionData) };
+            job.activeSessions -= m_count;
+            server.sessionCount -= m_count - static_cast<int> (m_heldSessions.size());
+            for (auto &ftpSession : m_heldSessions) {
+                server.idleSessions.push_back({ std::move(ftpSession), std::chrono::steady_clock::now() });
+            }
+            expireIdleSessions(server, expiredSessions);
+        }
+
+        sessionPool.sessionReleased.notify_all();
+
+        closeExpiredSessions(expiredSessions);
+
+    }
+
+    //
+    // Return number of places reserved.
+    //
+
+    int CReservedSessions::count(void) const {
+        return (m_count);
+    }
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Return true if job (holding jobSessions) is served before another job (holding
+    // otherSessions). A job below its minimum is served before one that is not; otherwise
+    // the job that has had the least work for its weight goes first.
+    //
+
+    bool isServedBefore(const JobShare &job, int jobSessions, const JobShare &otherJob, int otherSessions) {
+
+        bool belowMinimum { jobSessions < job.minSessions };
+        bool otherBelowMinimum { otherSessions < otherJob.minSessions };
+
+        if (belowMinimum != otherBelowMinimum) {
+            return (belowMinimum);
+        }
+
+        return (job.virtualTime < otherJob.virtualTime);
+
+    }
+
+    //
+    // Queue a lane of job for a session. A job that has been idle starts level with the
+    // least served active job so that it cannot claim the time it was idle as credit.
+    //
+
+    void queueForSession(JobShares &jobShares, JobShare &job) {
+
+        if ((job.activeSessions == 0) && (job.waitingLanes == 0)) {
+            bool activeJobs { false };
+            double leastVirtualTime { 0.0 };
+            for (auto &otherJob : jobShares) {
+                if ((&otherJob.second != &job) && ((otherJob.second.activeSessions != 0) || (otherJob.second.waitingLanes != 0))) {
+                    leastVirtualTime = (activeJobs) ? std::min(leastVirtualTime, otherJob.second.virtualTime) : otherJob.second.virtualTime;
+                    activeJobs = true;
+                }
+            }
+            if (activeJobs) {
+                job.virtualTime = std::max(job.virtualTime, leastVirtualTime);
+            }
+        }
+
+        job.waitingLanes++;
+
+    }
+
+    //
+    // Return true if a queued lane of job may take a session now: one is free (sessionFree),
+    // the job is below its maximum and no other waiting job is served before it.
+    //
+
+    bool isSessionDue(const JobShares &jobShares, const JobShare &job, bool sessionFree) {
+
+        return (sessionFree && isJobEligible(job) && isJobDue(jobShares, job, job.activeSessions));
+
+    }
+
+    //
+    // Give a queued lane of job its session.
+    //
+
+    void grantSession(JobShare &job) {
+
+        job.waitingLanes--;
+        job.activeSessions++;
+
+    }
+
+    //
+    // Return true if a session held by job should be handed to another waiting job that
+    // is now served before it.
+    //
+
+    bool isHandoffDue(const JobShares &jobShares, const JobShare &job) {
+
+        return (!isJobDue(jobShares, job, job.activeSessions - 1));
+
+    }
+
+    //
+    // Charge job for an item of work that transferred bytes.
+    //
+
+    void chargeJob(JobShare &job, std::uint64_t bytes) {
+
+        job.virtualTime += static_cast<double> (bytes + kItemCharge) / job.weight;
+
+    }
+
+    //
+    // Log out and close every idle pooled session. Called before exit so that no session
+    // (and its TLS connection) is left to be torn down during static destruction.
+    //
+
+    void closeIdleSessions(void) {
+
+        std::vector<std::unique_ptr<CSession>> idleSessions;
+
+        {
+            std::lock_guard<std::mutex> poolLock(sessionPool.poolMutex);
+            for (auto &server : sessionPool.servers) {
+                for (auto &idleSession : server.second.idleSessions) {
+                    idleSessions.push_back(std::move(idleSession.ftpSession));
+                }
+                server.second.sessionCount -= static_cast<int> (server.second.idleSessions.size());
+                server.second.idleSessions.clear();
+            }
+        }
+
+        for (auto &idleSession : idleSessions) {
+            try {
+                idleSession->disconnect();
+            } catch (const std::exception &e) {
+                std::cerr << "Escapement error: Could not close pooled session [" << e.what() << "]" << std::endl;
+            }
+        }
+
+    }
+
+} // namespace Escapement_SessionPool
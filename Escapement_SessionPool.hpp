@@ -0,0 +1,121 @@
+#ifndef ESCAPEMENT_SESSIONPOOL_HPP
+#define ESCAPEMENT_SESSIONPOOL_HPP
+
+//
+// C++ STL
+//
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+#include "Escapement_Session.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_SessionPool {
+
+    //
+    // Job's share of a server's sessions
+    //
+
+    struct JobShare {
+        int weight { Escapement::kDefaultJobPriority };         // Share weight (priority)
+        int minSessions { Escapement::kDefaultMinConnections }; // Served first until holding this many
+        int maxSessions { Escapement::kDefaultMaxConnections }; // Most sessions held (0 == no limit)
+        int activeSessions { 0 };                               // Sessions held
+        int waitingLanes { 0 };                                 // Lanes waiting for a session
+        double virtualTime { 0.0 };                             // Work done (bytes) over weight
+    };
+
+    //
+    // Job shares of a server's sessions (indexed by job name)
+    //
+
+    typedef std::unordered_map<std::string, JobShare> JobShares;
+
+    //
+    // Session taken from the pool for the lifetime of the object. It is handed back on
+    // destruction unless an exception is unwinding past it, in which case its state is
+    // unknown and it is closed instead. A holder working through a queue calls
+    // checkpoint() between items so the session can pass to a job that is due it.
+    //
+
+    class CPooledSession {
+    public:
+
+        explicit CPooledSession(const Escapement::EscapementOptions &optionData, bool waitForTurn = true);
+        virtual ~CPooledSession();
+
+        CPooledSession(const CPooledSession &orig) = delete;
+        CPooledSession(const CPooledSession &&orig) = delete;
+        CPooledSession& operator=(CPooledSession other) = delete;
+
+        void checkpoint(void);
+        bool isTaken(void) const;
+
+        Escapement_Session::CSession& operator*(void) const;
+        Escapement_Session::CSession* operator->(void) const;
+
+    private:
+
+        void readySession(void);
+        void releaseDataChannel(void);
+
+        const Escapement::EscapementOptions &m_optionData;      // Session options
+        std::unique_ptr<Escapement_Session::CSession> m_session; // Pooled session
+        std::uint64_t m_bytesCharged { 0 };                     // Session bytes already charged to job
+        int m_uncaughtExceptions { 0 };                         // Exceptions in flight when taken
+        bool m_taken { false };                                 // == true session taken from pool
+
+    };
+
+    //
+    // Places in the pool taken for the lifetime of the object by connections made outside
+    // it (those of the asynchronous engine), so that they count against the server's
+    // session limit and the job's share. At least one place is taken (waiting for the
+    // job's turn if need be) and further ones only while they are going spare; idle
+    // sessions whose places are taken are held and handed back on destruction.
+    //
+
+    class CReservedSessions {
+    public:
+
+        CReservedSessions(const Escapement::EscapementOptions &optionData, int sessions);
+        virtual ~CReservedSessions();
+
+        CReservedSessions(const CReservedSessions &orig) = delete;
+        CReservedSessions(const CReservedSessions &&orig) = delete;
+        CReservedSessions& operator=(CReservedSessions other) = delete;
+
+        int count(void) const;
+
+    private:
+
+        const Escapement::EscapementOptions &m_optionData;                  // Session options
+        std::vector<std::unique_ptr<Escapement_Session::CSession>> m_heldSessions; // Idle sessions held
+        int m_count { 0 };                                                  // Places taken
+
+    };
+
+    bool isServedBefore(const JobShare &job, int jobSessions, const JobShare &otherJob, int otherSessions);
+    void queueForSession(JobShares &jobShares, JobShare &job);
+    bool isSessionDue(const JobShares &jobShares, const JobShare &job, bool sessionFree);
+    void grantSession(JobShare &job);
+    bool isHandoffDue(const JobShares &jobShares, const JobShare &job);
+    void chargeJob(JobShare &job, std::uint64_t bytes);
+    void closeIdleSessions(void);
+
+} // namespace Escapement_SessionPool
+
+#endif /* ESCAPEMENT_SESSIONPOOL_HPP */
+
@@ -0,0 +1,968 @@
+//
+// Module: Escapement_Transfer
+//
+// Description: Escapement parallel file transfer code. Files to be transferred
+// are placed in a size aware queue that is then drained by one or more transfer
+// lanes, each with a session from the shared session pool. The first lane takes
+// the small files while any extra lanes take the largest files first (longest
+// processing time first); a lane that runs out of its own class of file takes from
+// the other so that no session sits idle before the end of the run. Files are
+// written to a partial (~) file that is renamed into place once complete.
+//
+// Very large downloads may instead be split into byte ranges fetched by the lane's
+// session together with any spare sessions the pool can give it at the time.
+//
+// Large transfers can be journaled so that an interrupted transfer is resumed (using
+// REST or APPE) on the next run instead of being started again.
+//
+// When MODE Z is enabled files judged compressible are transferred compressed and
+// their throughput and compression ratio reported.
+//
+// Files that have only grown since they were last uploaded can have just their new
+// tail appended once the remote copy is verified as a prefix.
+//
+// Downloads are preallocated to their remote size before being written (with
+// O_DIRECT above the direct I/O threshold, so that restoring large files does not
+// evict everything else from the page cache) and once complete are given the remote
+// modified time, so local and remote copies agree without further bookkeeping.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : File I/O (fallocate, O_DIRECT, utimensat).
+// OpenSSL            : SHA-256 fingerprints for append uploads.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cerrno>
+#include <memory>
+#include <sstream>
+#include <iomanip>
+#include <ctime>
+
+//
+// Linux
+//
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//
+// OpenSSL
+//
+
+#include <openssl/evp.h>
+
+//
+// Escapement transfer
+//
+
+#include "Escapement_Transfer.hpp"
+#include "Escapement_SessionPool.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Transfer {
+
+    // =======
+    // IMPORTS
+    // =======
+
+    using namespace Escapement;
+    using namespace Escapement_Session;
+    using namespace Escapement_SessionPool;
+    using namespace Escapement_Journal;
+    using namespace Escapement_Compress;
+
+    using namespace Antik;
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Postfix of file while a segmented or resumable transfer is in progress
+    //
+
+    static const char *kPartialPostfix { "~" };
+
+    //
+    // Bytes transferred between journal checkpoints
+    //
+
+    static const std::uint64_t kJournalCheckpoint { 64 * 1024 * 1024 };
+
+    //
+    // Read buffer size used when hashing local files
+    //
+
+    static const size_t kHashBufferSize { 1024 * 1024 };
+
+    //
+    // Byte range of a segmented download, the bytes fetched of it and how many of those
+    // are synced to disk and journaled
+    //
+
+    struct DownloadSegment {
+        std::uint64_t offset { 0 };         // Start of range in file
+        std::uint64_t length { 0 };         // Range length
+        std::uint64_t transferred { 0 };    // Bytes fetched
+        std::uint64_t confirmed { 0 };      // Bytes fetched, synced and journaled
+    };
+
+    //
+    // Segmented download shared by the sessions fetching its ranges
+    //
+
+    struct SegmentedDownload {
+        std::string remoteFile;                     // Remote file
+        int localFile { -1 };                       // Local (partial) file
+        std::vector<DownloadSegment> segments;      // Ranges
+        size_t nextSegment { 0 };                   // Next range to start
+        TransferJournal *transferJournal { nullptr }; // Transfer journal
+        JournalEntry journalEntry;                  // Journal entry (confirmed bytes per range)
+        std::mutex segmentMutex;                    // Range/journal entry access mutex
+    };
+
+    //
+    // Message digest context
+    //
+
+    typedef std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> DigestContext;
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    //
+    // Sync a segmented download to disk and journal a range as confirmed up to confirmed bytes.
+    //
+
+    static void confirmSegment(SegmentedDownload &download, DownloadSegment &segment, std::uint64_t confirmed) {
+
+        fdatasync(download.localFile);
+
+        std::lock_guard<std::mutex> segmentLock(download.segmentMutex);
+        segment.confirmed = confirmed;
+        download.journalEntry.segments[&segment - download.segments.data()] = confirmed;
+        updateJournalEntry(*download.transferJournal, download.journalEntry);
+
+    }
+
+    //
+    // Fetch ranges of a segmented download over a session until none are left to start
+    // (or the server will not give one whole). A range resumes from its confirmed bytes
+    // and is confirmed every kJournalCheckpoint bytes and once complete.
+    //
+
+    static void downloadSegments(CSession &ftpSession, SegmentedDownload &download) {
+
+        for (;;) {
+            DownloadSegment *segment;
+            {
+                std::lock_guard<std::mutex> segmentLock(download.segmentMutex);
+                while ((download.nextSegment < download.segments.size()) &&
+                       (download.segments[download.nextSegment].transferred == download.segments[download.nextSegment].length)) {
+                    download.nextSegment++;
+                }
+                if (download.nextSegment == download.segments.size()) {
+                    return;
+                }
+                segment = &download.segments[download.nextSegment++];
+            }
+            std::uint64_t start { segment->transferred };
+            segment->transferred += ftpSession.getFileRange(download.remoteFile, download.localFile, segment->offset + start, segment->length - start,
+                    [&download, segment, start] (std::uint64_t bytesTransferred) {
+                        if ((start + bytesTransferred - segment->confirmed) >= kJournalCheckpoint) {
+                            confirmSegment(download, *segment, start + bytesTransferred);
+                        }
+                    });
+            if (segment->transferred != segment->length) {
+                return;
+            }
+            confirmSegment(download, *segment, segment->length);
+        }
+
+    }
+
+    //
+    // Switch a local file being downloaded to direct I/O (O_DIRECT) if it is large enough.
+    // Where the file system does not support it the file is left as is.
+    //
+
+    static void setDirectIO(const CSession &ftpSession, int localFile, std::int64_t fileSize) {
+        if ((fileSize != kUnknownFileSize) && ftpSession.isDirectIOSize(fileSize)) {
+            fcntl(localFile, F_SETFL, fcntl(localFile, F_GETFL) | O_DIRECT);
+        }
+    }
+
+    //
+    // Reserve space for a download from offset to the remote file size so that it is laid
+    // out contiguously. The file size is left unchanged (a short transfer stays short) and
+    // file systems that cannot preallocate are ignored.
+    //
+
+    static void preallocateFile(int localFile, std::uint64_t offset, std::int64_t fileSize) {
+        if ((fileSize != kUnknownFileSize) && (static_cast<std::uint64_t> (fileSize) > offset)) {
+            fallocate(localFile, FALLOC_FL_KEEP_SIZE, offset, fileSize - offset);
+        }
+    }
+
+    //
+    // Set last modified time of a downloaded file to that of the remote file (UTC).
+    //
+
+    static void setModifiedTime(const std::string &localFile, const FTP::CFTP::DateTime &modified) {
+
+        std::tm dateTime {};
+        std::string modifiedString { static_cast<std::string> (modified) };
+
+        if (strptime(modifiedString.c_str(), "%Y%m%d%H%M%S", &dateTime) != nullptr) {
+            struct timespec fileTimes[2] { { 0, UTIME_OMIT }, { timegm(&dateTime), 0 } };
+            if (utimensat(AT_FDCWD, localFile.c_str(), fileTimes, 0) != 0) {
+                std::cerr << "Escapement error: Could not set modified time of [" << localFile << "]" << std::endl;
+            }
+        }
+
+    }
+
+    //
+    // Get next file to transfer for a lane. The small file lane takes small files in
+    // order and then the smallest of the large files; large file lanes take the largest
+    // remaining file and then any small files. Returns false when the queue is empty.
+    //
+
+    static bool nextFileToTransfer(TransferQueue &transferQueue, bool smallLane, std::string &file) {
+
+        std::lock_guard<std::mutex> queueLock(transferQueue.queueMutex);
+
+        if (smallLane) {
+            if (!transferQueue.smallFiles.empty()) {
+                file = transferQueue.smallFiles.front();
+                transferQueue.smallFiles.pop_front();
+                return (true);
+            } else if (!transferQueue.largeFiles.empty()) {
+                file = transferQueue.largeFiles.back();
+                transferQueue.largeFiles.pop_back();
+                return (true);
+            }
+        } else {
+            if (!transferQueue.largeFiles.empty()) {
+                file = transferQueue.largeFiles.front();
+                transferQueue.largeFiles.pop_front();
+                return (true);
+            } else if (!transferQueue.smallFiles.empty()) {
+                file = transferQueue.smallFiles.front();
+                transferQueue.smallFiles.pop_front();
+                return (true);
+            }
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Put a file back at the front of its transfer lane.
+    //
+
+    static void requeueFileToTransfer(TransferQueue &transferQueue, bool smallLane, const std::string &file) {
+
+        std::lock_guard<std::mutex> queueLock(transferQueue.queueMutex);
+
+        if (smallLane) {
+            transferQueue.smallFiles.push_front(file);
+        } else {
+            transferQueue.largeFiles.push_front(file);
+        }
+
+    }
+
+    //
+    // Add bytes start up to end of a local file to SHA-256 digest. Returns false on read error.
+    //
+
+    static bool hashFileRange(int localFile, std::uint64_t start, std::uint64_t end, EVP_MD_CTX *digestContext) {
+
+        std::vector<char> hashBuffer(kHashBufferSize);
+
+        while (start < end) {
+            ssize_t bytesRead = pread(localFile, hashBuffer.data(), std::min(static_cast<std::uint64_t> (hashBuffer.size()), end - start), start);
+            if (bytesRead <= 0) {
+                if ((bytesRead == -1) && (errno == EINTR)) {
+                    continue;
+                }
+                return (false);
+            }
+            if (EVP_DigestUpdate(digestContext, hashBuffer.data(), bytesRead) != 1) {
+                return (false);
+            }
+            start += bytesRead;
+        }
+
+        return (true);
+
+    }
+
+    //
+    // Return fingerprint ("size:SHA-256") of data added to digest so far; the digest may
+    // then be added to further. Returns "" on failure.
+    //
+
+    static std::string digestFingerprint(std::uint64_t size, EVP_MD_CTX *digestContext) {
+
+        DigestContext finalContext(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLength { 0 };
+
+        if (!finalContext || (EVP_MD_CTX_copy_ex(finalContext.get(), digestContext) != 1) ||
+            (EVP_DigestFinal_ex(finalContext.get(), digest, &digestLength) != 1)) {
+            return ("");
+        }
+
+        std::ostringstream fingerprint;
+        fingerprint << size << ":" << std::hex << std::setfill('0');
+        for (unsigned int byte = 0; byte < digestLength; byte++) {
+            fingerprint << std::setw(2) << static_cast<int> (digest[byte]);
+        }
+
+        return (fingerprint.str());
+
+    }
+
+    //
+    // Report throughput and compression ratio of a file transfer (when compression enabled).
+    //
+
+    static void reportTransfer(CSession &ftpSession, const std::string &file) {
+
+        static std::mutex reportMutex;
+
+        if (ftpSession.isCompressionSupported()) {
+            std::lock_guard<std::mutex> reportLock(reportMutex);
+            std::cout << transferReport(file, ftpSession.getTransferStats()) << std::endl;
+        }
+
+    }
+
+    //
+    // Drain transfer queue over a pooled session adding any files transferred to success
+    // list. The queue is taken a file at a time with a pool checkpoint before each, so
+    // the session passes to another job when that job is due its share of the server.
+    // A session that fails mid transfer is reconnected; if the server cannot be reached
+    // the file is put back on the queue for another lane and this lane stops.
+    //
+
+    static void transferLane(const EscapementOptions &optionData, TransferQueue &transferQueue, bool smallLane, TransferFn transferFn, FileList &successList, std::mutex &successMutex) {
+
+        std::unique_ptr<CPooledSession> ftpSession;
+        std::string file;
+
+        while (nextFileToTransfer(transferQueue, smallLane, file)) {
+
+            try {
+                if (!ftpSession) {
+                    ftpSession.reset(new CPooledSession(optionData));
+                } else {
+                    ftpSession->checkpoint();
+                    if (!(*ftpSession)->isConnected()) {
+                        (*ftpSession)->connect(optionData);
+                    }
+                }
+            } catch (const std::exception &e) {
+                std::cerr << "Escapement error: Transfer connection failed [" << e.what() << "]" << std::endl;
+                requeueFileToTransfer(transferQueue, smallLane, file);
+                break;
+            }
+
+            try {
+                FileList transferred { transferFn(**ftpSession, { file }) };
+                std::lock_guard<std::mutex> successLock(successMutex);
+                successList.insert(successList.end(), transferred.begin(), transferred.end());
+            } catch (const std::exception &e) {
+                std::cerr << "Escapement error: Transfer of [" << file << "] failed [" << e.what() << "]" << std::endl;
+                (*ftpSession)->close();
+            }
+
+        }
+
+    }
+
+    // ================
+    // PUBLIC FUNCTIONS
+    // ================
+
+    //
+    // Split file list into small and large file lanes using any known file sizes (unknown
+    // sizes are treated as small). Large files are ordered largest first.
+    //
+
+    void buildTransferQueue(const FileList &fileList, const FileInfoMap &fileInfoMap, std::uint64_t smallFileSize, TransferQueue &transferQueue) {
+
+        std::vector<std::pair<std::int64_t, std::string>> largeFiles;
+
+        for (auto &file : fileList) {
+            auto fileInfo = fileInfoMap.find(file);
+            if ((fileInfo != fileInfoMap.end()) && (fileInfo->second.size != kUnknownFileSize) &&
+                (static_cast<std::uint64_t> (fileInfo->second.size) >= smallFileSize)) {
+                largeFiles.emplace_back(fileInfo->second.size, file);
+            } else {
+                transferQueue.smallFiles.push_back(file);
+            }
+        }
+
+        std::stable_sort(largeFiles.begin(), largeFiles.end(),
+                [] (const std::pair<std::int64_t, std::string> &lhs, const std::pair<std::int64_t, std::string> &rhs) { return (lhs.first > rhs.first); });
+
+        for (auto &file : largeFiles) {
+            transferQueue.largeFiles.push_back(file.second);
+        }
+
+    }
+
+    //
+    // Transfer queued files over one small file lane plus (transferConnections - 1) large
+    // file lanes, each with its own session. Returns list of files transferred; running
+    // TLS handshake/resumption totals are reported when SSL is on.
+    //
+
+    FileList transferFiles(const EscapementOptions &optionData, TransferQueue &transferQueue, TransferFn transferFn) {
+
+        FileList successList;
+        std::mutex successMutex;
+        std::vector<std::thread> transferThreads;
+
+        for (int connection = 1; connection < optionData.transferConnections; connection++) {
+            transferThreads.emplace_back(transferLane, std::cref(optionData), std::ref(transferQueue), false,
+                    transferFn, std::ref(successList), std::ref(successMutex));
+        }
+
+        transferLane(optionData, transferQueue, true, transferFn, successList, successMutex);
+
+        for (auto &transferThread : transferThreads) {
+            transferThread.join();
+        }
+
+        if (!optionData.noSSL) {
+            CSession::TLSStatistics tlsStatistics { CSession::getTLSStatistics() };
+            if (tlsStatistics.handshakes != 0) {
+                std::cout << "TLS handshakes [" << tlsStatistics.handshakes << "] resumed [" << tlsStatistics.resumed << "] (";
+                std::cout << (tlsStatistics.resumed * 100 / tlsStatistics.handshakes) << "%)" << std::endl;
+            }
+        }
+
+        return (successList);
+
+    }
+
+    //
+    // Download a file into a partial local file and rename it into place once complete.
+    // The remote file size (if known) decides whether the download bypasses the page cache
+    // and the remote modified time (if known) becomes that of the local file.
+    //
+
+    bool getFile(CSession &ftpSession, const std::string &remoteFile, const std::string &localFile, const FileInfo &remoteFileInfo) {
+
+        std::string partialFile { localFile + kPartialPostfix };
+        std::uint16_t statusCode;
+
+        int partialFileFd = open(partialFile.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+        if (partialFileFd == -1) {
+            std::cerr << "Escapement error: Could not create [" << partialFile << "]" << std::endl;
+            return (false);
+        }
+
+        preallocateFile(partialFileFd, 0, remoteFileInfo.size);
+        setDirectIO(ftpSession, partialFileFd, remoteFileInfo.size);
+
+        try {
+            ftpSession.setCompression(isCompressibleName(remoteFile));
+            statusCode = ftpSession.getFile(remoteFile, partialFileFd);
+        } catch (...) {
+            close(partialFileFd);
+            unlink(partialFile.c_str());
+            throw;
+        }
+
+        close(partialFileFd);
+
+        if (((statusCode == 226) || (statusCode == 250)) && (std::rename(partialFile.c_str(), localFile.c_str()) == 0)) {
+            setModifiedTime(localFile, remoteFileInfo.modified);
+            reportTransfer(ftpSession, remoteFile);
+            return (true);
+        }
+
+        unlink(partialFile.c_str());
+
+        return (false);
+
+    }
+
+    //
+    // Upload a file to a partial remote file and rename it into place once complete.
+    //
+
+    bool putFile(CSession &ftpSession, const std::string &localFile, const std::string &remoteFile) {
+
+        std::string partialFile { remoteFile + kPartialPostfix };
+        std::uint16_t statusCode;
+
+        int localFileFd = open(localFile.c_str(), O_RDONLY | O_CLOEXEC);
+        if (localFileFd == -1) {
+            std::cerr << "Escapement error: Could not open [" << localFile << "]" << std::endl;
+            return (false);
+        }
+
+        try {
+            ftpSession.setCompression(ftpSession.isCompressionSupported() && isCompressibleFile(localFile, localFileFd));
+            statusCode = ftpSession.putFile(partialFile, localFileFd);
+        } catch (...) {
+            close(localFileFd);
+            throw;
+        }
+
+        close(localFileFd);
+
+        if (((statusCode == 226) || (statusCode == 250)) && (ftpSession.renameFile(partialFile, remoteFile) == 250)) {
+            reportTransfer(ftpSession, localFile);
+            return (true);
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Download a file as optionData.downloadSegments byte ranges written into a preallocated
+    // local file. The ranges are fetched with REST/RETR by the lane's own session and by as
+    // many more sessions (up to one per range) as the pool has spare for the job right now;
+    // it is never waited on, so lanes segmenting at once cannot deadlock over the pool. Each
+    // range's progress is journaled, so if the journal holds an entry for the same remote
+    // file (size, modified time and range count unchanged) every range resumes from its
+    // last confirmed (synced to disk) byte. An incomplete download is kept for that unless
+    // there is no journal. The local file only replaces any existing copy once every range
+    // has been fetched whole.
+    //
+
+    bool getFileSegmented(CSession &ftpSession, const EscapementOptions &optionData, TransferJournal &transferJournal,
+            const std::string &remoteFile, const std::string &localFile, const FileInfo &remoteFileInfo) {
+
+        std::uint64_t fileSize { static_cast<std::uint64_t> (remoteFileInfo.size) };
+        std::string segmentedFile { localFile + kPartialPostfix };
+        std::uint64_t segmentLength { (fileSize + optionData.downloadSegments - 1) / optionData.downloadSegments };
+        SegmentedDownload download;
+        std::vector<std::thread> segmentThreads;
+        std::exception_ptr laneError;
+        struct stat fileStat;
+        bool downloadComplete { true };
+
+        int segmentedFileFd = open(segmentedFile.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+        if (segmentedFileFd == -1) {
+            std::cerr << "Escapement error: Could not create [" << segmentedFile << "]" << std::endl;
+            return (false);
+        }
+
+        for (std::uint64_t offset = 0; offset < fileSize; offset += segmentLength) {
+            download.segments.push_back({ offset, std::min(segmentLength, fileSize - offset), 0, 0 });
+        }
+
+        download.remoteFile = remoteFile;
+        download.localFile = segmentedFileFd;
+        download.transferJournal = &transferJournal;
+
+        JournalEntry &journalEntry { download.journalEntry };
+
+        if (findJournalEntry(transferJournal, remoteFile, journalEntry) && (journalEntry.direction == kJournalPull) &&
+            (journalEntry.destination == segmentedFile) && (journalEntry.size == fileSize) &&
+            (journalEntry.modified == static_cast<std::string> (remoteFileInfo.modified)) &&
+            (journalEntry.segments.size() == download.segments.size()) &&
+            (fstat(segmentedFileFd, &fileStat) == 0) && (static_cast<std::uint64_t> (fileStat.st_size) == fileSize)) {
+            std::uint64_t resumedBytes { 0 };
+            for (size_t segment = 0; segment < download.segments.size(); segment++) {
+                DownloadSegment &downloadSegment { download.segments[segment] };
+                downloadSegment.transferred = downloadSegment.confirmed = std::min(journalEntry.segments[segment], downloadSegment.length);
+                resumedBytes += downloadSegment.confirmed;
+            }
+            std::cout << "Resuming segmented pull of [" << remoteFile << "] with " << resumedBytes << " bytes already fetched" << std::endl;
+        } else {
+            if ((ftruncate(segmentedFileFd, 0) != 0) ||
+                ((fallocate(segmentedFileFd, 0, 0, fileSize) != 0) && (ftruncate(segmentedFileFd, fileSize) != 0))) {
+                std::cerr << "Escapement error: Could not allocate [" << segmentedFile << "]" << std::endl;
+                close(segmentedFileFd);
+                return (false);
+            }
+            journalEntry = { remoteFile, segmentedFile, kJournalPull, fileSize, static_cast<std::string> (remoteFileInfo.modified), 0,
+                             std::vector<std::uint64_t>(download.segments.size(), 0) };
+            updateJournalEntry(transferJournal, journalEntry);
+        }
+
+        for (size_t segment = 1; segment < download.segments.size(); segment++) {
+            segmentThreads.emplace_back([&optionData, &download] () {
+                try {
+                    CPooledSession segmentSession { optionData, false };
+                    if (segmentSession.isTaken()) {
+                        downloadSegments(*segmentSession, download);
+                    }
+                } catch (const std::exception &e) {
+                    std::cerr << "Escapement error: Segment of [" << download.remoteFile << "] failed [" << e.what() << "]" << std::endl;
+                }
+            });
+        }
+
+        try {
+            downloadSegments(ftpSession, download);
+        } catch (...) {
+            laneError = std::current_exception();
+        }
+
+        for (auto &segmentThread : segmentThreads) {
+            segmentThread.join();
+        }
+
+        close(segmentedFileFd);
+
+        for (auto &segment : download.segments) {
+            if (segment.transferred != segment.length) {
+                downloadComplete = false;
+            }
+        }
+
+        if (!laneError && downloadComplete && (std::rename(segmentedFile.c_str(), localFile.c_str()) == 0)) {
+            setModifiedTime(localFile, remoteFileInfo.modified);
+            removeJournalEntry(transferJournal, remoteFile);
+            return (true);
+        }
+
+        if (transferJournal.journalFile.empty()) {
+            removeJournalEntry(transferJournal, remoteFile);
+            unlink(segmentedFile.c_str());
+        }
+
+        if (laneError) {
+            std::rethrow_exception(laneError);
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Download a file into a partial local file, journaling progress. If the journal holds
+    // an entry for the same remote file (size and modified time unchanged) the download
+    // resumes with REST from the last confirmed (synced to disk) byte.
+    //
+
+    bool getFileResumable(CSession &ftpSession, TransferJournal &transferJournal, const std::string &remoteFile, const std::string &localFile, const FileInfo &remoteFileInfo) {
+
+        std::string partialFile { localFile + kPartialPostfix };
+        JournalEntry journalEntry;
+        struct stat fileStat;
+        std::uint64_t remoteSize { 0 };
+        std::uint64_t offset { 0 };
+        bool downloadComplete { false };
+
+        int partialFileFd = open(partialFile.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+        if (partialFileFd == -1) {
+            std::cerr << "Escapement error: Could not create [" << partialFile << "]" << std::endl;
+            return (false);
+        }
+
+        try {
+
+            if (ftpSession.getFileSize(remoteFile, remoteSize) != 213) {
+                throw CSession::Exception("Could not get size of [" + remoteFile + "]");
+            }
+
+            if (findJournalEntry(transferJournal, remoteFile, journalEntry) && (journalEntry.direction == kJournalPull) &&
+                (journalEntry.destination == partialFile) && (journalEntry.size == remoteSize) &&
+                (journalEntry.modified == static_cast<std::string> (remoteFileInfo.modified)) &&
+                (fstat(partialFileFd, &fileStat) == 0) && (static_cast<std::uint64_t> (fileStat.st_size) >= journalEntry.confirmed)) {
+                offset = journalEntry.confirmed;
+                std::cout << "Resuming pull of [" << remoteFile << "] at byte " << offset << std::endl;
+            }
+
+            if (ftruncate(partialFileFd, offset) != 0) {
+                throw CSession::Exception("Could not truncate [" + partialFile + "]");
+            }
+
+            journalEntry = { remoteFile, partialFile, kJournalPull, remoteSize, static_cast<std::string> (remoteFileInfo.modified), offset, {} };
+            updateJournalEntry(transferJournal, journalEntry);
+
+            preallocateFile(partialFileFd, offset, remoteSize);
+            setDirectIO(ftpSession, partialFileFd, remoteSize);
+
+            std::uint16_t statusCode = ftpSession.getFile(remoteFile, partialFileFd, offset,
+                    [&transferJournal, &journalEntry, partialFileFd, offset] (std::uint64_t bytesTransferred) {
+                        if ((offset + bytesTransferred - journalEntry.confirmed) >= kJournalCheckpoint) {
+                            fdatasync(partialFileFd);
+                            journalEntry.confirmed = offset + bytesTransferred;
+                            updateJournalEntry(transferJournal, journalEntry);
+                        }
+                    });
+
+            downloadComplete = ((statusCode == 226) || (statusCode == 250)) &&
+                    (fstat(partialFileFd, &fileStat) == 0) && (static_cast<std::uint64_t> (fileStat.st_size) == remoteSize);
+
+        } catch (...) {
+            close(partialFileFd);
+            throw;
+        }
+
+        close(partialFileFd);
+
+        if (downloadComplete && (std::rename(partialFile.c_str(), localFile.c_str()) == 0)) {
+            setModifiedTime(localFile, remoteFileInfo.modified);
+            removeJournalEntry(transferJournal, remoteFile);
+            return (true);
+        }
+
+        return (false);
+
+    }
+
+    //
+    // Upload a file to a partial remote file, journaling progress. If the journal holds an
+    // entry for the same local file (size and modified time unchanged) the upload resumes
+    // from the size of the partial remote file as reported by SIZE.
+    //
+
+    bool putFileResumable(CSession &ftpSession, TransferJournal &transferJournal, const std::string &localFile, const std::string &remoteFile, const FileInfo &localFileInfo) {
+
+        std::string partialFile { remoteFile + kPartialPostfix };
+        JournalEntry journalEntry;
+        struct stat fileStat;
+        std::uint64_t remoteSize { 0 };
+        std::uint64_t offset { 0 };
+        bool uploadComplete { false };
+
+        int localFileFd = open(localFile.c_str(), O_RDONLY | O_CLOEXEC);
+        if ((localFileFd == -1) || (fstat(localFileFd, &fileStat) != 0)) {
+            std::cerr << "Escapement error: Could not open [" << localFile << "]" << std::endl;
+            if (localFileFd != -1) {
+                close(localFileFd);
+            }
+            return (false);
+        }
+
+        try {
+
+            std::uint64_t localSize = fileStat.st_size;
+
+            if (findJournalEntry(transferJournal, localFile, journalEntry) && (journalEntry.direction == kJournalPush) &&
+                (journalEntry.destination == partialFile) && (journalEntry.size == localSize) &&
+                (journalEntry.modified == static_cast<std::string> (localFileInfo.modified)) &&
+                (ftpSession.getFileSize(partialFile, remoteSize) == 213) && (remoteSize <= localSize)) {
+                offset = remoteSize;
+                std::cout << "Resuming push of [" << localFile << "] at byte " << offset << std::endl;
+            }
+
+            journalEntry = { localFile, partialFile, kJournalPush, localSize, static_cast<std::string> (localFileInfo.modified), offset, {} };
+            updateJournalEntry(transferJournal, journalEntry);
+
+            std::uint16_t statusCode = ftpSession.putFile(partialFile, localFileFd, offset, false,
+                    [&transferJournal, &journalEntry, offset] (std::uint64_t bytesTransferred) {
+                        if ((offset + bytesTransferred - journalEntry.confirmed) >= kJournalCheckpoint) {
+                            journalEntry.confirmed = offset + bytesTransferred;
+                            updateJournalEntry(transferJournal, journalEntry);
+                        }
+                    });
+
+            if (((statusCode == 226) || (statusCode == 250)) &&
+                (ftpSession.getFileSize(partialFile, remoteSize) == 213) && (remoteSize == localSize)) {
+                uploadComplete = (ftpSession.renameFile(partialFile, remoteFile) == 250);
+            }
+
+        } catch (...) {
+            close(localFileFd);
+            throw;
+        }
+
+        close(localFileFd);
+
+        if (uploadComplete) {
+            removeJournalEntry(transferJournal, localFile);
+        }
+
+        return (uploadComplete);
+
+    }
+
+    //
+    // Upload just the tail of a local file that has grown since it was last uploaded. The
+    // remote copy must be shorter than the local file and verified as a prefix of it, by a
+    // server SHA-256 HASH of its range where supported or else against the fingerprint
+    // recorded at its last upload. The tail is written straight to the remote file (REST
+    // or APPE) as an interrupted append still leaves a valid prefix. Returns true if the
+    // tail was appended and the remote file is then the local file's size (with fingerprint
+    // set for the new remote content); false means the file needs a full upload.
+    //
+
+    bool putFileTail(CSession &ftpSession, const std::string &localFile, const std::string &remoteFile, const FileInfo &remoteFileInfo, std::string &fingerprint) {
+
+        std::uint64_t remoteSize { 0 };
+        std::uint64_t appendedSize { 0 };
+        std::uint16_t statusCode;
+        struct stat fileStat;
+        DigestContext digestContext(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+
+        fingerprint.clear();
+
+        if (!digestContext || (ftpSession.getFileSize(remoteFile, remoteSize) != 213) || (remoteSize == 0)) {
+            return (false);
+        }
+
+        int localFileFd = open(localFile.c_str(), O_RDONLY | O_CLOEXEC);
+        if (localFileFd == -1) {
+            return (false);
+        }
+
+        if ((fstat(localFileFd, &fileStat) != 0) || (remoteSize >= static_cast<std::uint64_t> (fileStat.st_size)) ||
+            (EVP_DigestInit_ex(digestContext.get(), EVP_sha256(), nullptr) != 1) ||
+            !hashFileRange(localFileFd, 0, remoteSize, digestContext.get())) {
+            close(localFileFd);
+            return (false);
+        }
+
+        std::string prefixFingerprint { digestFingerprint(remoteSize, digestContext.get()) };
+        std::string remoteHash;
+        bool prefixVerified;
+
+        try {
+            if (ftpSession.isHashSupported() && (ftpSession.getFileHash(remoteFile, 0, remoteSize, remoteHash) == 213)) {
+                prefixVerified = (prefixFingerprint == (std::to_string(remoteSize) + ":" + remoteHash));
+            } else {
+                prefixVerified = (!prefixFingerprint.empty() && (prefixFingerprint == remoteFileInfo.fingerprint));
+            }
+            statusCode = (prefixVerified) ? ftpSession.putFile(remoteFile, localFileFd, remoteSize) : 0;
+        } catch (...) {
+            close(localFileFd);
+            throw;
+        }
+
+        bool appended = (((statusCode == 226) || (statusCode == 250)) &&
+                (ftpSession.getFileSize(remoteFile, appendedSize) == 213) &&
+                (appendedSize == static_cast<std::uint64_t> (fileStat.st_size)));
+
+        if (appended && hashFileRange(localFileFd, remoteSize, appendedSize, digestContext.get())) {
+            fingerprint = digestFingerprint(appendedSize, digestContext.get());
+        }
+
+        close(localFileFd);
+
+        if (appended) {
+            std::cout << "Appended " << (appendedSize - remoteSize) << " bytes to [" << remoteFile << "]" << std::endl;
+        }
+
+        return (appended);
+
+    }
+
+    //
+    // Return fingerprint ("size:SHA-256") of a local file's content ("" on failure).
+    //
+
+    std::string fileFingerprint(const std::string &localFile) {
+
+        DigestContext digestContext(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+        std::string fingerprint;
+        struct stat fileStat;
+
+        int localFileFd = open(localFile.c_str(), O_RDONLY | O_CLOEXEC);
+        if (localFileFd == -1) {
+            return (fingerprint);
+        }
+
+        if (digestContext && (fstat(localFileFd, &fileStat) == 0) &&
+            (EVP_DigestInit_ex(digestContext.get(), EVP_sha256(), nullptr) == 1) &&
+            hashFileRange(localFileFd, 0, fileStat.st_size, digestContext.get())) {
+            fingerprint = digestFingerprint(fileStat.st_size, digestContext.get());
+        }
+
+        close(localFileFd);
+
+        return (fingerprint);
+
+    }
+
+    //
+    // Create remote directories over a session of their own with the MKD commands
+    // pipelined; the list must have parents before children (server handles commands
+    // in order). Any MKD refused is checked (again pipelined) with CWD in case the
+    // directory already exists, the pipeline ending with a CWD back to the remote
+    // directory so the pooled session is left where it started (or closed if it cannot
+    // get back). Returns directories that now exist.
+    //
+
+    FileList makeRemoteDirectories(const EscapementOptions &optionData, const FileList &directoryList) {
+
+        FileList existingList;
+
+        if (directoryList.empty()) {
+            return (existingList);
+        }
+
+        try {
+
+            CPooledSession ftpSession { optionData };
+            std::vector<std::string> commandLines;
+            FileList uncheckedList;
+
+            for (auto &directory : directoryList) {
+                commandLines.push_back("MKD " + directory);
+            }
+
+            std::vector<std::uint16_t> statusCodes { ftpSession->commandPipeline(commandLines) };
+
+            for (size_t directory = 0; directory < directoryList.size(); directory++) {
+                if (statusCodes[directory] == 257) {
+                    existingList.push_back(directoryList[directory]);
+                } else {
+                    uncheckedList.push_back(directoryList[directory]);
+                }
+            }
+
+            if (!uncheckedList.empty()) {
+                commandLines.clear();
+                for (auto &directory : uncheckedList) {
+                    commandLines.push_back("CWD " + directory);
+                }
+                commandLines.push_back("CWD " + optionData.remoteDirectory);
+                statusCodes = ftpSession->commandPipeline(commandLines);
+                if (statusCodes.back() != 250) {
+                    ftpSession->close();
+                }
+                for (size_t directory = 0; directory < uncheckedList.size(); directory++) {
+                    if (statusCodes[directory] == 250) {
+                        existingList.push_back(uncheckedList[directory]);
+                    } else {
+                        std::cerr << "Escapement error: Could not create directory [" << uncheckedList[directory] << "]" << std::endl;
+                    }
+                }
+            }
+
+        } catch (const CSession::Exception &e) {
+            std::cerr << "Escapement error: Remote directory creation failed [" << e.what() << "]" << std::endl;
+        }
+
+        return (existingList);
+
+    }
+
+} // namespace Escapement_Transfer
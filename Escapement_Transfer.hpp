@@ -0,0 +1,59 @@
+#ifndef ESCAPEMENT_TRANSFER_HPP
+#define ESCAPEMENT_TRANSFER_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <functional>
+
+//
+// Escapement components
+//
+
+#include "Escapement.hpp"
+#include "Escapement_Journal.hpp"
+#include "Escapement_Session.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Transfer {
+
+    //
+    // Transfer a list of files over a given session and return those transferred.
+    //
+
+    typedef std::function<Antik::FileList (Escapement_Session::CSession &ftpSession, const Antik::FileList &fileList)> TransferFn;
+
+    //
+    // Size aware transfer queue. Small files have their own lane (kept in path order)
+    // while large files are ordered largest first so that the biggest jobs start early.
+    //
+
+    struct TransferQueue {
+        std::deque<std::string> smallFiles;     // Files below small file threshold
+        std::deque<std::string> largeFiles;     // Remaining files sorted largest first
+        std::mutex queueMutex;                  // Queue access mutex
+    };
+
+    void buildTransferQueue(const Antik::FileList &fileList, const Escapement::FileInfoMap &fileInfoMap, std::uint64_t smallFileSize, TransferQueue &transferQueue);
+    Antik::FileList transferFiles(const Escapement::EscapementOptions &optionData, TransferQueue &transferQueue, TransferFn transferFn);
+    bool getFile(Escapement_Session::CSession &ftpSession, const std::string &remoteFile, const std::string &localFile, const Escapement::FileInfo &remoteFileInfo = Escapement::FileInfo());
+    bool putFile(Escapement_Session::CSession &ftpSession, const std::string &localFile, const std::string &remoteFile);
+    bool getFileSegmented(Escapement_Session::CSession &ftpSession, const Escapement::EscapementOptions &optionData, Escapement_Journal::TransferJournal &transferJournal,
+            const std::string &remoteFile, const std::string &localFile, const Escapement::FileInfo &remoteFileInfo);
+    bool getFileResumable(Escapement_Session::CSession &ftpSession, Escapement_Journal::TransferJournal &transferJournal, const std::string &remoteFile, const std::string &localFile, const Escapement::FileInfo &remoteFileInfo);
+    bool putFileResumable(Escapement_Session::CSession &ftpSession, Escapement_Journal::TransferJournal &transferJournal, const std::string &localFile, const std::string &remoteFile, const Escapement::FileInfo &localFileInfo);
+    bool putFileTail(Escapement_Session::CSession &ftpSession, const std::string &localFile, const std::string &remoteFile, const Escapement::FileInfo &remoteFileInfo, std::string &fingerprint);
+    std::string fileFingerprint(const std::string &localFile);
+    Antik::FileList makeRemoteDirectories(const Escapement::EscapementOptions &optionData, const Antik::FileList &directoryList);
+
+} // namespace Escapement_Transfer
+
+#endif /* ESCAPEMENT_TRANSFER_HPP */
+
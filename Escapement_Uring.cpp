@@ -0,0 +1,451 @@
+//
+// Class: CUringWriter
+//
+// Description: Sequential file writer used by Escapement for downloads. Writes are
+// submitted through io_uring (driven directly through its system calls) as fixed
+// buffer writes from buffers registered with the kernel once, so they neither block
+// the network receive nor cost a page pin per write. Only a small number of buffers
+// exist; when all are in flight the writer waits for the disk, which in turn stops
+// the socket being read and lets TCP flow control hold back the server. Files open
+// O_DIRECT bypass the page cache so large restores do not flood memory with dirty
+// pages.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+// Linux              : io_uring (5.1+), mmap, O_DIRECT.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+//
+// Escapement io_uring writer
+//
+
+#include "Escapement_Uring.hpp"
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Uring {
+
+    // ===========================
+    // PRIVATE TYPES AND CONSTANTS
+    // ===========================
+
+    //
+    // Submission/completion queue entries requested (at least one per buffer)
+    //
+
+    static const unsigned kUringEntries { 8 };
+
+    //
+    // Set once a writer could not set up its ring or register its buffers (for example
+    // RLIMIT_MEMLOCK too low or io_uring_register blocked); io_uring is then not used
+    // again by the process.
+    //
+
+    static std::atomic<bool> uringSetupFailed { false };
+
+    // ===============
+    // LOCAL FUNCTIONS
+    // ===============
+
+    static int uringSetup(unsigned entries, struct io_uring_params *params) {
+        return (static_cast<int> (syscall(__NR_io_uring_setup, entries, params)));
+    }
+
+    static int uringEnter(int ringFd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return (static_cast<int> (syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, nullptr, 0)));
+    }
+
+    static int uringRegister(int ringFd, unsigned opcode, const void *arg, unsigned argCount) {
+        return (static_cast<int> (syscall(__NR_io_uring_register, ringFd, opcode, arg, argCount)));
+    }
+
+    //
+    // Address of a ring field at an offset given by the kernel
+    //
+
+    static unsigned *ringField(void *ring, std::uint32_t offset) {
+        return (reinterpret_cast<unsigned *> (static_cast<char *> (ring) + offset));
+    }
+
+    // ===============
+    // PRIVATE METHODS
+    // ===============
+
+    //
+    // Queue and submit write of buffer at next file offset.
+    //
+
+    void CUringWriter::submitWrite(int buffer, size_t length) {
+
+        unsigned tail = *m_sqTail;
+        unsigned index = tail & *m_sqMask;
+        struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *> (m_sqes) + index;
+
+        std::memset(sqe, 0, sizeof (*sqe));
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = m_localFile;
+        sqe->off = m_nextOffset;
+        sqe->addr = reinterpret_cast<std::uint64_t> (m_buffers + (buffer * m_bufferSize));
+        sqe->len = length;
+        sqe->buf_index = buffer;
+        sqe->user_data = buffer;
+
+        m_sqArray[index] = index;
+        __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        int submitted;
+        do {
+            submitted = uringEnter(m_ringFd, 1, 0, 0);
+        } while ((submitted == -1) && (errno == EINTR));
+
+        if (submitted != 1) {
+            throw Exception("Could not submit write: " + std::string(std::strerror(errno)));
+        }
+
+        m_inFlight.push_back({ buffer, length, false });
+        m_nextOffset += length;
+
+    }
+
+    //
+    // Process completed writes (waiting for at least one if asked to), freeing their
+    // buffers and advancing the contiguous bytes written.
+    //
+
+    void CUringWriter::reapCompletions(bool wait) {
+
+        if (wait) {
+            while ((uringEnter(m_ringFd, 0, 1, IORING_ENTER_GETEVENTS) == -1) && (errno == EINTR)) {
+            }
+        }
+
+        unsigned head = *m_cqHead;
+        unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = static_cast<struct io_uring_cqe *> (m_cqes) + (head & *m_cqMask);
+            for (auto &write : m_inFlight) {
+                if (!write.done && (write.buffer == static_cast<int> (cqe->user_data))) {
+                    write.done = true;
+                    if ((cqe->res < 0) && (m_writeError == 0)) {
+                        m_writeError = -cqe->res;
+                    } else if ((cqe->res >= 0) && (static_cast<size_t> (cqe->res) != write.length) && (m_writeError == 0)) {
+                        m_writeError = EIO;
+                    }
+                    break;
+                }
+            }
+        }
+
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+        while (!m_inFlight.empty() && m_inFlight.front().done) {
+            m_bytesWritten += m_inFlight.front().length;
+            m_freeBuffers.push_back(m_inFlight.front().buffer);
+            m_inFlight.pop_front();
+        }
+
+    }
+
+    //
+    // Throw if any write has failed.
+    //
+
+    void CUringWriter::checkError(void) {
+
+        if (m_writeError != 0) {
+            throw Exception("Local file write failed: " + std::string(std::strerror(m_writeError)));
+        }
+
+    }
+
+    //
+    // Release ring and buffers. Any writes still in flight (after a failure) are waited
+    // for before their buffers are freed.
+    //
+
+    void CUringWriter::release(void) {
+
+        if (m_ringFd != -1) {
+            while (!m_inFlight.empty()) {
+                reapCompletions(true);
+            }
+        }
+
+        if (m_sqes != nullptr) {
+            munmap(m_sqes, m_sqesSize);
+            m_sqes = nullptr;
+        }
+        if ((m_cqRing != nullptr) && (m_cqRing != m_sqRing)) {
+            munmap(m_cqRing, m_cqRingSize);
+        }
+        m_cqRing = nullptr;
+        if (m_sqRing != nullptr) {
+            munmap(m_sqRing, m_sqRingSize);
+            m_sqRing = nullptr;
+        }
+        if (m_ringFd != -1) {
+            ::close(m_ringFd);
+            m_ringFd = -1;
+        }
+
+        free(m_buffers);
+        m_buffers = nullptr;
+
+    }
+
+    // ==============
+    // PUBLIC METHODS
+    // ==============
+
+    //
+    // Set up io_uring and register buffers for writing file sequentially from offset.
+    // Direct I/O is only kept if the start offset is suitably aligned.
+    //
+
+    CUringWriter::CUringWriter(int localFile, std::uint64_t offset, size_t bufferSize) {
+
+        struct io_uring_params params {};
+        std::vector<struct iovec> bufferList(kUringBuffers);
+        int fileFlags = fcntl(localFile, F_GETFL);
+
+        m_localFile = localFile;
+        m_nextOffset = offset;
+        m_bufferSize = ((bufferSize + kDirectIOAlignment - 1) / kDirectIOAlignment) * kDirectIOAlignment;
+        m_directIO = (fileFlags != -1) && (fileFlags & O_DIRECT);
+
+        if (m_directIO && ((offset % kDirectIOAlignment) != 0)) {
+            fcntl(localFile, F_SETFL, fileFlags & ~O_DIRECT);
+            m_directIO = false;
+        }
+
+        if (posix_memalign(reinterpret_cast<void **> (&m_buffers), kDirectIOAlignment, m_bufferSize * kUringBuffers) != 0) {
+            m_buffers = nullptr;
+            throw Exception("Could not allocate write buffers.");
+        }
+
+        try {
+
+            m_ringFd = uringSetup(kUringEntries, &params);
+            if (m_ringFd == -1) {
+                throw Exception("Could not set up io_uring: " + std::string(std::strerror(errno)));
+            }
+
+            m_sqRingSize = params.sq_off.array + (params.sq_entries * sizeof (unsigned));
+            m_cqRingSize = params.cq_off.cqes + (params.cq_entries * sizeof (struct io_uring_cqe));
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+            }
+
+            m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+            if (m_sqRing == MAP_FAILED) {
+                m_sqRing = nullptr;
+                throw Exception("Could not map submission queue.");
+            }
+
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                m_cqRing = m_sqRing;
+            } else {
+                m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_CQ_RING);
+                if (m_cqRing == MAP_FAILED) {
+                    m_cqRing = nullptr;
+                    throw Exception("Could not map completion queue.");
+                }
+            }
+
+            m_sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+            m_sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+            if (m_sqes == MAP_FAILED) {
+                m_sqes = nullptr;
+                throw Exception("Could not map submission queue entries.");
+            }
+
+            m_sqTail = ringField(m_sqRing, params.sq_off.tail);
+            m_sqMask = ringField(m_sqRing, params.sq_off.ring_mask);
+            m_sqArray = ringField(m_sqRing, params.sq_off.array);
+            m_cqHead = ringField(m_cqRing, params.cq_off.head);
+            m_cqTail = ringField(m_cqRing, params.cq_off.tail);
+            m_cqMask = ringField(m_cqRing, params.cq_off.ring_mask);
+            m_cqes = ringField(m_cqRing, params.cq_off.cqes);
+
+            for (int buffer = 0; buffer < kUringBuffers; buffer++) {
+                bufferList[buffer].iov_base = m_buffers + (buffer * m_bufferSize);
+                bufferList[buffer].iov_len = m_bufferSize;
+                m_freeBuffers.push_back(buffer);
+            }
+
+            if (uringRegister(m_ringFd, IORING_REGISTER_BUFFERS, bufferList.data(), bufferList.size()) != 0) {
+                throw Exception("Could not register write buffers: " + std::string(std::strerror(errno)));
+            }
+
+        } catch (...) {
+            uringSetupFailed = true;
+            release();
+            throw;
+        }
+
+    }
+
+    //
+    // Destructor.
+    //
+
+    CUringWriter::~CUringWriter() {
+
+        release();
+
+    }
+
+    //
+    // Return true if the kernel provides io_uring (checked once) and no writer has yet
+    // failed to set it up.
+    //
+
+    bool CUringWriter::isSupported(void) {
+
+        static std::once_flag supportChecked;
+        static bool supported { false };
+
+        std::call_once(supportChecked, [] () {
+            struct io_uring_params params {};
+            int ringFd = uringSetup(1, &params);
+            if (ringFd != -1) {
+                supported = true;
+                ::close(ringFd);
+            }
+        });
+
+        return (supported && !uringSetupFailed);
+
+    }
+
+    //
+    // Return a free buffer of getBufferSize() bytes, waiting for a write to complete if
+    // all of them are in flight.
+    //
+
+    char *CUringWriter::getBuffer(void) {
+
+        reapCompletions(false);
+
+        while (m_freeBuffers.empty()) {
+            reapCompletions(true);
+        }
+
+        checkError();
+
+        int buffer = m_freeBuffers.back();
+        m_freeBuffers.pop_back();
+
+        return (m_buffers + (buffer * m_bufferSize));
+
+    }
+
+    //
+    // Return size of each buffer.
+    //
+
+    size_t CUringWriter::getBufferSize(void) const {
+
+        return (m_bufferSize);
+
+    }
+
+    //
+    // Write length bytes of buffer (from getBuffer()) at the next file position. A direct
+    // I/O write of an unaligned length (the end of the file) waits for all other writes
+    // and goes through the page cache.
+    //
+
+    void CUringWriter::writeBuffer(char *buffer, size_t length) {
+
+        int bufferIndex = (buffer - m_buffers) / m_bufferSize;
+
+        if (length == 0) {
+            m_freeBuffers.push_back(bufferIndex);
+            return;
+        }
+
+        if (m_directIO && ((length % kDirectIOAlignment) != 0)) {
+            m_freeBuffers.push_back(bufferIndex);
+            complete();
+            fcntl(m_localFile, F_SETFL, fcntl(m_localFile, F_GETFL) & ~O_DIRECT);
+            m_directIO = false;
+            for (size_t bytesWritten = 0; bytesWritten < length;) {
+                ssize_t writeLength = pwrite(m_localFile, buffer + bytesWritten, length - bytesWritten, m_nextOffset + bytesWritten);
+                if (writeLength == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    throw Exception("Local file write failed: " + std::string(std::strerror(errno)));
+                }
+                bytesWritten += writeLength;
+            }
+            m_nextOffset += length;
+            m_bytesWritten += length;
+            return;
+        }
+
+        try {
+            submitWrite(bufferIndex, length);
+        } catch (...) {
+            m_freeBuffers.push_back(bufferIndex);
+            throw;
+        }
+
+    }
+
+    //
+    // Wait for all writes to complete.
+    //
+
+    void CUringWriter::complete(void) {
+
+        while (!m_inFlight.empty()) {
+            reapCompletions(true);
+        }
+
+        checkError();
+
+    }
+
+    //
+    // Return bytes written (contiguously from the start offset) so far.
+    //
+
+    std::uint64_t CUringWriter::getBytesWritten(void) const {
+
+        return (m_bytesWritten);
+
+    }
+
+} // namespace Escapement_Uring
@@ -0,0 +1,119 @@
+#ifndef ESCAPEMENT_URING_HPP
+#define ESCAPEMENT_URING_HPP
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdexcept>
+#include <cstdint>
+#include <cstddef>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Uring {
+
+    //
+    // Alignment of direct I/O (O_DIRECT) buffers, file offsets and write lengths
+    //
+
+    const size_t kDirectIOAlignment { 4096 };
+
+    //
+    // Number of registered write buffers (at most this many writes are in flight)
+    //
+
+    const int kUringBuffers { 4 };
+
+    //
+    // Sequential file writer that submits writes through io_uring from a small set of
+    // registered buffers. Writes complete in the background while the caller fills the
+    // next buffer; once every buffer is in flight getBuffer() waits for one to complete
+    // so a slow disk holds back the producer. If the file was opened (or switched) to
+    // O_DIRECT the buffers are suitably aligned and a final unaligned tail is written
+    // through the page cache. Failures are reported by throwing CUringWriter::Exception.
+    //
+
+    class CUringWriter {
+    public:
+
+        //
+        // Class exception
+        //
+
+        struct Exception : public std::runtime_error {
+
+            Exception(std::string const& message)
+            : std::runtime_error("CUringWriter Failure: " + message) {
+            }
+
+        };
+
+        CUringWriter(int localFile, std::uint64_t offset, size_t bufferSize);
+        virtual ~CUringWriter();
+
+        CUringWriter(const CUringWriter &orig) = delete;
+        CUringWriter(const CUringWriter &&orig) = delete;
+        CUringWriter& operator=(CUringWriter other) = delete;
+
+        static bool isSupported(void);
+
+        char *getBuffer(void);
+        size_t getBufferSize(void) const;
+        void writeBuffer(char *buffer, size_t length);
+        void complete(void);
+        std::uint64_t getBytesWritten(void) const;
+
+    private:
+
+        //
+        // Write in flight (in submission order)
+        //
+
+        struct InFlightWrite {
+            int buffer { 0 };               // Registered buffer index
+            size_t length { 0 };            // Bytes to write
+            bool done { false };            // == true write completed
+        };
+
+        void submitWrite(int buffer, size_t length);
+        void reapCompletions(bool wait);
+        void checkError(void);
+        void release(void);
+
+        int m_localFile { -1 };                 // File being written
+        std::uint64_t m_nextOffset { 0 };       // File offset of next write
+        std::uint64_t m_bytesWritten { 0 };     // Contiguous bytes written from start offset
+        size_t m_bufferSize { 0 };              // Size of each buffer
+        bool m_directIO { false };              // == true file is open O_DIRECT
+        char *m_buffers { nullptr };            // Registered buffers (one aligned block)
+        std::vector<int> m_freeBuffers;         // Buffers not in flight
+        std::deque<InFlightWrite> m_inFlight;   // Writes in flight
+        int m_writeError { 0 };                 // First write error (errno value)
+
+        int m_ringFd { -1 };                    // io_uring instance
+        void *m_sqRing { nullptr };             // Submission queue ring mapping
+        void *m_cqRing { nullptr };             // Completion queue ring mapping
+        size_t m_sqRingSize { 0 };              // Submission queue ring mapping size
+        size_t m_cqRingSize { 0 };              // Completion queue ring mapping size
+        void *m_sqes { nullptr };               // Submission queue entries mapping
+        size_t m_sqesSize { 0 };                // Submission queue entries mapping size
+        unsigned *m_sqTail { nullptr };         // Submission queue tail
+        unsigned *m_sqMask { nullptr };         // Submission queue index mask
+        unsigned *m_sqArray { nullptr };        // Submission queue index array
+        unsigned *m_cqHead { nullptr };         // Completion queue head
+        unsigned *m_cqTail { nullptr };         // Completion queue tail
+        unsigned *m_cqMask { nullptr };         // Completion queue index mask
+        void *m_cqes { nullptr };               // Completion queue entries
+
+    };
+
+} // namespace Escapement_Uring
+
+#endif /* ESCAPEMENT_URING_HPP */
+
@@ -0,0 +1,182 @@
+//
+// Program: Escapement_BinaryCache_Test
+//
+// Description: Unit tests for the binary file-state cache (CBinaryCache): entries
+// and options written are read back unchanged and a damaged cache file is refused.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+//
+// Escapement components
+//
+
+#include "Escapement_BinaryCache.hpp"
+#include "Escapement_Test.hpp"
+
+// =======
+// IMPORTS
+// =======
+
+using namespace Escapement;
+using namespace Escapement_BinaryCache;
+
+// ===============
+// LOCAL FUNCTIONS
+// ===============
+
+//
+// Return test file state (enough entries for several path table restarts)
+//
+
+static FileInfoMap testFileState(void) {
+
+    FileInfoMap fileInfoMap;
+
+    for (int file = 0; file < 100; file++) {
+        FileInfo fileInfo;
+        fileInfo.modified = static_cast<Antik::FTP::CFTP::DateTime> (std::string("202001020304") + ((file % 2) ? "05" : "59"));
+        fileInfo.size = file * 1000;
+        if ((file % 10) == 0) {
+            fileInfo.fingerprint = std::to_string(fileInfo.size) + ":0123456789abcdef";
+        }
+        fileInfoMap["/remote/directory" + std::to_string(file % 7) + "/file" + std::to_string(file)] = fileInfo;
+    }
+
+    FileInfo directoryInfo;
+    directoryInfo.directory = true;
+    fileInfoMap["/remote/directory0"] = directoryInfo;
+
+    return (fileInfoMap);
+
+}
+
+//
+// Return true if cache file opens (passes its checks)
+//
+
+static bool isCacheReadable(const std::string &cacheFile) {
+
+    try {
+        CBinaryCache binaryCache { cacheFile };
+        return (true);
+    } catch (const CBinaryCache::Exception &e) {
+        return (false);
+    }
+
+}
+
+//
+// Entries and options read back as written (entries in path order)
+//
+
+static void testRoundTrip(const std::string &cacheFile) {
+
+    FileInfoMap fileInfoMap { testFileState() };
+    CachedOptions cachedOptions { { "ServerName", "ftp.example.com" }, { "RemoteDirectory", "/remote" } };
+    FileInfoMap readFileInfoMap;
+    std::string lastPath;
+    bool pathOrder { true };
+
+    CBinaryCache::write(cacheFile, cachedOptions, fileInfoMap);
+
+    ESCAPEMENT_CHECK(CBinaryCache::isBinaryCache(cacheFile));
+    ESCAPEMENT_CHECK(CBinaryCache::readOptions(cacheFile) == cachedOptions);
+
+    CBinaryCache binaryCache { cacheFile };
+
+    ESCAPEMENT_CHECK(binaryCache.size() == fileInfoMap.size());
+
+    binaryCache.forEach([&] (const std::string &filePath, const FileInfo &fileInfo) {
+        pathOrder = pathOrder && (lastPath < filePath);
+        lastPath = filePath;
+        readFileInfoMap[filePath] = fileInfo;
+    });
+
+    ESCAPEMENT_CHECK(pathOrder);
+    ESCAPEMENT_CHECK(readFileInfoMap.size() == fileInfoMap.size());
+
+    for (auto &file : fileInfoMap) {
+        auto readFile = readFileInfoMap.find(file.first);
+        ESCAPEMENT_CHECK(readFile != readFileInfoMap.end());
+        if (readFile != readFileInfoMap.end()) {
+            ESCAPEMENT_CHECK(static_cast<std::string> (readFile->second.modified) == static_cast<std::string> (file.second.modified));
+            ESCAPEMENT_CHECK(readFile->second.size == file.second.size);
+            ESCAPEMENT_CHECK(readFile->second.directory == file.second.directory);
+            ESCAPEMENT_CHECK(readFile->second.fingerprint == file.second.fingerprint);
+        }
+    }
+
+}
+
+//
+// A cache with a byte changed or cut short is refused
+//
+
+static void testCorruption(const std::string &cacheFile) {
+
+    struct stat cacheStat;
+
+    CBinaryCache::write(cacheFile, {}, testFileState());
+
+    ESCAPEMENT_CHECK(stat(cacheFile.c_str(), &cacheStat) == 0);
+    ESCAPEMENT_CHECK(isCacheReadable(cacheFile));
+
+    {
+        std::fstream cacheStream { cacheFile, std::ios::binary | std::ios::in | std::ios::out };
+        char cacheByte;
+        cacheStream.seekg(cacheStat.st_size / 2);
+        cacheStream.get(cacheByte);
+        cacheStream.seekp(cacheStat.st_size / 2);
+        cacheStream.put(static_cast<char> (cacheByte ^ 0x5a));
+    }
+
+    ESCAPEMENT_CHECK(!isCacheReadable(cacheFile));
+
+    CBinaryCache::write(cacheFile, {}, testFileState());
+
+    ESCAPEMENT_CHECK(truncate(cacheFile.c_str(), cacheStat.st_size - 1) == 0);
+    ESCAPEMENT_CHECK(!isCacheReadable(cacheFile));
+
+}
+
+// ============================
+// ===== MAIN ENTRY POint =====
+// ============================
+
+int main(void) {
+
+    std::string testDirectory { Escapement_Test::makeTestDirectory() };
+    std::string cacheFile { testDirectory + "/cache.bin" };
+
+    testRoundTrip(cacheFile);
+    testCorruption(cacheFile);
+
+    std::remove(cacheFile.c_str());
+    rmdir(testDirectory.c_str());
+
+    return (Escapement_Test::failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
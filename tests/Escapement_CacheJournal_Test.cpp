@@ -0,0 +1,166 @@
+//
+// Program: Escapement_CacheJournal_Test
+//
+// Description: Unit tests for the file-state cache journal (CCacheJournal): changes
+// replay in order and a record torn at the end of the journal is ignored and then
+// truncated away when the journal is reopened.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <fstream>
+#include <cstdio>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+//
+// Escapement components
+//
+
+#include "Escapement_CacheJournal.hpp"
+#include "Escapement_Test.hpp"
+
+// =======
+// IMPORTS
+// =======
+
+using namespace Escapement;
+using namespace Escapement_CacheJournal;
+
+// ===============
+// LOCAL FUNCTIONS
+// ===============
+
+//
+// Return journal file size (-1 if not there)
+//
+
+static off_t journalSize(const std::string &journalFile) {
+
+    struct stat journalStat;
+
+    return ((stat(journalFile.c_str(), &journalStat) == 0) ? journalStat.st_size : -1);
+
+}
+
+//
+// Write journal of an update, a second update and the removal of the first entry
+//
+
+static void writeJournal(const std::string &journalFile) {
+
+    FileInfoMap fileInfoMap;
+    FileInfo fileInfo;
+
+    fileInfo.modified = static_cast<Antik::FTP::CFTP::DateTime> (std::string("20200102030405"));
+    fileInfo.size = 1234;
+    fileInfo.fingerprint = "1234:abcdef";
+
+    CCacheJournal cacheJournal { journalFile, fileInfoMap };
+
+    cacheJournal.update("/remote/removed", fileInfo);
+    cacheJournal.update("/remote/kept", fileInfo);
+    cacheJournal.remove("/remote/removed");
+    cacheJournal.sync();
+
+    ESCAPEMENT_CHECK(cacheJournal.getRecordCount() == 3);
+
+}
+
+//
+// Changes replay in order onto the file state
+//
+
+static void testReplay(const std::string &journalFile) {
+
+    FileInfoMap fileInfoMap;
+    int changes { 0 };
+
+    fileInfoMap["/remote/removed"] = FileInfo();
+
+    ESCAPEMENT_CHECK(CCacheJournal::replay(journalFile, fileInfoMap, [&changes] (const std::string &) {
+        changes++;
+    }) == 3);
+
+    ESCAPEMENT_CHECK(changes == 3);
+    ESCAPEMENT_CHECK(fileInfoMap.size() == 1);
+    ESCAPEMENT_CHECK(fileInfoMap.count("/remote/kept") == 1);
+    if (fileInfoMap.count("/remote/kept")) {
+        FileInfo &fileInfo { fileInfoMap["/remote/kept"] };
+        ESCAPEMENT_CHECK(static_cast<std::string> (fileInfo.modified) == "20200102030405");
+        ESCAPEMENT_CHECK(fileInfo.size == 1234);
+        ESCAPEMENT_CHECK(!fileInfo.directory);
+        ESCAPEMENT_CHECK(fileInfo.fingerprint == "1234:abcdef");
+    }
+
+}
+
+//
+// A torn record at the end is not applied and reopening the journal cuts it off (later
+// records then follow the last good one)
+//
+
+static void testTornTail(const std::string &journalFile) {
+
+    off_t goodSize { journalSize(journalFile) };
+
+    {
+        std::ofstream journalStream { journalFile, std::ios::binary | std::ios::app };
+        journalStream.write("\x40\x00\x00\x00\x12\x34", 6);
+    }
+
+    FileInfoMap fileInfoMap;
+
+    ESCAPEMENT_CHECK(CCacheJournal::replay(journalFile, fileInfoMap) == 3);
+    ESCAPEMENT_CHECK(fileInfoMap.size() == 1);
+
+    {
+        FileInfoMap reopenedFileInfoMap;
+        CCacheJournal cacheJournal { journalFile, reopenedFileInfoMap };
+        ESCAPEMENT_CHECK(cacheJournal.getRecordCount() == 3);
+        ESCAPEMENT_CHECK(journalSize(journalFile) == goodSize);
+        cacheJournal.remove("/remote/kept");
+    }
+
+    fileInfoMap.clear();
+
+    ESCAPEMENT_CHECK(CCacheJournal::replay(journalFile, fileInfoMap) == 4);
+    ESCAPEMENT_CHECK(fileInfoMap.empty());
+
+}
+
+// ============================
+// ===== MAIN ENTRY POint =====
+// ============================
+
+int main(void) {
+
+    std::string testDirectory { Escapement_Test::makeTestDirectory() };
+    std::string journalFile { testDirectory + "/cache.journal" };
+
+    writeJournal(journalFile);
+    testReplay(journalFile);
+    testTornTail(journalFile);
+
+    std::remove(journalFile.c_str());
+    rmdir(testDirectory.c_str());
+
+    return (Escapement_Test::failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
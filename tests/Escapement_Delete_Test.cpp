@@ -0,0 +1,142 @@
+//
+// Program: Escapement_Delete_Test
+//
+// Description: Unit tests for splitting remote entries to delete into branches
+// (splitIntoBranches): directories deleted in their entirety head their own branch
+// while everything else shares one, branches ordered largest first.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <deque>
+
+//
+// Escapement components
+//
+
+#include "Escapement_Delete.hpp"
+#include "Escapement_Test.hpp"
+
+// =======
+// IMPORTS
+// =======
+
+using namespace Escapement;
+using namespace Escapement_Delete;
+
+// ===============
+// LOCAL FUNCTIONS
+// ===============
+
+//
+// Add remote entry to file information map
+//
+
+static void addRemoteEntry(FileInfoMap &remoteFiles, const std::string &filePath, bool directory) {
+
+    FileInfo fileInfo;
+
+    fileInfo.directory = directory;
+    if (!directory) {
+        fileInfo.size = 1;
+    }
+
+    remoteFiles[filePath] = fileInfo;
+
+}
+
+//
+// Directory deleted in its entirety gets its own branch; one with a kept entry under
+// it does not
+//
+
+static void testSubtreeBranches(void) {
+
+    FileInfoMap remoteFiles;
+
+    addRemoteEntry(remoteFiles, "/r/a", true);
+    addRemoteEntry(remoteFiles, "/r/a/1", false);
+    addRemoteEntry(remoteFiles, "/r/a/2", false);
+    addRemoteEntry(remoteFiles, "/r/b", true);
+    addRemoteEntry(remoteFiles, "/r/b/1", false);
+    addRemoteEntry(remoteFiles, "/r/b/kept", false);
+    addRemoteEntry(remoteFiles, "/r/c", false);
+
+    std::deque<DeleteBranch> branches { splitIntoBranches({ "/r/c", "/r/b/1", "/r/a/2", "/r/a/1", "/r/a" }, remoteFiles) };
+
+    ESCAPEMENT_CHECK(branches.size() == 2);
+    if (branches.size() == 2) {
+        ESCAPEMENT_CHECK(branches[0].root == "/r/a");
+        ESCAPEMENT_CHECK((branches[0].fileList == Antik::FileList { "/r/a/2", "/r/a/1", "/r/a" }));
+        ESCAPEMENT_CHECK(branches[1].root.empty());
+        ESCAPEMENT_CHECK((branches[1].fileList == Antik::FileList { "/r/c", "/r/b/1" }));
+    }
+
+}
+
+//
+// Nested directories deleted in their entirety share the topmost one's branch and no
+// empty branch of remaining entries is returned
+//
+
+static void testNestedSubtree(void) {
+
+    FileInfoMap remoteFiles;
+
+    addRemoteEntry(remoteFiles, "/r/x", true);
+    addRemoteEntry(remoteFiles, "/r/x/y", true);
+    addRemoteEntry(remoteFiles, "/r/x/y/z", false);
+    addRemoteEntry(remoteFiles, "/r/kept", false);
+
+    std::deque<DeleteBranch> branches { splitIntoBranches({ "/r/x/y/z", "/r/x/y", "/r/x" }, remoteFiles) };
+
+    ESCAPEMENT_CHECK(branches.size() == 1);
+    if (branches.size() == 1) {
+        ESCAPEMENT_CHECK(branches[0].root == "/r/x");
+        ESCAPEMENT_CHECK(branches[0].fileList.size() == 3);
+    }
+
+}
+
+//
+// Entries of unknown type never head a branch
+//
+
+static void testUnknownEntries(void) {
+
+    FileInfoMap remoteFiles;
+
+    std::deque<DeleteBranch> branches { splitIntoBranches({ "/r/gone/1", "/r/gone" }, remoteFiles) };
+
+    ESCAPEMENT_CHECK(branches.size() == 1);
+    if (branches.size() == 1) {
+        ESCAPEMENT_CHECK(branches[0].root.empty());
+        ESCAPEMENT_CHECK(branches[0].fileList.size() == 2);
+    }
+
+}
+
+// ============================
+// ===== MAIN ENTRY POint =====
+// ============================
+
+int main(void) {
+
+    testSubtreeBranches();
+    testNestedSubtree();
+    testUnknownEntries();
+
+    return (Escapement_Test::failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
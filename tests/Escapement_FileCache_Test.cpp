@@ -0,0 +1,84 @@
+//
+// Program: Escapement_FileCache_Test
+//
+// Description: Unit tests for file cache sharding (shardOf): a remote path's shard
+// depends only on its top-level directory below the remote directory.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <set>
+
+//
+// Escapement components
+//
+
+#include "Escapement_FileCache.hpp"
+#include "Escapement_Test.hpp"
+
+// =======
+// IMPORTS
+// =======
+
+using namespace Escapement_FileCache;
+
+// ===============
+// LOCAL FUNCTIONS
+// ===============
+
+//
+// A subtree (and its top-level directory) always lives in one shard
+//
+
+static void testSubtreeShard(void) {
+
+    int shard { shardOf("/remote", "/remote/photos") };
+
+    ESCAPEMENT_CHECK(shardOf("/remote", "/remote/photos/2020/a.jpg") == shard);
+    ESCAPEMENT_CHECK(shardOf("/remote", "/remote/photos/b.jpg") == shard);
+    ESCAPEMENT_CHECK(shardOf("/remote", "/remote//photos/c.jpg") == shard);
+    ESCAPEMENT_CHECK(shardOf("/other", "/other/photos/d.jpg") == shard);
+
+}
+
+//
+// Shards are in range and top-level directories spread over more than one
+//
+
+static void testShardSpread(void) {
+
+    std::set<int> shards;
+
+    for (int directory = 0; directory < 64; directory++) {
+        int shard { shardOf("/remote", "/remote/directory" + std::to_string(directory) + "/file") };
+        ESCAPEMENT_CHECK(shard >= 0);
+        shards.insert(shard);
+    }
+
+    ESCAPEMENT_CHECK(shards.size() > 1);
+
+}
+
+// ============================
+// ===== MAIN ENTRY POint =====
+// ============================
+
+int main(void) {
+
+    testSubtreeShard();
+    testShardSpread();
+
+    return (Escapement_Test::failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
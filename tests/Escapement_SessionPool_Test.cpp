@@ -0,0 +1,299 @@
+//
+// Program: Escapement_SessionPool_Test
+//
+// Description: Unit tests for the session pool fair share ordering (isServedBefore):
+// a job below its minimum connections is served first, otherwise the job that has
+// had the least work for its weight. Two jobs are then driven through the pool's
+// grant decisions against a server with a session limit: waiting for a session,
+// idle job catch up, checkpoint handoff and the maximum sessions a job may hold.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// Escapement components
+//
+
+#include "Escapement_SessionPool.hpp"
+#include "Escapement_Test.hpp"
+
+// =======
+// IMPORTS
+// =======
+
+using namespace Escapement_SessionPool;
+
+// ===========================
+// PRIVATE TYPES AND CONSTANTS
+// ===========================
+
+//
+// Server sessions as the pool counts them (without any real sessions)
+//
+
+struct TestServer {
+    JobShares jobShares;        // Shares by job name
+    int sessionLimit { 0 };     // Most sessions open (serverConnections)
+    int sessionCount { 0 };     // Sessions open (idle or in use)
+    int idleSessions { 0 };     // Sessions handed back
+};
+
+//
+// Bytes charged for a large file
+//
+
+static const std::uint64_t kLargeFile { 100 * 1024 * 1024 };
+
+// ===============
+// LOCAL FUNCTIONS
+// ===============
+
+//
+// Return true if server has a session free
+//
+
+static bool isSessionFree(const TestServer &server) {
+
+    return ((server.idleSessions != 0) || (server.sessionCount < server.sessionLimit));
+
+}
+
+//
+// Grant a queued lane of job a session (an idle one if there is one)
+//
+
+static void takeSession(TestServer &server, JobShare &job) {
+
+    grantSession(job);
+
+    if (server.idleSessions != 0) {
+        server.idleSessions--;
+    } else {
+        server.sessionCount++;
+    }
+
+}
+
+//
+// Queue a lane of job and grant it a session if it is due one; return true if granted
+//
+
+static bool requestSession(TestServer &server, JobShare &job) {
+
+    queueForSession(server.jobShares, job);
+
+    if (!isSessionDue(server.jobShares, job, isSessionFree(server))) {
+        return (false);
+    }
+
+    takeSession(server, job);
+
+    return (true);
+
+}
+
+//
+// Hand a session held by job back to the server
+//
+
+static void releaseSession(TestServer &server, JobShare &job) {
+
+    job.activeSessions--;
+    server.idleSessions++;
+
+}
+
+//
+// Return job share with a minimum and work done
+//
+
+static JobShare jobShare(int minSessions, double virtualTime) {
+
+    JobShare job;
+
+    job.minSessions = minSessions;
+    job.virtualTime = virtualTime;
+
+    return (job);
+
+}
+
+//
+// Job with less work for its weight goes first
+//
+
+static void testLeastWorkFirst(void) {
+
+    JobShare busyJob { jobShare(0, 200.0) };
+    JobShare idleJob { jobShare(0, 100.0) };
+
+    ESCAPEMENT_CHECK(isServedBefore(idleJob, 1, busyJob, 1));
+    ESCAPEMENT_CHECK(!isServedBefore(busyJob, 1, idleJob, 1));
+    ESCAPEMENT_CHECK(!isServedBefore(idleJob, 1, idleJob, 1));
+
+}
+
+//
+// Job below its minimum goes first whatever its work; once both are at their minimum
+// the work done decides again
+//
+
+static void testMinimumFirst(void) {
+
+    JobShare busyJob { jobShare(2, 200.0) };
+    JobShare idleJob { jobShare(1, 100.0) };
+
+    ESCAPEMENT_CHECK(isServedBefore(busyJob, 1, idleJob, 1));
+    ESCAPEMENT_CHECK(!isServedBefore(idleJob, 1, busyJob, 1));
+    ESCAPEMENT_CHECK(isServedBefore(idleJob, 1, busyJob, 2));
+    ESCAPEMENT_CHECK(isServedBefore(idleJob, 0, busyJob, 1));
+
+}
+
+//
+// Lanes wait once the server is at its session limit; a session handed back goes to
+// the waiting job charged least, not to the job that handed it back
+//
+
+static void testWaitForSession(void) {
+
+    TestServer server;
+    server.sessionLimit = 2;
+    JobShare &busyJob { server.jobShares["busy"] };
+    JobShare &newJob { server.jobShares["new"] };
+
+    ESCAPEMENT_CHECK(requestSession(server, busyJob));
+    ESCAPEMENT_CHECK(requestSession(server, busyJob));
+    ESCAPEMENT_CHECK(!requestSession(server, busyJob));
+    ESCAPEMENT_CHECK(!requestSession(server, newJob));
+    ESCAPEMENT_CHECK(server.sessionCount == 2);
+
+    chargeJob(busyJob, kLargeFile);
+    releaseSession(server, busyJob);
+
+    ESCAPEMENT_CHECK(isSessionDue(server.jobShares, newJob, isSessionFree(server)));
+    ESCAPEMENT_CHECK(!isSessionDue(server.jobShares, busyJob, isSessionFree(server)));
+
+    takeSession(server, newJob);
+
+    ESCAPEMENT_CHECK(!isSessionDue(server.jobShares, busyJob, isSessionFree(server)));
+    ESCAPEMENT_CHECK(server.sessionCount == 2);
+    ESCAPEMENT_CHECK(server.idleSessions == 0);
+
+}
+
+//
+// A job that has been idle starts level with the least served active job rather than
+// claiming its idle time as credit; with no other job active it keeps its own time
+//
+
+static void testIdleCatchUp(void) {
+
+    TestServer server;
+    server.sessionLimit = 2;
+    JobShare &busyJob { server.jobShares["busy"] };
+    JobShare &idleJob { server.jobShares["idle"] };
+
+    ESCAPEMENT_CHECK(requestSession(server, idleJob));
+    releaseSession(server, idleJob);
+    double idleTime { idleJob.virtualTime };
+
+    ESCAPEMENT_CHECK(requestSession(server, busyJob));
+    chargeJob(busyJob, kLargeFile);
+    chargeJob(busyJob, kLargeFile);
+
+    ESCAPEMENT_CHECK(requestSession(server, idleJob));
+    ESCAPEMENT_CHECK(idleJob.virtualTime == busyJob.virtualTime);
+    ESCAPEMENT_CHECK(idleJob.virtualTime > idleTime);
+
+    TestServer quietServer;
+    JobShare &soleJob { quietServer.jobShares["sole"] };
+    soleJob.virtualTime = 10.0;
+    queueForSession(quietServer.jobShares, soleJob);
+    ESCAPEMENT_CHECK(soleJob.virtualTime == 10.0);
+
+}
+
+//
+// A checkpoint hands the session on only when another job is waiting, may take it and
+// is now served first (a job below its minimum keeps its session)
+//
+
+static void testCheckpointHandoff(void) {
+
+    TestServer server;
+    server.sessionLimit = 1;
+    JobShare &holdingJob { server.jobShares["holding"] };
+    JobShare &waitingJob { server.jobShares["waiting"] };
+
+    ESCAPEMENT_CHECK(requestSession(server, holdingJob));
+    chargeJob(holdingJob, kLargeFile);
+    ESCAPEMENT_CHECK(!isHandoffDue(server.jobShares, holdingJob));
+
+    ESCAPEMENT_CHECK(!requestSession(server, waitingJob));
+    ESCAPEMENT_CHECK(!isHandoffDue(server.jobShares, holdingJob));
+
+    chargeJob(holdingJob, kLargeFile);
+    ESCAPEMENT_CHECK(isHandoffDue(server.jobShares, holdingJob));
+
+    waitingJob.maxSessions = 1;
+    waitingJob.activeSessions = 1;
+    ESCAPEMENT_CHECK(!isHandoffDue(server.jobShares, holdingJob));
+    waitingJob.activeSessions = 0;
+
+    holdingJob.minSessions = 1;
+    ESCAPEMENT_CHECK(!isHandoffDue(server.jobShares, holdingJob));
+    holdingJob.minSessions = 0;
+
+    releaseSession(server, holdingJob);
+    ESCAPEMENT_CHECK(isSessionDue(server.jobShares, waitingJob, isSessionFree(server)));
+    takeSession(server, waitingJob);
+    ESCAPEMENT_CHECK(server.sessionCount == 1);
+
+}
+
+//
+// A job at its maximum is not granted another session even with sessions free, and
+// does not hold back a job below its own
+//
+
+static void testMaxSessions(void) {
+
+    TestServer server;
+    server.sessionLimit = 4;
+    JobShare &cappedJob { server.jobShares["capped"] };
+    JobShare &otherJob { server.jobShares["other"] };
+    cappedJob.maxSessions = 1;
+    otherJob.virtualTime = 1000.0 * kLargeFile;
+
+    ESCAPEMENT_CHECK(requestSession(server, cappedJob));
+    ESCAPEMENT_CHECK(!requestSession(server, cappedJob));
+    ESCAPEMENT_CHECK(requestSession(server, otherJob));
+    ESCAPEMENT_CHECK(requestSession(server, otherJob));
+    ESCAPEMENT_CHECK(cappedJob.activeSessions == 1);
+    ESCAPEMENT_CHECK(otherJob.activeSessions == 2);
+
+}
+
+// ============================
+// ===== MAIN ENTRY POint =====
+// ============================
+
+int main(void) {
+
+    testLeastWorkFirst();
+    testMinimumFirst();
+    testWaitForSession();
+    testIdleCatchUp();
+    testCheckpointHandoff();
+    testMaxSessions();
+
+    return (Escapement_Test::failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}
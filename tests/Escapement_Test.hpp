@@ -0,0 +1,59 @@
+#ifndef ESCAPEMENT_TEST_HPP
+#define ESCAPEMENT_TEST_HPP
+
+//
+// C++ STL
+//
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+//
+// Linux
+//
+
+#include <unistd.h>
+
+// =========
+// NAMESPACE
+// =========
+
+namespace Escapement_Test {
+
+    //
+    // Checks failed by test program (non-zero exit status if any)
+    //
+
+    inline int failedChecks { 0 };
+
+    //
+    // Report a check that failed
+    //
+
+    inline void check(bool passed, const char *condition, const char *file, int line) {
+        if (!passed) {
+            std::cerr << file << ":" << line << ": check failed [" << condition << "]" << std::endl;
+            failedChecks++;
+        }
+    }
+
+    //
+    // Create a scratch directory for test files (removed by caller)
+    //
+
+    inline std::string makeTestDirectory(void) {
+        char testDirectory[] { "/tmp/escapement_testXXXXXX" };
+        if (mkdtemp(testDirectory) == nullptr) {
+            std::cerr << "Could not create test directory." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        return (testDirectory);
+    }
+
+} // namespace Escapement_Test
+
+#define ESCAPEMENT_CHECK(condition) Escapement_Test::check((condition), #condition, __FILE__, __LINE__)
+
+#endif /* ESCAPEMENT_TEST_HPP */
+
@@ -0,0 +1,109 @@
+//
+// Program: Escapement_Transfer_Test
+//
+// Description: Unit tests for the size aware transfer queue (buildTransferQueue):
+// files below the small file threshold or of unknown size go to the small file lane
+// in list order and the rest to the large file lane largest first.
+//
+// Dependencies:
+//
+// C11++              : Use of C11++ features.
+//
+
+// =============
+// INCLUDE FILES
+// =============
+
+//
+// C++ STL
+//
+
+#include <string>
+#include <deque>
+
+//
+// Escapement components
+//
+
+#include "Escapement_Transfer.hpp"
+#include "Escapement_Test.hpp"
+
+// =======
+// IMPORTS
+// =======
+
+using namespace Escapement;
+using namespace Escapement_Transfer;
+
+// ===============
+// LOCAL FUNCTIONS
+// ===============
+
+//
+// Return file information for a file of a given size
+//
+
+static FileInfo sizedFile(std::int64_t size) {
+
+    FileInfo fileInfo;
+
+    fileInfo.size = size;
+
+    return (fileInfo);
+
+}
+
+//
+// Files split between lanes by size (unknown/unlisted sizes small, threshold large)
+//
+
+static void testLaneSplit(void) {
+
+    FileInfoMap fileInfoMap;
+    TransferQueue transferQueue;
+
+    fileInfoMap["/r/small"] = sizedFile(10);
+    fileInfoMap["/r/unknown"] = FileInfo();
+    fileInfoMap["/r/threshold"] = sizedFile(100);
+    fileInfoMap["/r/large"] = sizedFile(5000);
+
+    buildTransferQueue({ "/r/small", "/r/unknown", "/r/threshold", "/r/unlisted", "/r/large" }, fileInfoMap, 100, transferQueue);
+
+    ESCAPEMENT_CHECK((transferQueue.smallFiles == std::deque<std::string> { "/r/small", "/r/unknown", "/r/unlisted" }));
+    ESCAPEMENT_CHECK((transferQueue.largeFiles == std::deque<std::string> { "/r/large", "/r/threshold" }));
+
+}
+
+//
+// Large files ordered largest first, equal sizes keeping list order
+//
+
+static void testLargestFirst(void) {
+
+    FileInfoMap fileInfoMap;
+    TransferQueue transferQueue;
+
+    fileInfoMap["/r/a"] = sizedFile(1000);
+    fileInfoMap["/r/b"] = sizedFile(3000);
+    fileInfoMap["/r/c"] = sizedFile(1000);
+    fileInfoMap["/r/d"] = sizedFile(2000);
+
+    buildTransferQueue({ "/r/a", "/r/b", "/r/c", "/r/d" }, fileInfoMap, 0, transferQueue);
+
+    ESCAPEMENT_CHECK(transferQueue.smallFiles.empty());
+    ESCAPEMENT_CHECK((transferQueue.largeFiles == std::deque<std::string> { "/r/b", "/r/d", "/r/a", "/r/c" }));
+
+}
+
+// ============================
+// ===== MAIN ENTRY POint =====
+// ============================
+
+int main(void) {
+
+    testLaneSplit();
+    testLargestFirst();
+
+    return (Escapement_Test::failedChecks == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+
+}